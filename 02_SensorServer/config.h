@@ -41,8 +41,8 @@ int write_to_pipe(const char *message);
  * @param pipe_fd The file descriptor for the pipe's read end.
  * @param buffer The buffer to store the read data.
  * @param size The size of the buffer.
- * @param timeout_sec The timeout in seconds for the read operation.
- * @return Number of bytes read on success, 0 on timeout, -1 on failure.
+ * @param timeout_sec The timeout in seconds for the read operation, -1 to wait without a timeout.
+ * @return Number of bytes read on success, 0 on timeout, -1 on failure or once all write ends are closed.
  */
 ssize_t read_from_pipe(char *buffer, ssize_t size, int timeout_sec);
 
@@ -1,103 +1,1372 @@
+#define _GNU_SOURCE
+
 #include "connmgr.h"
 #include "sbuffer.h"
 #include "lib/tcpsock.h"
+#include "uring.h"
+#include "protocol.h"
+#include "timerwheel.h"
 #include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 #define BUFFER_SIZE 1024
+#define RECORD_SIZE PROTOCOL_RECORD_SIZE    // bytes of a legacy measurement, and of the hello of the framed protocol
+#define READ_RECORDS 256            // measurements taken from a connection at once
+
+// Protocol spoken on a connection, see protocol.h
+#define CONNECTION_HANDSHAKE 0      // nothing received yet, the first record tells a hello from a legacy measurement
+#define CONNECTION_LEGACY 1
+#define CONNECTION_FRAMED 2
+#define REACTOR_EVENTS 64           // events handled per epoll_wait
+#define ACCEPT_BATCH 32             // connections accepted at once with accept4
+#define URING_ENTRIES 256           // submission queue entries of the io_uring
+#define URING_BUFFERS 256           // provided receive buffers shared by all connections, a power of two
+#define URING_BUFFER_SIZE 4096
+#define URING_BUFFER_GROUP 0
+#define URING_ACCEPT 0              // user data of the accept on the TCP server socket, the receives carry their connection_t
+#define URING_CANCEL 1              // user data of the requests cancelling an accept
+#define URING_STOP 2                // user data of the poll on the stop event
+#define URING_ACCEPT_LOCAL 3        // user data of the accept on the Unix domain socket
+#define LISTENERS 2                 // the TCP server socket, and the Unix domain socket if one is configured
+
+// A Sensor Node that sends nothing for TIMEOUT seconds is disconnected, the Makefile sets it with -DTIMEOUT
+#ifndef TIMEOUT
+#define TIMEOUT 5
+#endif
+#define IDLE_TIMEOUT_MS (TIMEOUT * 1000ULL)
+#define IDLE_TICK_MS 100            // resolution of the idle timers, a connection times out at most this much late
+#define STATS_SAMPLE_SECONDS 1      // a connection that receives data samples the transport statistics of its socket this often
+
+// The statistics of a connection are written by the thread serving it only, and read by the statistics thread
+#define STAT_ADD(field, n) __atomic_store_n(&(field), (field) + (n), __ATOMIC_RELAXED)
+#define STAT_SET(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+#define STAT_GET(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
 
-static int client_count = 0;
+static int client_count = 0;       // Sensor Nodes connected so far (CONNMGR_LIMIT_TOTAL) or connected right now
+static int reserved = 0;           // slots taken by accepts that are in progress, not in client_count yet
+static int active_clients = 0;     // client handler threads that are still running
+static int timeouts = 0;           // connections closed because their Sensor Node was silent for TIMEOUT seconds
+static unsigned long accepted = 0; // connections served since the start
+static unsigned long refused = 0;  // connections closed right away because all slots were taken
 static int max_connections;
+static int limit;                  // one of the CONNMGR_LIMIT_* values
+static int draining = 0;           // set once the stop event arrived, a connection accepted after it is drained right away
+static int wake_fd = -1;           // wakes the Connection Manager thread once all slots are taken (CONNMGR_LIMIT_TOTAL) or a slot frees up
 static pthread_mutex_t count_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t clients_done = PTHREAD_COND_INITIALIZER;
+
+
+/**
+ * Ingest statistics of a Sensor Node connection
+ * Every field is accessed with STAT_*, so a dump from another thread reads whole values, though not one consistent snapshot
+ *
+ * @param records Measurements received
+ * @param bytes Bytes taken from the connection, the hello and the frame headers included
+ * @param parse_errors Protocol violations: an invalid hello or frame header
+ * @param last_seen Wall clock time data was last taken from the connection, 0 if none yet
+ * @param sampled Wall clock time 'info' was last sampled, 0 if never
+ * @param info Last sample of the transport statistics of the socket
+ * @param peak_queue Deepest receive queue of all samples, in bytes
+ */
+typedef struct {
+    unsigned long records;
+    unsigned long bytes;
+    unsigned long parse_errors;
+    time_t last_seen;
+    time_t sampled;
+    tcpsock_info_t info;
+    unsigned int peak_queue;
+} connection_stats_t;
+
+/**
+ * Structure storing the state of a Sensor Node connection
+ *
+ * @param socket Client Socket struct
+ * @param client_id Client Node ID, revealed by the first measurement
+ * @param client_id_established Set once the first measurement was received
+ * @param protocol One of the CONNECTION_* protocols
+ * @param frame_id Sensor ID of the frame that is being received (CONNECTION_FRAMED)
+ * @param frame_remaining Readings of that frame that weren't received yet, 0 between frames (CONNECTION_FRAMED)
+ * @param fed Set if the data of the connection is received by io_uring and fed to the socket, instead of read from it
+ * @param timer Idle timer of the connection (epoll and io_uring)
+ * @param last_active Time in milliseconds the connection last received data (epoll and io_uring)
+ * @param stats Ingest statistics of the connection
+ * @param next Next open connection, all of them are listed so a stop can drain them
+ * @param prev Previous open connection
+ */
+typedef struct connection {
+    tcpsock_t *socket;
+    int client_id;
+    int client_id_established;
+    int protocol;
+    sensor_id_t frame_id;
+    int frame_remaining;
+    int fed;
+    wheel_timer_t timer;
+    uint64_t last_active;
+    connection_stats_t stats;
+    struct connection *next;
+    struct connection *prev;
+} connection_t;
+
+static connection_t *open_connections = NULL;  // protected by count_mutex
 
+/**
+ * Idle timers of the connections served by a single thread
+ *
+ * Receiving data only notes the time in the connection, the timer isn't moved. Once a timer expires, it is scheduled
+ * again for the rest of the timeout if the connection received data in the meantime, so a busy connection costs a
+ * store per wakeup and a reschedule per TIMEOUT seconds.
+ *
+ * @param wheel Timer wheel with the timer of every connection
+ * @param now Time in milliseconds the thread last woke up
+ */
+typedef struct {
+    timer_wheel_t wheel;
+    uint64_t now;
+} idle_timers_t;
 
 /**
  * Structure storing Client Arguments
  *
  * @param buffer SPointer to the Shared Buffer
- * @param client_socket Client Socket struct
- * @param client_id Client Node ID
+ * @param connection The connection served by the client thread
  */
 typedef struct {
     sbuffer_t *buffer;
-    tcpsock_t *client_socket;
+    connection_t *connection;
 } client_args_t;
 
-// Client handler thread function
-void *handle_client(void *args) {
-    client_args_t *client_args = (client_args_t *)args;
-    tcpsock_t *client_socket = client_args->client_socket;
-    sbuffer_t *buffer = client_args->buffer;
-    int client_id = 0;
-    int client_id_established = 0;
-    sensor_data_t data;
+/**
+ * Structure storing a Reactor
+ *
+ * @param thread Reactor thread
+ * @param buffer Pointer to the Shared Buffer
+ * @param listeners SO_REUSEPORT server socket the reactor accepts its own connections on, and the Unix domain socket
+ *                  (first reactor only), NULL if the reactor has no such listener or stopped accepting
+ * @param epoll_fd Epoll instance watching the listeners and all connections of the reactor
+ * @param wake_fd Eventfd waking the reactor to resume its paused listeners, or to stop if 'stop' is set
+ * @param stop Set before the wake to stop accepting and to exit once all connections of the reactor are closed
+ * @param paused Set while the listeners aren't watched because all slots are taken
+ * @param connections Number of open connections of the reactor
+ * @param idle Idle timers of the connections of the reactor, the wait of epoll ends in time for the next one
+ */
+typedef struct {
+    pthread_t thread;
+    sbuffer_t *buffer;
+    tcpsock_t *listeners[LISTENERS];
+    int epoll_fd;
+    int wake_fd;
+    int stop;
+    int paused;
+    int connections;
+    idle_timers_t idle;
+} reactor_t;
 
-    // Update client counter
+static connection_t *connection_create(tcpsock_t *socket) {
+    connection_t *connection = malloc(sizeof(connection_t));
+    if (!connection) return NULL;
+    connection->socket = socket;
+    connection->client_id = 0;
+    connection->client_id_established = 0;
+    connection->protocol = CONNECTION_HANDSHAKE;
+    connection->frame_id = 0;
+    connection->frame_remaining = 0;
+    connection->fed = 0;
+    connection->timer.next = connection->timer.prev = NULL;
+    connection->timer.data = connection;
+    connection->last_active = 0;
+    memset(&connection->stats, 0, sizeof(connection->stats));
+    connection->next = connection->prev = NULL;
+    return connection;
+}
+
+// Checks if a slot is free for another connection
+static int accepting_more(void) {
+    pthread_mutex_lock(&count_mutex);
+    int more = client_count + reserved < max_connections;
+    pthread_mutex_unlock(&count_mutex);
+    return more;
+}
+
+// Wakes the Connection Manager thread, it checks for itself what changed
+static void connmgr_wake(void) {
+    uint64_t value = 1;
+    if (wake_fd >= 0 && write(wake_fd, &value, sizeof(value)) < 0) perror("[ERROR] Writing wake event failed");
+}
+
+/**
+ * Reserves up to 'wanted' slots for connections that are about to be accepted
+ * \return the number of reserved slots, 0 if all slots are taken
+ */
+static int connection_reserve(int wanted) {
+    pthread_mutex_lock(&count_mutex);
+    int free = max_connections - client_count - reserved;
+    int slots = free < wanted ? (free > 0 ? free : 0) : wanted;
+    reserved += slots;
+    pthread_mutex_unlock(&count_mutex);
+    return slots;
+}
+
+// Gives back 'slots' reserved slots that no connection was accepted for
+static void connection_unreserve(int slots) {
+    if (slots <= 0) return;
+    pthread_mutex_lock(&count_mutex);
+    int was_full = client_count + reserved >= max_connections;
+    reserved -= slots;
+    pthread_mutex_unlock(&count_mutex);
+    if (was_full && limit != CONNMGR_LIMIT_TOTAL) connmgr_wake();
+}
+
+// Counts an accepted connection in the slot reserved for it
+static void connection_count(void) {
     pthread_mutex_lock(&count_mutex);
+    reserved--;
     client_count++;
+    accepted++;
+    int reached = limit == CONNMGR_LIMIT_TOTAL && client_count >= max_connections;
     pthread_mutex_unlock(&count_mutex);
+    if (reached) connmgr_wake();
+}
 
-    char message[BUFFER_SIZE];
+// Frees the slot of a closed connection, only the long-running limits hand it out again
+static void connection_release(void) {
+    if (limit == CONNMGR_LIMIT_TOTAL) return;
+    pthread_mutex_lock(&count_mutex);
+    int was_full = client_count + reserved >= max_connections;
+    client_count--;
+    pthread_mutex_unlock(&count_mutex);
+    if (was_full) connmgr_wake();
+}
 
-    while (1) {
-        int bytes = sizeof(data.id);
-        if (tcp_receive(client_socket, &data.id, &bytes) != TCP_NO_ERROR) break;
+// Writes the peer of 'socket' to 'peer': "<ip>:<port>", or "local <path>" for a connection on the Unix domain socket
+static void connection_peer(tcpsock_t *socket, char *peer, size_t size) {
+    char *address = NULL;
+    int port = 0, family = AF_INET;
+    tcp_get_ip_addr(socket, &address);
+    tcp_get_port(socket, &port);
+    tcp_get_family(socket, &family);
+    if (family == AF_UNIX) snprintf(peer, size, "local %s", address);
+    else snprintf(peer, size, "%s:%d", address, port);
+}
 
-        bytes = sizeof(data.value);
-        if (tcp_receive(client_socket, &data.value, &bytes) != TCP_NO_ERROR) break;
+// Samples the transport statistics of the socket of 'connection' at wall clock time 'now', by the thread serving it
+static void connection_sample(connection_t *connection, time_t now) {
+    tcpsock_info_t info;
+    STAT_SET(connection->stats.sampled, now);
+    if (tcp_get_info(connection->socket, &info) != TCP_NO_ERROR) return;
+    STAT_SET(connection->stats.info.rtt_us, info.rtt_us);
+    STAT_SET(connection->stats.info.rtt_var_us, info.rtt_var_us);
+    STAT_SET(connection->stats.info.retransmits, info.retransmits);
+    STAT_SET(connection->stats.info.receive_queue, info.receive_queue);
+    if (info.receive_queue > connection->stats.peak_queue) STAT_SET(connection->stats.peak_queue, info.receive_queue);
+}
 
-        bytes = sizeof(data.ts);
-        if (tcp_receive(client_socket, &data.ts, &bytes) != TCP_NO_ERROR) break;
+// Counts 'bytes' taken from 'connection', and samples its socket if the last sample is STATS_SAMPLE_SECONDS old
+static void connection_taken(connection_t *connection, int bytes) {
+    time_t now = time(NULL);
+    STAT_ADD(connection->stats.bytes, bytes);
+    STAT_SET(connection->stats.last_seen, now);
+    if (now - connection->stats.sampled >= STATS_SAMPLE_SECONDS) connection_sample(connection, now);
+}
 
-        // Check if Sensor Node has an already established ID
-        if (client_id_established == 0) {
-            // Identity Reveal!!
-            client_id = data.id;
-            client_id_established = 1;
-            // LOG
-            snprintf(message, BUFFER_SIZE,
-                        "Sensor Node %2d has opened a new connection", client_id);
-            write_to_pipe(message);
+// Writes the statistics of 'connection' to 'message' as of wall clock time 'now', safe from any thread while it is open
+static void connection_describe(connection_t *connection, char *message, size_t size, time_t now) {
+    char peer[BUFFER_SIZE / 2];
+    connection_peer(connection->socket, peer, sizeof(peer));
+    time_t last_seen = STAT_GET(connection->stats.last_seen);
+    unsigned int rtt_us = STAT_GET(connection->stats.info.rtt_us);
+
+    snprintf(message, size,
+             "Sensor Node %d (%s): %lu records, %lu bytes, %lu parse errors, last seen %lds ago, "
+             "rtt %u.%03u ms (var %u us), %u retransmits, receive queue %u bytes (peak %u)",
+             STAT_GET(connection->client_id), peer, STAT_GET(connection->stats.records),
+             STAT_GET(connection->stats.bytes), STAT_GET(connection->stats.parse_errors),
+             last_seen ? (long) (now - last_seen) : -1L, rtt_us / 1000, rtt_us % 1000,
+             STAT_GET(connection->stats.info.rtt_var_us), STAT_GET(connection->stats.info.retransmits),
+             STAT_GET(connection->stats.info.receive_queue), STAT_GET(connection->stats.peak_queue));
+}
+
+/**
+ * Logs the statistics of every open connection
+ * They are described under the registry lock, which keeps the connections from being closed meanwhile, and only
+ * logged after it is released so a slow pipe doesn't hold up connections that open or close
+ */
+static void connections_dump(void) {
+    typedef char description_t[BUFFER_SIZE - 32];
+    char message[BUFFER_SIZE];
+    time_t now = time(NULL);
+    int count = 0;
+
+    pthread_mutex_lock(&count_mutex);
+    for (connection_t *connection = open_connections; connection; connection = connection->next) count++;
+    description_t *descriptions = count > 0 ? malloc(count * sizeof(description_t)) : NULL;
+    if (descriptions) {
+        int described = 0;
+        for (connection_t *connection = open_connections; connection; connection = connection->next) {
+            connection_describe(connection, descriptions[described++], sizeof(description_t), now);
         }
+    }
+    pthread_mutex_unlock(&count_mutex);
+
+    // LOG
+    snprintf(message, BUFFER_SIZE, "Statistics of %d open Sensor Node connections", count);
+    write_to_pipe(message);
+    if (count > 0 && !descriptions) {
+        // LOG
+        write_to_pipe("Memory allocation for the connection statistics failed.");
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        // LOG
+        snprintf(message, BUFFER_SIZE, "Connection statistics: %s", descriptions[i]);
+        write_to_pipe(message);
+    }
+    free(descriptions);
+}
+
+/**
+ * Logs the new connection on 'socket', counts it in the slot reserved for it and creates its connection_t
+ * \return the connection, NULL if memory allocation failed, then 'socket' is closed and its slot freed
+ */
+static connection_t *connection_accept(tcpsock_t *socket) {
+    char message[BUFFER_SIZE];
+    char peer[BUFFER_SIZE / 2];
+    int sd;
+    connection_peer(socket, peer, sizeof(peer));
+    tcp_get_sd(socket, &sd);
 
+    // LOG
+    snprintf(message, BUFFER_SIZE, "New connection from %s", peer);
+    write_to_pipe(message);
+
+    connection_count();
+    connection_t *connection = connection_create(socket);
+    if (!connection) {
+        // LOG
+        snprintf(message, BUFFER_SIZE, "Memory allocation for connection from %s failed.", peer);
+        write_to_pipe(message);
+        tcp_close(&socket);
+        connection_release();
+        return NULL;
+    }
+
+    pthread_mutex_lock(&count_mutex);
+    connection->next = open_connections;
+    if (open_connections) open_connections->prev = connection;
+    open_connections = connection;
+    // Accepted while the others are drained already
+    if (draining) shutdown(sd, SHUT_RD);
+    pthread_mutex_unlock(&count_mutex);
+    return connection;
+}
+
+// Closes the connection on 'socket' right away, because all slots are taken
+static void connection_refuse(tcpsock_t *socket) {
+    char message[BUFFER_SIZE];
+    char peer[BUFFER_SIZE / 2];
+    connection_peer(socket, peer, sizeof(peer));
+
+    // LOG
+    snprintf(message, BUFFER_SIZE, "Refused connection from %s, all %d slots are taken", peer, max_connections);
+    write_to_pipe(message);
+
+    pthread_mutex_lock(&count_mutex);
+    refused++;
+    pthread_mutex_unlock(&count_mutex);
+    tcp_close(&socket);
+}
+
+/**
+ * Accepts a batch of the connections queued on the non-blocking 'listener', as many as there are free slots
+ * With CONNMGR_LIMIT_REJECT the connections beyond the free slots are accepted as well and refused right away
+ * \param connections an array of ACCEPT_BATCH connections, filled out with the accepted ones, NULL for those that failed
+ * \param nonblocking create the connections in non-blocking mode
+ * \return the number of accepted connections, 0 if none is queued or no slot is free, -1 if accepting failed
+ */
+static int connections_accept(tcpsock_t *listener, connection_t **connections, int nonblocking) {
+    char message[BUFFER_SIZE];
+    tcpsock_t *sockets[ACCEPT_BATCH];
+    int slots = connection_reserve(ACCEPT_BATCH);
+    int count = limit == CONNMGR_LIMIT_REJECT ? ACCEPT_BATCH : slots;
+    if (count == 0) return 0;
+
+    int result = tcp_accept_batch(listener, sockets, &count, nonblocking);
+    if (count < slots) connection_unreserve(slots - count);
+    if (result == TCP_WOULD_BLOCK) return 0;
+    if (result != TCP_NO_ERROR) {
         // LOG
         snprintf(message, BUFFER_SIZE,
-                 "Received new data from Sensor Node %d {id: %d, value: %.2f, ts: %ld}",
-                 client_id, data.id, data.value, data.ts);
+                 "Failed to accept Sensor Node connection. Errno: %d (%s)", errno, strerror(errno));
         write_to_pipe(message);
+        return -1;
+    }
+
+    for (int i = slots; i < count; i++) {
+        connection_refuse(sockets[i]);
+    }
+    if (count > slots) count = slots;
+    for (int i = 0; i < count; i++) {
+        connections[i] = connection_accept(sockets[i]);
+    }
+    return count;
+}
 
-        // Push data to shared buffer
-        sbuffer_insert(buffer, &data);
+// Stops receiving on all open connections, each is closed once the data it received already is handled
+static void connections_drain(void) {
+    char message[BUFFER_SIZE];
+    int count = 0;
+
+    pthread_mutex_lock(&count_mutex);
+    draining = 1;
+    for (connection_t *connection = open_connections; connection; connection = connection->next) {
+        int sd;
+        if (tcp_get_sd(connection->socket, &sd) == TCP_NO_ERROR && shutdown(sd, SHUT_RD) == 0) count++;
     }
+    pthread_mutex_unlock(&count_mutex);
 
     // LOG
-    snprintf(message, BUFFER_SIZE, "Sensor Node %d has closed the connection", client_id);
+    snprintf(message, BUFFER_SIZE, "Draining %d Sensor Node connections", count);
     write_to_pipe(message);
+}
+
+// Logs a measurement received on 'connection', the first one reveals the ID of the Sensor Node
+static void connection_received(connection_t *connection, const sensor_data_t *data) {
+    char message[BUFFER_SIZE];
 
-    tcp_close(&client_socket);
+    // Check if Sensor Node has an already established ID
+    if (connection->client_id_established == 0) {
+        // Identity Reveal!!
+        STAT_SET(connection->client_id, data->id);
+        connection->client_id_established = 1;
+        // LOG
+        snprintf(message, BUFFER_SIZE,
+                 "Sensor Node %2d has opened a new connection", connection->client_id);
+        write_to_pipe(message);
+    }
+
+    // LOG
+    snprintf(message, BUFFER_SIZE,
+             "Received new data from Sensor Node %d {id: %d, value: %.2f, ts: %ld}",
+             connection->client_id, data->id, data->value, data->ts);
+    write_to_pipe(message);
+}
+
+// Closes the socket of 'connection' and frees it, after logging a summary of its statistics
+static void connection_close(connection_t *connection) {
+    char message[BUFFER_SIZE];
+    char description[BUFFER_SIZE - 32];
+    time_t now = time(NULL);
+
+    // LOG
+    snprintf(message, BUFFER_SIZE, "Sensor Node %d has closed the connection", connection->client_id);
+    write_to_pipe(message);
+
+    connection_sample(connection, now);
+    connection_describe(connection, description, sizeof(description), now);
+    // LOG
+    snprintf(message, BUFFER_SIZE, "Connection summary: %s", description);
+    write_to_pipe(message);
+
+    // Unlisted before its descriptor is closed, so a drain never shuts down a descriptor that is reused already
+    pthread_mutex_lock(&count_mutex);
+    if (connection->next) connection->next->prev = connection->prev;
+    if (connection->prev) connection->prev->next = connection->next;
+    else if (open_connections == connection) open_connections = connection->next;
+    pthread_mutex_unlock(&count_mutex);
+
+    tcp_close(&connection->socket);
+    free(connection);
+    connection_release();
+}
+
+// Logs and counts that the Sensor Node of 'connection' sent nothing for TIMEOUT seconds, the caller closes the connection
+static void connection_timed_out(connection_t *connection) {
+    char message[BUFFER_SIZE];
+
+    // LOG
+    snprintf(message, BUFFER_SIZE, "Sensor Node %d timed out after %d seconds without data", connection->client_id, TIMEOUT);
+    write_to_pipe(message);
+
+    pthread_mutex_lock(&count_mutex);
+    timeouts++;
+    pthread_mutex_unlock(&count_mutex);
+}
+
+static void idle_init(idle_timers_t *idle) {
+    idle->now = timer_wheel_clock();
+    timer_wheel_init(&idle->wheel, IDLE_TICK_MS, idle->now);
+}
+
+// Starts the idle timer of the new 'connection'
+static void idle_watch(idle_timers_t *idle, connection_t *connection) {
+    connection->last_active = idle->now;
+    timer_wheel_schedule(&idle->wheel, &connection->timer, IDLE_TIMEOUT_MS);
+}
+
+/**
+ * Checks the 'connection' whose idle timer expired, and schedules the timer again if it received data in the meantime
+ * \return 1 if the connection timed out, then it is logged and counted, 0 otherwise
+ */
+static int idle_expired(idle_timers_t *idle, connection_t *connection) {
+    uint64_t silent = idle->now - connection->last_active;
+    if (silent < IDLE_TIMEOUT_MS) {
+        timer_wheel_schedule(&idle->wheel, &connection->timer, IDLE_TIMEOUT_MS - silent);
+        return 0;
+    }
+    connection_timed_out(connection);
+    return 1;
+}
+
+// Decodes a measurement in the order a Sensor Node sends it: <sensor_id><temperature><timestamp>
+static void record_decode(const unsigned char *record, sensor_data_t *data) {
+    memcpy(&data->id, record, sizeof(data->id));
+    memcpy(&data->value, record + sizeof(data->id), sizeof(data->value));
+    memcpy(&data->ts, record + sizeof(data->id) + sizeof(data->value), sizeof(data->ts));
+}
+
+// Logs 'count' measurements received on 'connection' and inserts them into 'buffer' in one batch
+static void connection_insert(connection_t *connection, sbuffer_t *buffer, sensor_data_t *batch, int count) {
+    for (int i = 0; i < count; i++) {
+        connection_received(connection, &batch[i]);
+    }
+    if (count > 0) sbuffer_insert_batch(buffer, batch, count);
+    STAT_ADD(connection->stats.records, count);
+}
+
+/**
+ * Takes up to '*count' complete records of 'record_size' bytes from 'connection'
+ * A fed connection only returns what was fed to it already, TCP_WOULD_BLOCK once that holds no complete record
+ * \return the result of tcp_receive_records or tcp_feed_records
+ */
+static int connection_take(connection_t *connection, unsigned char *records, int record_size, int *count) {
+    int result;
+    if (!connection->fed) {
+        result = tcp_receive_records(connection->socket, records, record_size, count);
+    } else {
+        result = tcp_feed_records(connection->socket, NULL, 0, records, record_size, count);
+        if (result == TCP_NO_ERROR && *count == 0) result = TCP_WOULD_BLOCK;
+    }
+    if (result == TCP_NO_ERROR && *count > 0) connection_taken(connection, *count * record_size);
+    return result;
+}
+
+/**
+ * Answers the hello of a Sensor Node speaking 'version' of the framed protocol, switching the connection to frames
+ * \return TCP_NO_ERROR on success, an error if the version is invalid or the answer can't be sent
+ */
+static int connection_handshake(connection_t *connection, uint32_t version) {
+    char message[BUFFER_SIZE];
+    unsigned char hello[RECORD_SIZE];
+    int bytes = RECORD_SIZE;
+
+    if (version < 1) {
+        STAT_ADD(connection->stats.parse_errors, 1);
+        return TCP_SOCKOP_ERROR;
+    }
+    if (version > PROTOCOL_VERSION) version = PROTOCOL_VERSION;
+
+    // The answer is a single small record, it fits in the empty send buffer of a non-blocking socket
+    protocol_hello_encode(hello, version);
+    int result = tcp_send(connection->socket, hello, &bytes);
+    if (result != TCP_NO_ERROR) return result;
+    if (bytes != RECORD_SIZE) return TCP_SOCKOP_ERROR;
+
+    connection->protocol = CONNECTION_FRAMED;
+    // LOG
+    snprintf(message, BUFFER_SIZE, "New connection speaks the framed protocol, version %u", version);
+    write_to_pipe(message);
+    return TCP_NO_ERROR;
+}
+
+/**
+ * Receives the next piece of data of 'connection': the first record, a batch of legacy measurements, a frame header
+ * or a batch of readings of the current frame. The measurements are inserted into 'buffer' in one batch.
+ * On a blocking socket this waits until the piece is complete
+ * \return the result of tcp_receive_records, TCP_WOULD_BLOCK once the data of the connection is drained,
+ *         TCP_SOCKOP_ERROR if the Sensor Node violates the protocol
+ */
+static int connection_receive(connection_t *connection, sbuffer_t *buffer) {
+    char message[BUFFER_SIZE];
+    unsigned char records[READ_RECORDS * RECORD_SIZE];
+    sensor_data_t batch[READ_RECORDS];
+    int count = 1;
+    int result;
+
+    if (connection->protocol == CONNECTION_HANDSHAKE) {
+        uint32_t version;
+        result = connection_take(connection, records, RECORD_SIZE, &count);
+        if (result != TCP_NO_ERROR) return result;
+        if (protocol_hello_decode(records, &version)) return connection_handshake(connection, version);
+
+        // A legacy Sensor Node starts right away with its first measurement
+        connection->protocol = CONNECTION_LEGACY;
+        record_decode(records, &batch[0]);
+        connection_insert(connection, buffer, batch, 1);
+        return TCP_NO_ERROR;
+    }
+
+    if (connection->protocol == CONNECTION_LEGACY) {
+        count = READ_RECORDS;
+        result = connection_take(connection, records, RECORD_SIZE, &count);
+        for (int i = 0; i < count; i++) {
+            record_decode(records + i * RECORD_SIZE, &batch[i]);
+        }
+        connection_insert(connection, buffer, batch, count);
+        return result;
+    }
+
+    if (connection->frame_remaining == 0) {
+        uint16_t readings;
+        result = connection_take(connection, records, PROTOCOL_HEADER_SIZE, &count);
+        if (result != TCP_NO_ERROR) return result;
+        memcpy(&connection->frame_id, records, sizeof(connection->frame_id));
+        memcpy(&readings, records + sizeof(connection->frame_id), sizeof(readings));
+        if (connection->frame_id == PROTOCOL_HELLO_ID || readings > PROTOCOL_MAX_READINGS) {
+            // LOG
+            snprintf(message, BUFFER_SIZE, "Sensor Node %d sent an invalid frame {id: %d, readings: %d}",
+                     connection->client_id, connection->frame_id, readings);
+            write_to_pipe(message);
+            STAT_ADD(connection->stats.parse_errors, 1);
+            return TCP_SOCKOP_ERROR;
+        }
+        connection->frame_remaining = readings;
+        return TCP_NO_ERROR;
+    }
+
+    count = connection->frame_remaining < READ_RECORDS ? connection->frame_remaining : READ_RECORDS;
+    result = connection_take(connection, records, PROTOCOL_READING_SIZE, &count);
+    for (int i = 0; i < count; i++) {
+        const unsigned char *reading = records + i * PROTOCOL_READING_SIZE;
+        batch[i].id = connection->frame_id;
+        memcpy(&batch[i].value, reading, sizeof(batch[i].value));
+        memcpy(&batch[i].ts, reading + sizeof(batch[i].value), sizeof(batch[i].ts));
+    }
+    connection->frame_remaining -= count;
+    connection_insert(connection, buffer, batch, count);
+    return result;
+}
+
+/**
+ * Inserts all complete measurements in the 'size' bytes of 'data', received on 'connection' by io_uring, into 'buffer'
+ * Data that doesn't complete a measurement or frame header yet is kept in the socket until the next chunk arrives
+ * \return TCP_NO_ERROR while the connection is fine, an error if it has to be closed
+ */
+static int connection_feed(connection_t *connection, sbuffer_t *buffer, const void *data, int size) {
+    int none = 0;
+    int result = tcp_feed_records(connection->socket, data, size, NULL, 1, &none);
+
+    while (result == TCP_NO_ERROR) {
+        result = connection_receive(connection, buffer);
+    }
+    return result == TCP_WOULD_BLOCK ? TCP_NO_ERROR : result;
+}
+
+// Client handler thread function
+void *handle_client(void *args) {
+    client_args_t *client_args = (client_args_t *)args;
+    connection_t *connection = client_args->connection;
+    sbuffer_t *buffer = client_args->buffer;
+    int result;
+
+    // The blocking receive gives up after TIMEOUT seconds without data
+    if (tcp_set_receive_timeout(connection->socket, TIMEOUT) != TCP_NO_ERROR) {
+        write_to_pipe("Failed to set the receive timeout of a Sensor Node connection");
+    }
+
+    // Every wakeup hands everything the sensor has sent so far to the buffer
+    while ((result = connection_receive(connection, buffer)) == TCP_NO_ERROR);
+    if (result == TCP_WOULD_BLOCK) connection_timed_out(connection);
+
+    connection_close(connection);
     free(client_args);
 
+    pthread_mutex_lock(&count_mutex);
+    active_clients--;
+    pthread_cond_signal(&clients_done);
+    pthread_mutex_unlock(&count_mutex);
+
     pthread_exit(NULL);
 }
 
+/**
+ * Reads everything that is queued on the socket of 'connection' and inserts all complete measurements into 'buffer'
+ * The sockets are edge-triggered, so the reactor only hears about the connection again once new data arrives
+ * \return 0 while the connection is open, -1 once it is closed or broken
+ */
+static int connection_read(connection_t *connection, sbuffer_t *buffer) {
+    int result;
+    while ((result = connection_receive(connection, buffer)) == TCP_NO_ERROR);
+    return result == TCP_WOULD_BLOCK ? 0 : -1;
+}
+
+/**
+ * Hands the non-blocking 'connection' over to 'reactor'
+ * \return 0 on success, -1 if the connection couldn't be added
+ */
+static int reactor_add(reactor_t *reactor, connection_t *connection) {
+    int sd;
+    if (tcp_get_sd(connection->socket, &sd) != TCP_NO_ERROR) return -1;
+
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLRDHUP | EPOLLET,
+        .data.ptr = connection
+    };
+    if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, sd, &event) != 0) return -1;
+    reactor->connections++;
+    idle_watch(&reactor->idle, connection);
+    return 0;
+}
+
+// Removes 'connection' from 'reactor' and closes it
+static void reactor_remove(reactor_t *reactor, connection_t *connection) {
+    int sd;
+    tcp_get_sd(connection->socket, &sd);
+    epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, sd, NULL);
+    timer_wheel_cancel(&reactor->idle.wheel, &connection->timer);
+    connection_close(connection);
+    reactor->connections--;
+}
+
+// Closes the connection of the expired idle 'timer' of the reactor 'arg' if its Sensor Node was silent for too long
+static void reactor_expire(wheel_timer_t *timer, void *arg) {
+    reactor_t *reactor = (reactor_t *)arg;
+    connection_t *connection = (connection_t *)timer->data;
+    if (idle_expired(&reactor->idle, connection)) reactor_remove(reactor, connection);
+}
+
+// Returns the listener slot of 'reactor' that the epoll event data 'ptr' refers to, NULL if it refers to something else
+static tcpsock_t **reactor_listener(reactor_t *reactor, void *ptr) {
+    for (int i = 0; i < LISTENERS; i++) {
+        if (ptr == &reactor->listeners[i]) return &reactor->listeners[i];
+    }
+    return NULL;
+}
+
+// Watches the listeners of 'reactor' for new connections again (EPOLLIN), or pauses them (0)
+static void reactor_listen(reactor_t *reactor, uint32_t events) {
+    for (int i = 0; i < LISTENERS; i++) {
+        int sd;
+        if (!reactor->listeners[i] || tcp_get_sd(reactor->listeners[i], &sd) != TCP_NO_ERROR) continue;
+        struct epoll_event event = { .events = events, .data.ptr = &reactor->listeners[i] };
+        if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_MOD, sd, &event) == 0) reactor->paused = events == 0;
+    }
+}
+
+/**
+ * Accepts the connections queued on 'listener' of 'reactor' in batches and serves them from the reactor itself
+ * Once all slots are taken the listeners are paused, the connections queued on them wait until the reactor is woken up
+ */
+static void reactor_accept(reactor_t *reactor, tcpsock_t *listener) {
+    connection_t *connections[ACCEPT_BATCH];
+    int count;
+
+    // The listener is level-triggered, what is left after an error is accepted on the next wakeup
+    while ((count = connections_accept(listener, connections, 1)) > 0) {
+        for (int i = 0; i < count; i++) {
+            if (connections[i] && reactor_add(reactor, connections[i]) != 0) {
+                // LOG
+                write_to_pipe("Failed to add a new Sensor Node to a reactor");
+                connection_close(connections[i]);
+            }
+        }
+    }
+    if (limit != CONNMGR_LIMIT_REJECT && !accepting_more()) reactor_listen(reactor, 0);
+}
+
+// Closes the listeners of 'reactor', connections that are still queued on them are refused
+static void reactor_stop_accepting(reactor_t *reactor) {
+    for (int i = 0; i < LISTENERS; i++) {
+        int sd;
+        if (!reactor->listeners[i]) continue;
+        if (tcp_get_sd(reactor->listeners[i], &sd) == TCP_NO_ERROR) epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, sd, NULL);
+        tcp_close(&reactor->listeners[i]);
+    }
+}
+
+// Reactor thread function, accepts connections on its own listeners and serves them with its epoll instance
+void *reactor_logic(void *arg) {
+    reactor_t *reactor = (reactor_t *)arg;
+    struct epoll_event events[REACTOR_EVENTS];
+    int stopping = 0;
+
+    while (!stopping || reactor->connections > 0) {
+        // Without connections nothing can time out and the wait has no timeout
+        int timeout = timer_wheel_timeout(&reactor->idle.wheel, timer_wheel_clock());
+        int ready = epoll_wait(reactor->epoll_fd, events, REACTOR_EVENTS, timeout);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror("[ERROR] Epoll wait failed");
+            break;
+        }
+        reactor->idle.now = timer_wheel_clock();
+
+        for (int i = 0; i < ready; i++) {
+            tcpsock_t **listener = reactor_listener(reactor, events[i].data.ptr);
+            if (listener) {
+                // The listeners are registered with their slot in the reactor
+                if (*listener) reactor_accept(reactor, *listener);
+                continue;
+            }
+            connection_t *connection = (connection_t *)events[i].data.ptr;
+            if (!connection) {
+                // Only the wake eventfd is registered without a connection
+                uint64_t value;
+                if (read(reactor->wake_fd, &value, sizeof(value)) < 0) perror("[ERROR] Reading wake event failed");
+                if (__atomic_load_n(&reactor->stop, __ATOMIC_ACQUIRE)) {
+                    reactor_stop_accepting(reactor);
+                    stopping = 1;
+                } else if (reactor->paused && accepting_more()) {
+                    reactor_listen(reactor, EPOLLIN);
+                }
+                continue;
+            }
+
+            connection->last_active = reactor->idle.now;
+            if (connection_read(connection, reactor->buffer) != 0) reactor_remove(reactor, connection);
+        }
+        // Only after the events, so none of them refers to a connection that timed out
+        timer_wheel_advance(&reactor->idle.wheel, reactor->idle.now, reactor_expire, reactor);
+    }
+    reactor_stop_accepting(reactor);
+    return NULL;
+}
+
+// Wakes the first 'count' reactors, those that are paused resume accepting if a slot is free
+static void reactors_wake(reactor_t *reactors, int count) {
+    for (int i = 0; i < count; i++) {
+        uint64_t value = 1;
+        if (write(reactors[i].wake_fd, &value, sizeof(value)) < 0) perror("[ERROR] Writing wake event failed");
+    }
+}
+
+/**
+ * Tells the first 'count' reactors to stop accepting and to exit once their connections are closed, waits for them and frees them all
+ * With 'drain' set the connections are drained instead of waiting until their Sensor Nodes close them
+ */
+static void reactors_stop(reactor_t *reactors, int count, int drain) {
+    // Stop all of them first, so no listener keeps accepting while another reactor still serves its connections
+    for (int i = 0; i < count; i++) {
+        __atomic_store_n(&reactors[i].stop, 1, __ATOMIC_RELEASE);
+    }
+    reactors_wake(reactors, count);
+    if (drain) connections_drain();
+    for (int i = 0; i < count; i++) {
+        pthread_join(reactors[i].thread, NULL);
+        close(reactors[i].epoll_fd);
+        close(reactors[i].wake_fd);
+    }
+    free(reactors);
+}
+
+/**
+ * Waits in the Connection Manager thread until the stop event arrives on 'stop_fd', or with CONNMGR_LIMIT_TOTAL until
+ * all slots are taken. Every time a slot frees up in the meantime, the first 'count' reactors are woken up to resume accepting.
+ * \return 1 if the stop event arrived, 0 otherwise
+ */
+static int reactors_supervise(reactor_t *reactors, int count, int stop_fd) {
+    struct pollfd fds[2] = {
+        { .fd = stop_fd, .events = POLLIN },
+        { .fd = wake_fd, .events = POLLIN }
+    };
+
+    while (1) {
+        if (limit == CONNMGR_LIMIT_TOTAL) {
+            pthread_mutex_lock(&count_mutex);
+            int reached = client_count >= max_connections;
+            pthread_mutex_unlock(&count_mutex);
+            if (reached) return 0;
+        }
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("[ERROR] Poll of the Connection Manager failed");
+            return 1;
+        }
+        if (fds[0].revents & POLLIN) return 1;
+        if (fds[1].revents & POLLIN) {
+            uint64_t value;
+            if (read(wake_fd, &value, sizeof(value)) < 0) perror("[ERROR] Reading wake event failed");
+            reactors_wake(reactors, count);
+        }
+    }
+}
+
+/**
+ * Sets up 'reactor' with its epoll instance, wake eventfd and 'listener', and 'local' unless it is NULL, without starting it
+ * \return 0 on success, -1 if an error occurred, then nothing is left open except the listeners
+ */
+static int reactor_init(reactor_t *reactor, sbuffer_t *buffer, tcpsock_t *listener, tcpsock_t *local) {
+    reactor->buffer = buffer;
+    reactor->listeners[0] = listener;
+    reactor->listeners[1] = local;
+    reactor->stop = 0;
+    reactor->paused = 0;
+    reactor->connections = 0;
+    idle_init(&reactor->idle);
+    reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    reactor->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    struct epoll_event wake_event = { .events = EPOLLIN, .data.ptr = NULL };
+    int result = reactor->epoll_fd < 0 || reactor->wake_fd < 0 ||
+                 epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->wake_fd, &wake_event) != 0;
+    for (int i = 0; i < LISTENERS && !result; i++) {
+        int sd;
+        struct epoll_event listen_event = { .events = EPOLLIN, .data.ptr = &reactor->listeners[i] };
+        if (!reactor->listeners[i]) continue;
+        result = tcp_set_nonblocking(reactor->listeners[i]) != TCP_NO_ERROR ||
+                 tcp_get_sd(reactor->listeners[i], &sd) != TCP_NO_ERROR ||
+                 epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, sd, &listen_event) != 0;
+    }
+    if (result) {
+        if (reactor->epoll_fd >= 0) close(reactor->epoll_fd);
+        if (reactor->wake_fd >= 0) close(reactor->wake_fd);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Creates and starts up to '*count' reactor threads, each accepting on its own SO_REUSEPORT listener, so the kernel
+ * spreads new connections over the reactors and no accept is shared between threads
+ * The first reactor takes over '*server_socket' and '*local_socket' and sets them to NULL, the others open a listener
+ * on the same port. A Unix domain socket can't be shared that way, so the first reactor accepts all local connections.
+ * \return an array of running reactors and '*count' set to their number, NULL if not even one reactor could be started
+ */
+static reactor_t *reactors_start(sbuffer_t *buffer, int *count, tcpsock_t **server_socket, tcpsock_t **local_socket) {
+    reactor_t *reactors = calloc(*count, sizeof(reactor_t));
+    if (!reactors) return NULL;
+
+    int port;
+    tcp_get_port(*server_socket, &port);
+    for (int i = 0; i < *count; i++) {
+        reactor_t *reactor = &reactors[i];
+        tcpsock_t *listener = i == 0 ? *server_socket : NULL;
+        if (i > 0 && tcp_passive_open_reuseport(&listener, port) != TCP_NO_ERROR) listener = NULL;
+
+        if (listener && reactor_init(reactor, buffer, listener, i == 0 ? *local_socket : NULL) == 0) {
+            if (pthread_create(&reactor->thread, NULL, reactor_logic, reactor) == 0) {
+                if (i == 0) *server_socket = *local_socket = NULL;
+                continue;
+            }
+            close(reactor->epoll_fd);
+            close(reactor->wake_fd);
+        }
+        // Keep the reactors that are already running
+        if (listener && i > 0) tcp_close(&listener);
+        if (i == 0) {
+            free(reactors);
+            return NULL;
+        }
+        *count = i;
+    }
+    return reactors;
+}
+
+/**
+ * Creates the io_uring of the Connection Manager with its provided receive buffers
+ * \return the ring, NULL if the kernel can't run it or an error occurred
+ */
+static uring_t *uring_start(void) {
+    uring_t *ring;
+    if (uring_init(&ring, URING_ENTRIES) != URING_NO_ERROR) return NULL;
+    if (uring_provide_buffers(ring, URING_BUFFER_GROUP, URING_BUFFERS, URING_BUFFER_SIZE) != URING_NO_ERROR) {
+        uring_free(&ring);
+        return NULL;
+    }
+    return ring;
+}
+
+/**
+ * Queues a multishot receive for 'connection'
+ * \return 0 on success, -1 if the submission queue is full
+ */
+static int uring_receive(uring_t *ring, connection_t *connection) {
+    int sd;
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    if (!sqe || tcp_get_sd(connection->socket, &sd) != TCP_NO_ERROR) return -1;
+    uring_prep_recv_multishot(sqe, sd, URING_BUFFER_GROUP, (unsigned long long) (uintptr_t) connection);
+    return 0;
+}
+
+/**
+ * Handles a connection accepted by the multishot accept of the ring and starts its idle timer in 'idle'
+ * \return 1 if the connection is served, 0 if it was closed again
+ */
+static int uring_accepted(uring_t *ring, idle_timers_t *idle, int sd) {
+    tcpsock_t *client_socket;
+
+    if (tcp_wrap_connection(&client_socket, sd) != TCP_NO_ERROR) {
+        close(sd);
+        connection_unreserve(1);
+        return 0;
+    }
+
+    connection_t *connection = connection_accept(client_socket);
+    if (!connection) return 0;
+    connection->fed = 1;
+    if (uring_receive(ring, connection) != 0) {
+        // LOG
+        write_to_pipe("Failed to add a new Sensor Node to the io_uring");
+        connection_close(connection);
+        return 0;
+    }
+    idle_watch(idle, connection);
+    return 1;
+}
+
+// Ends the receive of a connection that has to be closed, it is closed when the last completion of the receive arrives
+static void uring_shutdown(connection_t *connection) {
+    int sd;
+    tcp_get_sd(connection->socket, &sd);
+    shutdown(sd, SHUT_RDWR);
+}
+
+// Shuts down the connection of the expired idle 'timer' if its Sensor Node was silent for too long, 'arg' is the idle_timers_t
+static void uring_expire(wheel_timer_t *timer, void *arg) {
+    connection_t *connection = (connection_t *)timer->data;
+    if (idle_expired((idle_timers_t *)arg, connection)) uring_shutdown(connection);
+}
+
+// Refuses the connection 'sd' accepted by the ring, because all slots are taken
+static void uring_refuse(int sd) {
+    tcpsock_t *client_socket;
+    if (tcp_wrap_connection(&client_socket, sd) == TCP_NO_ERROR) {
+        connection_refuse(client_socket);
+    } else {
+        close(sd);
+    }
+}
+
+/**
+ * Listening socket served by the io_uring
+ *
+ * @param sd Socket descriptor of the listener, -1 if there is none
+ * @param user_data User data of the accepts on the listener
+ * @param armed Set while an accept is queued on the listener
+ * @param parked Connection a single accept took while all slots were taken, served once a slot frees up, -1 if none
+ */
+typedef struct {
+    int sd;
+    unsigned long long user_data;
+    int armed;
+    int parked;
+} uring_listener_t;
+
+// Queues an accept on 'listener': multishot with CONNMGR_LIMIT_REJECT, which refuses what doesn't fit, otherwise a single
+// accept, so no more than one connection per listener is taken from its backlog while all slots are taken
+static void uring_arm_accept(uring_t *ring, uring_listener_t *listener) {
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    if (!sqe) return;
+    if (limit == CONNMGR_LIMIT_REJECT) {
+        uring_prep_accept_multishot(sqe, listener->sd, listener->user_data);
+    } else {
+        uring_prep_accept(sqe, listener->sd, listener->user_data);
+    }
+    listener->armed = 1;
+}
+
+/**
+ * Serves the connections parked on the 'listeners' as far as slots are free, and arms the listeners without an accept
+ * while slots are free
+ * \return the number of connections that are served now
+ */
+static int uring_listen(uring_t *ring, idle_timers_t *idle, uring_listener_t *listeners) {
+    int served = 0;
+    for (int i = 0; i < LISTENERS; i++) {
+        uring_listener_t *listener = &listeners[i];
+        if (listener->sd < 0) continue;
+        if (listener->parked >= 0 && connection_reserve(1)) {
+            served += uring_accepted(ring, idle, listener->parked);
+            listener->parked = -1;
+        }
+        if (!listener->armed && listener->parked < 0 && accepting_more()) uring_arm_accept(ring, listener);
+    }
+    return served;
+}
+
+// Cancels the accepts of the 'listeners', a connection parked on one of them is refused
+static void uring_stop_accepting(uring_t *ring, uring_listener_t *listeners) {
+    for (int i = 0; i < LISTENERS; i++) {
+        struct io_uring_sqe *sqe;
+        if (listeners[i].armed && (sqe = uring_get_sqe(ring))) {
+            uring_prep_cancel(sqe, listeners[i].user_data, URING_CANCEL);
+        }
+        if (listeners[i].parked >= 0) uring_refuse(listeners[i].parked);
+        listeners[i].parked = -1;
+    }
+}
+
+// Returns 1 if an accept is queued on one of the 'listeners'
+static int uring_accepting(const uring_listener_t *listeners) {
+    for (int i = 0; i < LISTENERS; i++) {
+        if (listeners[i].armed) return 1;
+    }
+    return 0;
+}
+
+/**
+ * Serves all Sensor Nodes from 'ring': an accept on 'server_socket' and on 'local_socket' (unless it is NULL), and a
+ * multishot receive per connection. The kernel picks a provided buffer for every chunk it receives, so no system call
+ * is made per connection or per chunk.
+ * With CONNMGR_LIMIT_REJECT the accepts are multishot and refuse what doesn't fit. Otherwise every accept is a single
+ * one, armed again while slots are free: the connections that don't fit stay in the backlog of the listener.
+ * Returns once max_connections Sensor Nodes have connected and all of them have closed their connection (CONNMGR_LIMIT_TOTAL),
+ * or once the stop event on 'stop_fd' drained all connections.
+ */
+static void uring_logic(uring_t *ring, sbuffer_t *buffer, tcpsock_t *server_socket, tcpsock_t *local_socket, int stop_fd) {
+    char message[BUFFER_SIZE];
+    int stopping = 0;
+    int connections = 0;
+    idle_timers_t idle;
+    uring_listener_t listeners[LISTENERS] = {
+        { .sd = -1, .user_data = URING_ACCEPT, .armed = 0, .parked = -1 },
+        { .sd = -1, .user_data = URING_ACCEPT_LOCAL, .armed = 0, .parked = -1 }
+    };
+
+    idle_init(&idle);
+    tcp_get_sd(server_socket, &listeners[0].sd);
+    if (local_socket) tcp_get_sd(local_socket, &listeners[1].sd);
+    uring_listen(ring, &idle, listeners);
+    if (uring_accepting(listeners)) {
+        // LOG
+        write_to_pipe("Server is waiting for new Sensor Node connection...");
+    }
+    struct io_uring_sqe *sqe;
+    if (stop_fd >= 0 && (sqe = uring_get_sqe(ring))) uring_prep_poll(sqe, stop_fd, POLLIN, URING_STOP);
+
+    while (uring_accepting(listeners) || connections > 0) {
+        int result = uring_submit_and_wait(ring, 1, timer_wheel_timeout(&idle.wheel, timer_wheel_clock()));
+        if (result < 0) {
+            snprintf(message, BUFFER_SIZE, "io_uring failed. Errno: %d (%s)", -result, strerror(-result));
+            write_to_pipe(message);
+            break;
+        }
+        idle.now = timer_wheel_clock();
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_peek_cqe(ring))) {
+            unsigned long long user_data = cqe->user_data;
+            int res = cqe->res;
+            unsigned int flags = cqe->flags;
+            uring_cqe_seen(ring);
+
+            if (user_data == URING_CANCEL) continue;
+
+            if (user_data == URING_STOP) {
+                if (res < 0 || !(res & POLLIN)) continue;
+                stopping = 1;
+                connections_drain();
+                uring_stop_accepting(ring, listeners);
+                continue;
+            }
+
+            if (user_data == URING_ACCEPT || user_data == URING_ACCEPT_LOCAL) {
+                uring_listener_t *listener = &listeners[user_data == URING_ACCEPT ? 0 : 1];
+                if (res >= 0 && stopping) {
+                    // Accepted before the cancellation of the accept took effect
+                    uring_refuse(res);
+                } else if (res >= 0 && connection_reserve(1)) {
+                    connections += uring_accepted(ring, &idle, res);
+                } else if (res >= 0 && limit == CONNMGR_LIMIT_REJECT) {
+                    uring_refuse(res);
+                } else if (res >= 0) {
+                    // The other listener took the last slot, this one waits for the next free slot
+                    listener->parked = res;
+                } else if (res != -ECANCELED) {
+                    snprintf(message, BUFFER_SIZE,
+                             "Failed to accept Sensor Node connection. Errno: %d (%s)", -res, strerror(-res));
+                    write_to_pipe(message);
+                }
+
+                if (!(flags & IORING_CQE_F_MORE)) {
+                    // The accept ended, arm it again while slots are free
+                    listener->armed = 0;
+                    if (!stopping) connections += uring_listen(ring, &idle, listeners);
+                }
+                if (!stopping && limit == CONNMGR_LIMIT_TOTAL && !accepting_more()) {
+                    // LOG
+                    write_to_pipe("Max number of simultanous clients reached.");
+                    stopping = 1;
+                    uring_stop_accepting(ring, listeners);
+                }
+                continue;
+            }
+
+            connection_t *connection = (connection_t *) (uintptr_t) user_data;
+            if (res > 0 && (flags & IORING_CQE_F_BUFFER)) {
+                unsigned short id = flags >> IORING_CQE_BUFFER_SHIFT;
+                connection->last_active = idle.now;
+                int fed = connection_feed(connection, buffer, uring_buffer(ring, id), res);
+                uring_buffer_recycle(ring, id);
+                if (fed != TCP_NO_ERROR) uring_shutdown(connection);
+            }
+            if (!(flags & IORING_CQE_F_MORE)) {
+                // A receive that ran out of provided buffers is armed again, the buffers are recycled by now
+                if ((res > 0 || res == -ENOBUFS) && uring_receive(ring, connection) == 0) continue;
+                timer_wheel_cancel(&idle.wheel, &connection->timer);
+                connection_close(connection);
+                connections--;
+                // The slot of the connection is free again (long-running), the listeners wait for it
+                if (!stopping) connections += uring_listen(ring, &idle, listeners);
+            }
+        }
+        timer_wheel_advance(&idle.wheel, idle.now, uring_expire, &idle);
+    }
+    uring_stop_accepting(ring, listeners);
+}
+
+// Starts a client handler thread serving 'connection'
+static void client_start(sbuffer_t *buffer, connection_t *connection) {
+    pthread_t client_thread;
+    client_args_t *client_args = malloc(sizeof(client_args_t));
+    if (!client_args) {
+        // LOG
+        write_to_pipe("Memory allocation for the thread of a new Sensor Node failed.");
+        connection_close(connection);
+        return;
+    }
+    client_args->buffer = buffer;
+    client_args->connection = connection;
+
+    pthread_mutex_lock(&count_mutex);
+    active_clients++;
+    pthread_mutex_unlock(&count_mutex);
+
+    if (pthread_create(&client_thread, NULL, handle_client, client_args) != 0) {
+        // LOG
+        write_to_pipe("Failed to create a thread for a new Sensor Node");
+        pthread_mutex_lock(&count_mutex);
+        active_clients--;
+        pthread_mutex_unlock(&count_mutex);
+        connection_close(connection);
+        free(client_args);
+    } else {
+        pthread_detach(client_thread);
+    }
+}
+
+/**
+ * Accepts the Sensor Nodes on the 'listeners' (NULL for a missing one) in the Connection Manager thread and starts a
+ * thread for each of them
+ * While all slots are taken the listeners aren't watched (except CONNMGR_LIMIT_REJECT), until a thread frees its slot.
+ * Returns once max_connections Sensor Nodes have connected (CONNMGR_LIMIT_TOTAL) or the stop event arrives on 'stop_fd'
+ * \return 1 if the stop event arrived, 0 otherwise
+ */
+static int threads_accept(sbuffer_t *buffer, tcpsock_t **listeners, int stop_fd) {
+    char message[BUFFER_SIZE];
+    connection_t *connections[ACCEPT_BATCH];
+    int listener_sds[LISTENERS];
+    struct pollfd fds[2 + LISTENERS] = {
+        { .fd = stop_fd, .events = POLLIN },
+        { .fd = wake_fd, .events = POLLIN }
+    };
+
+    // The listeners are only polled, so accepting a batch ends once nothing is queued anymore
+    for (int i = 0; i < LISTENERS; i++) {
+        listener_sds[i] = -1;
+        fds[2 + i].events = POLLIN;
+        if (!listeners[i]) continue;
+        if (tcp_set_nonblocking(listeners[i]) != TCP_NO_ERROR || tcp_get_sd(listeners[i], &listener_sds[i]) != TCP_NO_ERROR) {
+            write_to_pipe("Failed to set up the server socket of the Connection Manager");
+            return 0;
+        }
+    }
+
+    while (1) {
+        pthread_mutex_lock(&count_mutex);
+        int reached = limit == CONNMGR_LIMIT_TOTAL && client_count >= max_connections;
+        pthread_mutex_unlock(&count_mutex);
+        if (reached) {
+            // LOG
+            write_to_pipe("Max number of simultanous clients reached.");
+            return 0;
+        }
+
+        int listening = limit == CONNMGR_LIMIT_REJECT || accepting_more();
+        if (listening) {
+            // LOG
+            snprintf(message, BUFFER_SIZE, "Server is waiting for new Sensor Node connection...");
+            write_to_pipe(message);
+        }
+        for (int i = 0; i < LISTENERS; i++) {
+            fds[2 + i].fd = listening ? listener_sds[i] : -1;
+        }
+        if (poll(fds, 2 + LISTENERS, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("[ERROR] Poll of the Connection Manager failed");
+            return 1;
+        }
+        if (fds[0].revents & POLLIN) return 1;
+        if (fds[1].revents & POLLIN) {
+            uint64_t value;
+            if (read(wake_fd, &value, sizeof(value)) < 0) perror("[ERROR] Reading wake event failed");
+        }
+        for (int i = 0; i < LISTENERS; i++) {
+            if (!(fds[2 + i].revents & POLLIN)) continue;
+            int count = connections_accept(listeners[i], connections, 0);
+            for (int j = 0; j < count; j++) {
+                if (connections[j]) client_start(buffer, connections[j]);
+            }
+        }
+    }
+}
+
+/**
+ * Statistics thread function: logs the statistics of all open connections every time 'fds'[0] becomes readable,
+ * until 'fds'[1] does
+ */
+static void *stats_logic(void *arg) {
+    int *fds = (int *)arg;
+    struct pollfd events[2] = {
+        { .fd = fds[0], .events = POLLIN },
+        { .fd = fds[1], .events = POLLIN }
+    };
+
+    while (1) {
+        if (poll(events, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("[ERROR] Poll of the statistics thread failed");
+            break;
+        }
+        if (events[1].revents & POLLIN) break;
+        if (events[0].revents & POLLIN) {
+            uint64_t value;
+            if (read(fds[0], &value, sizeof(value)) < 0) perror("[ERROR] Reading statistics event failed");
+            connections_dump();
+        }
+    }
+    return NULL;
+}
+
 void *connmgr_logic(void *arg) {
     write_to_pipe("Connection Manager started.");
     connmgr_args_t *args = (connmgr_args_t *)arg;
     sbuffer_t *buffer = args->buffer;
     int port = args->port;
     max_connections = args->max_connections;
+    limit = args->limit;
 
-    tcpsock_t *server_socket, *client_socket;
-    pthread_t client_thread;
+    tcpsock_t *listeners[LISTENERS] = { NULL, NULL };   // the TCP server socket and the Unix domain socket
+    tcpsock_t **server_socket = &listeners[0];
+    tcpsock_t **local_socket = &listeners[1];
 
     char message[BUFFER_SIZE];
 
-    // Attempt to open the server socket
-    if (tcp_passive_open(&server_socket, port) != TCP_NO_ERROR) {
+    // Attempt to open the server socket, the epoll reactors open more listeners on the same port next to it
+    // Only this one checks that the port is free, so a second gateway can't join the group of a running one
+    int result = args->mode == CONNMGR_MODE_THREADS ? tcp_passive_open(server_socket, port)
+                                                    : tcp_passive_open_reuseport_first(server_socket, port);
+    if (result != TCP_NO_ERROR) {
         // LOG
         snprintf(message, BUFFER_SIZE,
                  "Failed to open server socket on port %5d. Errno: %d (%s)",
@@ -110,64 +1379,144 @@ void *connmgr_logic(void *arg) {
     snprintf(message, BUFFER_SIZE, "Server has just launched on port %5d", port);
     write_to_pipe(message);
 
-    int client_id = 0;
-
-    while (1) {
+    if (args->unix_path) {
+        if (tcp_passive_open_unix(local_socket, args->unix_path) != TCP_NO_ERROR) {
+            // LOG
+            snprintf(message, BUFFER_SIZE, "Failed to open Unix domain socket %s. Errno: %d (%s)",
+                     args->unix_path, errno, strerror(errno));
+            write_to_pipe(message);
+            tcp_close(server_socket);
+            pthread_exit(NULL);
+        }
         // LOG
-        snprintf(message, BUFFER_SIZE, "Server is waiting for new Sensor Node connection...");
+        snprintf(message, BUFFER_SIZE, "Server is listening on Unix domain socket %s as well", args->unix_path);
         write_to_pipe(message);
+    }
+    if (limit != CONNMGR_LIMIT_TOTAL) {
+        // LOG
+        snprintf(message, BUFFER_SIZE, "Serving up to %d Sensor Nodes at once until stopped, more are %s",
+                 max_connections, limit == CONNMGR_LIMIT_QUEUE ? "queued" : "rejected");
+        write_to_pipe(message);
+    }
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) perror("[ERROR] Failed to create the wake event of the Connection Manager");
 
-        if (tcp_wait_for_connection(server_socket, &client_socket) == TCP_NO_ERROR) {
-            char *client_ip = NULL;
-            int client_port = 0;
-            tcp_get_ip_addr(client_socket, &client_ip);
-            tcp_get_port(client_socket, &client_port);
+    // The statistics are dumped by a thread of their own, so it works no matter what the Connection Manager waits for
+    pthread_t stats_thread;
+    int stats_fds[2] = { args->stats_fd, -1 };
+    if (args->stats_fd >= 0 && (stats_fds[1] = eventfd(0, EFD_CLOEXEC)) >= 0 &&
+        pthread_create(&stats_thread, NULL, stats_logic, stats_fds) != 0) {
+        close(stats_fds[1]);
+        stats_fds[1] = -1;
+    }
+    if (args->stats_fd >= 0 && stats_fds[1] < 0) perror("[ERROR] Failed to start the statistics thread");
+
+    int mode = args->mode;
+    if (mode == CONNMGR_MODE_URING) {
+        uring_t *ring = uring_start();
+        if (!ring) {
+            // LOG
+            write_to_pipe("The kernel can't run the io_uring backend, falling back to epoll.");
+            mode = CONNMGR_MODE_EPOLL;
+        } else {
+            write_to_pipe("Serving Sensor Nodes with io_uring");
+            uring_logic(ring, buffer, *server_socket, *local_socket, args->stop_fd);
+            uring_free(&ring);
+        }
+    }
 
+    int drain = 0;
+    int reactor_count = args->reactors > 0 ? args->reactors : CONNMGR_DEFAULT_REACTORS;
+    reactor_t *reactors = NULL;
+    if (mode == CONNMGR_MODE_EPOLL) {
+        reactors = reactors_start(buffer, &reactor_count, server_socket, local_socket);
+        if (!reactors) {
             // LOG
+            write_to_pipe("Failed to start the reactor threads, falling back to a thread per Sensor Node.");
+            mode = CONNMGR_MODE_THREADS;
+        } else {
             snprintf(message, BUFFER_SIZE,
-                     "New connection from %s:%d", client_ip, client_port);
+                     "Serving Sensor Nodes with %d epoll reactor threads, each with its own listener", reactor_count);
             write_to_pipe(message);
+            // LOG
+            write_to_pipe("Server is waiting for new Sensor Node connection...");
 
-            // Create client handler thread
-            client_args_t *client_args = malloc(sizeof(client_args_t));
-            if (!client_args) {
-                // LOG
-                snprintf(message, BUFFER_SIZE, "Memory allocation for Sensor Node %2d failed.", client_id);
-                write_to_pipe(message);
-                tcp_close(&client_socket);
-                continue;
-            }
-            client_args->buffer = buffer;
-            client_args->client_socket = client_socket;
-
-            if (pthread_create(&client_thread, NULL, handle_client, client_args) != 0) {
+            // The reactors accept by themselves
+            drain = reactors_supervise(reactors, reactor_count, args->stop_fd);
+            if (!drain) {
                 // LOG
-                write_to_pipe("Failed to create a thread for a new Sensor Node");
-                tcp_close(&client_socket);
-                free(client_args);
-            } else {
-                pthread_detach(client_thread);
+                write_to_pipe("Max number of simultanous clients reached.");
             }
-        } else {
-            snprintf(message, BUFFER_SIZE,
-                     "Failed to accept Sensor Node connection. Errno: %d (%s)", errno, strerror(errno));
-            write_to_pipe(message);
         }
+    }
 
-        // Check termination condition
-        pthread_mutex_lock(&count_mutex);
-        if (client_count >= max_connections) {
-            // LOG
-            write_to_pipe("Max number of simultanous clients reached.");
-            pthread_mutex_unlock(&count_mutex);
-            break;
-        }
-        pthread_mutex_unlock(&count_mutex);
+    if (mode == CONNMGR_MODE_THREADS) {
+        drain = threads_accept(buffer, listeners, args->stop_fd);
     }
 
-    tcp_close(&server_socket);
+    // In epoll mode the reactors own the listeners, they close them as soon as they are stopped
+    if (*server_socket) tcp_close(server_socket);
+    if (*local_socket) tcp_close(local_socket);
     // LOG
     write_to_pipe("Server socket closed.");
-    sbuffer_terminate(buffer);
+
+    // The connections still insert into the buffer, so wait for them before the buffer can be terminated
+    if (reactors) {
+        reactors_stop(reactors, reactor_count, drain);
+    } else if (drain) {
+        connections_drain();
+    }
+    pthread_mutex_lock(&count_mutex);
+    while (active_clients > 0) {
+        pthread_cond_wait(&clients_done, &count_mutex);
+    }
+    // LOG
+    snprintf(message, BUFFER_SIZE,
+             "Connection Manager: %lu connections served, %lu refused, %d timed out after %d seconds without data",
+             accepted, refused, timeouts, TIMEOUT);
+    pthread_mutex_unlock(&count_mutex);
+    write_to_pipe(message);
+
+    if (stats_fds[1] >= 0) {
+        uint64_t value = 1;
+        if (write(stats_fds[1], &value, sizeof(value)) < 0) perror("[ERROR] Stopping the statistics thread failed");
+        pthread_join(stats_thread, NULL);
+        close(stats_fds[1]);
+    }
+    if (wake_fd >= 0) close(wake_fd);
+    wake_fd = -1;
     pthread_exit(NULL);
 }
+
+const char *connmgr_mode_name(int mode) {
+    switch (mode) {
+        case CONNMGR_MODE_THREADS: return "threads";
+        case CONNMGR_MODE_EPOLL:   return "epoll";
+        case CONNMGR_MODE_URING:   return "uring";
+        default:                   return NULL;
+    }
+}
+
+int connmgr_mode_from_name(const char *name) {
+    for (int mode = CONNMGR_MODE_THREADS; mode <= CONNMGR_MODE_URING; mode++) {
+        if (name && strcmp(name, connmgr_mode_name(mode)) == 0) return mode;
+    }
+    return -1;
+}
+
+const char *connmgr_limit_name(int limit) {
+    switch (limit) {
+        case CONNMGR_LIMIT_TOTAL:  return "total";
+        case CONNMGR_LIMIT_QUEUE:  return "queue";
+        case CONNMGR_LIMIT_REJECT: return "reject";
+        default:                   return NULL;
+    }
+}
+
+int connmgr_limit_from_name(const char *name) {
+    for (int limit = CONNMGR_LIMIT_QUEUE; limit <= CONNMGR_LIMIT_REJECT; limit++) {
+        if (name && strcmp(name, connmgr_limit_name(limit)) == 0) return limit;
+    }
+    return -1;
+}
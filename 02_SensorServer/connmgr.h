@@ -5,25 +5,87 @@
 #include "sbuffer.h"
 #include <pthread.h>
 
+// How the Connection Manager serves the Sensor Nodes
+#define CONNMGR_MODE_THREADS 0      // one blocking thread per Sensor Node
+#define CONNMGR_MODE_EPOLL 1        // a fixed set of reactor threads multiplexing all Sensor Nodes with epoll
+#define CONNMGR_MODE_URING 2        // a single io_uring with multishot accept and recv, falls back to epoll if the kernel can't run it
+
+#define CONNMGR_DEFAULT_REACTORS 2
+#define CONNMGR_MAX_REACTORS 64
+
+// What max_connections limits
+#define CONNMGR_LIMIT_TOTAL 0       // one-shot: max_connections Sensor Nodes in total, returns once all of them are closed
+#define CONNMGR_LIMIT_QUEUE 1       // long-running: max_connections at once, more wait in the listen backlog for a free slot
+#define CONNMGR_LIMIT_REJECT 2      // long-running: max_connections at once, more are accepted and closed right away
+
 /**
  * Connection Manager Arguments
  *
  * @param buffer A pointer to the shared buffer
  * @param port Port for TCP communication
  * @param max_connections Max number of simultanous connections
+ * @param mode One of the CONNMGR_MODE_* values
+ * @param reactors Number of reactor threads (CONNMGR_MODE_EPOLL)
+ * @param limit One of the CONNMGR_LIMIT_* values
+ * @param stop_fd Eventfd created by the caller, once it becomes readable the Connection Manager drains and returns
+ * @param unix_path Path of a Unix domain socket to accept local Sensor Nodes on next to the TCP port, NULL for none
+ * @param stats_fd Eventfd created by the caller, every time it becomes readable the statistics of all open connections
+ *                 are logged, -1 for none. Every connection logs a summary of its statistics when it is closed.
  */
 typedef struct {
     sbuffer_t *buffer;
     int port;
     int max_connections;
+    int mode;
+    int reactors;
+    int limit;
+    int stop_fd;
+    const char *unix_path;
+    int stats_fd;
 } connmgr_args_t;
 
 /**
  * Connection Manager Thread Logic
+ * Returns once max_connections Sensor Nodes have connected and closed their connections again (CONNMGR_LIMIT_TOTAL),
+ * once the stop event drained all connections, or if the server socket can't be opened.
+ * Draining stops accepting and shuts down the receiving side of every connection, so each is closed as soon as the
+ * data it received already is in the buffer. Nothing is inserted into the buffer anymore after that, the caller terminates it.
  *
  * @param arg Set of arguments
  * @return void
  */
 void *connmgr_logic(void *arg);
 
+/**
+ * Returns the name of a Connection Manager mode, as accepted by connmgr_mode_from_name
+ *
+ * @param mode One of the CONNMGR_MODE_* values
+ * @return The name of the mode, NULL if the mode is unknown
+ */
+const char *connmgr_mode_name(int mode);
+
+/**
+ * Looks up a Connection Manager mode by its name ("threads", "epoll" or "uring")
+ *
+ * @param name The name of the mode
+ * @return One of the CONNMGR_MODE_* values, -1 if the name is unknown
+ */
+int connmgr_mode_from_name(const char *name);
+
+/**
+ * Returns the name of a long-running limit, as accepted by connmgr_limit_from_name
+ *
+ * @param limit One of the CONNMGR_LIMIT_* values
+ * @return The name of the limit, NULL if the limit is unknown
+ */
+const char *connmgr_limit_name(int limit);
+
+/**
+ * Looks up a long-running limit by its name ("queue" or "reject")
+ *
+ * @param name The name of the limit
+ * @return CONNMGR_LIMIT_QUEUE or CONNMGR_LIMIT_REJECT, -1 if the name is unknown
+ */
+int connmgr_limit_from_name(const char *name);
+
 #endif // CONNMGR_H
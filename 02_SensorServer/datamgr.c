@@ -1,155 +1,305 @@
+#define _GNU_SOURCE
+
 #include "datamgr.h"
 #include "sbuffer.h"
-#include "lib/dplist.h"
+#include "sensortable.h"
+#include <errno.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/inotify.h>
 
 #define BUFFER_SIZE 1024
-#define RUN_AVG_LENGTH 5
 #define MIN_TEMP 10.0
 #define MAX_TEMP 16.5
+#define INOTIFY_BUFFER_SIZE 4096
+#define IDLE_TIMEOUT_MS 1000    // longest a worker without data waits before it looks for a reloaded map again
 
-/**
- * Structure storing Client Arguments
- *
- * @param sensor_id Sensort ID
- * @param room_id Room id for which the average is counted
- * @param running_avg Array storing source values
- * @param avg_index Client Index of average
- * @param current_avg Current Average value
- * @param last_modified Last modified timestamp
- */
-typedef struct {
-    uint16_t sensor_id;
-    uint16_t room_id;
-    double running_avg[RUN_AVG_LENGTH];
-    int avg_index;
-    double current_avg;
-    time_t last_modified;
-} sensor_node_t;
+// Threads other than the workers that are using a published sensor table right now, see table_read_lock()
+static int table_readers = 0;
 
 // Function prototypes
 void *datamgr_logic(void *arg);
-sensor_node_t *create_sensor_node(uint16_t sensor_id, uint16_t room_id);
-void update_running_avg(sensor_node_t *node, double new_value);
-void free_sensor_node(void **element);
-int sensor_node_compare(void *x, void *y);
-
-// Free sensor node
-void free_sensor_node(void **element) {
-    if (element && *element) {
-        free(*element);
-        *element = NULL;
+static void process_sensor_data(sensor_table_t *sensors, const sensor_data_t *data);
+
+void datamgr_partition(datamgr_args_t *args, sbuffer_t *buffer, int workers) {
+    unsigned int shards = sbuffer_shard_count(buffer);
+    for (int i = 0; i < workers; i++) {
+        args[i].buffer = buffer;
+        args[i].worker = i;
+        args[i].first_shard = shards * i / workers;
+        args[i].shard_count = shards * (i + 1) / workers - args[i].first_shard;
+        args[i].sensors = NULL;
+        args[i].pending = NULL;
     }
 }
 
-// Compare sensor nodes
-int sensor_node_compare(void *x, void *y) {
-    sensor_node_t *node_x = (sensor_node_t *)x;
-    sensor_node_t *node_y = (sensor_node_t *)y;
-    return (node_x->sensor_id - node_y->sensor_id);
+/**
+ * Read-side critical section of the published sensor tables, nestable and without a lock
+ * A worker that replaces its table frees the old one the first time it sees no readers after the exchange: a reader
+ * that comes later can only find the new table. That takes sequentially consistent loads of the tables, with acquire
+ * loads the load of a reader could still see the old table after the worker saw its count at zero.
+ */
+static void table_read_lock(void) {
+    __atomic_fetch_add(&table_readers, 1, __ATOMIC_SEQ_CST);
 }
 
-void *datamgr_logic(void *arg) {
-    write_to_pipe("Data Manager started.");
+static void table_read_unlock(void) {
+    __atomic_fetch_sub(&table_readers, 1, __ATOMIC_SEQ_CST);
+}
 
-    sbuffer_t *buffer = (sbuffer_t *)arg;
-    dplist_t *sensor_list = dpl_create(NULL, free_sensor_node, sensor_node_compare);
+int datamgr_room_stats(datamgr_args_t *workers, int count, uint16_t room_id, room_stats_t *summary) {
+    table_read_lock();
+    int found = 0;
+    memset(summary, 0, sizeof(room_stats_t));
+    for (int i = 0; i < count; i++) {
+        sensor_table_t *sensors = __atomic_load_n(&workers[i].sensors, __ATOMIC_SEQ_CST);
+        room_stats_t *room = sensors ? sensor_table_room(sensors, room_id) : NULL;
+        if (!room) continue;
+        room_stats_merge(summary, room);
+        found = 1;
+    }
+    table_read_unlock();
+    return found ? 0 : -1;
+}
 
-    // Load room-sensor mapping
-    FILE *map_file = fopen("room_sensor.map", "r");
-    if (!map_file) {
-        write_to_pipe("[ERROR] Unable to open room_sensor.map.");
-        return NULL;
+// Logs the statistics of every room, each room once even if several workers have sensors in it
+static void rooms_dump(datamgr_args_t *workers, int count) {
+    char message[BUFFER_SIZE];
+    unsigned char *dumped = calloc(SENSOR_TABLE_IDS / 8, 1);
+    room_stats_t *summary = malloc(sizeof(room_stats_t));
+    if (!dumped || !summary) {
+        free(dumped);
+        free(summary);
+        return;
+    }
+
+    table_read_lock();
+    for (int i = 0; i < count; i++) {
+        sensor_table_t *sensors = __atomic_load_n(&workers[i].sensors, __ATOMIC_SEQ_CST);
+        for (int j = 0; sensors && j < sensors->room_count; j++) {
+            uint16_t room_id = sensors->rooms[j]->room_id;
+            if (dumped[room_id / 8] & (1 << (room_id % 8))) continue;
+            dumped[room_id / 8] |= 1 << (room_id % 8);
+
+            datamgr_room_stats(workers, count, room_id, summary);
+            // LOG
+            snprintf(message, BUFFER_SIZE,
+                     "Room %d: sensors %d, readings %lu, mean %.2f, min %.2f, max %.2f, p50 %.2f, p90 %.2f, p99 %.2f",
+                     room_id, summary->sensors, (unsigned long)summary->count, room_stats_mean(summary),
+                     summary->min, summary->max, room_stats_quantile(summary, 0.5),
+                     room_stats_quantile(summary, 0.9), room_stats_quantile(summary, 0.99));
+            write_to_pipe(message);
+        }
+    }
+    table_read_unlock();
+
+    free(dumped);
+    free(summary);
+}
+
+// Keeps the sensors whose data ends up in the shards of the worker
+static int owns_sensor(sensor_id_t sensor_id, void *arg) {
+    datamgr_args_t *args = (datamgr_args_t *)arg;
+    return sbuffer_shard_of(args->buffer, sensor_id) - args->first_shard < args->shard_count;
+}
+
+// Loads the map file again and hands every worker its part, nothing is handed out if the file can't be loaded
+static void map_reload(datamgr_args_t *workers, int count) {
+    char message[BUFFER_SIZE];
+    sensor_table_t *tables[DATAMGR_MAX_WORKERS] = { NULL };
+    int lines = 0;
+
+    for (int i = 0; i < count && lines >= 0; i++) {
+        tables[i] = sensor_table_create();
+        lines = tables[i] ? sensor_table_load(tables[i], DATAMGR_MAP_FILE, owns_sensor, &workers[i]) : -1;
+    }
+    if (lines < 0) {
+        for (int i = 0; i < count; i++) sensor_table_free(&tables[i]);
+        write_to_pipe("[ERROR] Unable to reload " DATAMGR_MAP_FILE ", the current map is kept.");
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        // A map the worker hasn't picked up yet is simply replaced
+        sensor_table_t *unused = __atomic_exchange_n(&workers[i].pending, tables[i], __ATOMIC_ACQ_REL);
+        sensor_table_free(&unused);
+    }
+    // LOG
+    snprintf(message, BUFFER_SIZE, DATAMGR_MAP_FILE " reloaded with %d sensors.", lines);
+    write_to_pipe(message);
+}
+
+// Watches the directory of the map file, so a file replaced by a rename is noticed as well as one written in place
+static int map_watch(void) {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) return -1;
+    if (inotify_add_watch(fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        close(fd);
+        return -1;
     }
+    return fd;
+}
 
-    uint16_t room_id, sensor_id;
-    while (fscanf(map_file, "%hu %hu", &room_id, &sensor_id) == 2) {
-        sensor_node_t *node = create_sensor_node(sensor_id, room_id);
-        dpl_insert_at_index(sensor_list, node, 0, false);
+// Reads all pending events of 'fd', returns 1 if one of them is about the map file
+static int map_changed(int fd) {
+    char events[INOTIFY_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+    ssize_t length;
+    while ((length = read(fd, events, sizeof(events))) > 0) {
+        for (char *position = events; position < events + length;) {
+            struct inotify_event *event = (struct inotify_event *)position;
+            if (event->len > 0 && strcmp(event->name, DATAMGR_MAP_FILE) == 0) changed = 1;
+            position += sizeof(struct inotify_event) + event->len;
+        }
     }
-    fclose(map_file);
+    return changed;
+}
+
+void *datamgr_control_logic(void *arg) {
+    datamgr_control_args_t *args = (datamgr_control_args_t *)arg;
+    int watch_fd = map_watch();
+    if (watch_fd < 0) write_to_pipe("[ERROR] Unable to watch " DATAMGR_MAP_FILE ", it is only reloaded on SIGHUP.");
+
+    struct pollfd events[4] = {
+        { .fd = args->quit_fd, .events = POLLIN },
+        { .fd = args->stats_fd, .events = POLLIN },
+        { .fd = args->reload_fd, .events = POLLIN },
+        { .fd = watch_fd, .events = POLLIN }
+    };
 
-    sensor_data_t data;
     while (1) {
-        if (sbuffer_is_terminated(buffer)) {
+        if (poll(events, 4, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("[ERROR] Poll of the Data Manager control thread failed");
             break;
         }
+        if (events[0].revents & POLLIN) break;
 
-        // Read unprocessed sensor data
-        if (sbuffer_read_unprocessed(buffer, &data, 0) == 0) {
-            // Find the sensor node in the list
-            sensor_node_t key = { .sensor_id = data.id };
-            int index = dpl_get_index_of_element(sensor_list, &key);
-
-            if (index == -1) {
-                // Log if sensor ID is not found
-                char message[BUFFER_SIZE];
-                snprintf(message, BUFFER_SIZE, "Received sensor data with invalid sensor node ID %d", data.id);
-                write_to_pipe(message);
-                usleep(20);
-                sbuffer_mark_processed(buffer, &data);
-                continue;
-            }
-
-            sensor_node_t *node = dpl_get_element_at_index(sensor_list, index);
-
-            // Update the running average
-            update_running_avg(node, data.value);
-
-            // Check if the running average is out of bounds
-            if (node->current_avg < MIN_TEMP) {
-                char message[BUFFER_SIZE];
-                snprintf(message, BUFFER_SIZE, "Sensor node %d reports it's too cold (avg temp = %f)", node->sensor_id, node->current_avg);
-                write_to_pipe(message);
-            } else if (node->current_avg > MAX_TEMP) {
-                char message[BUFFER_SIZE];
-                snprintf(message, BUFFER_SIZE, "Sensor node %d reports it's too hot (avg temp = %f)", node->sensor_id, node->current_avg);
-                write_to_pipe(message);
-            }
-
-            // Log the processing
-            char message[BUFFER_SIZE];
-            snprintf(message, BUFFER_SIZE,
-                     "Processed sensor data {id: %d, value: %.2f, avg: %.2f, ts: %ld}",
-                     data.id, data.value, node->current_avg, data.ts);
-            write_to_pipe(message);
-
-            // Mark the data as processed
-            sbuffer_mark_processed(buffer, &data);
-        } else {
-            // No unprocessed data, wait
-            sleep(1);
+        uint64_t value;
+        if (events[1].revents & POLLIN) {
+            if (read(args->stats_fd, &value, sizeof(value)) < 0) perror("[ERROR] Reading statistics event failed");
+            rooms_dump(args->workers, args->count);
+        }
+        int reload = 0;
+        if (events[2].revents & POLLIN) {
+            if (read(args->reload_fd, &value, sizeof(value)) < 0) perror("[ERROR] Reading reload event failed");
+            reload = 1;
         }
+        if ((events[3].revents & POLLIN) && map_changed(watch_fd)) reload = 1;
+        if (reload) map_reload(args->workers, args->count);
     }
 
-    write_to_pipe("Data Manager exited.");
-    dpl_free(&sensor_list, true);
+    if (watch_fd >= 0) close(watch_fd);
     return NULL;
 }
 
-// Create a new sensor node
-sensor_node_t *create_sensor_node(uint16_t sensor_id, uint16_t room_id) {
-    sensor_node_t *node = malloc(sizeof(sensor_node_t));
-    node->sensor_id = sensor_id;
-    node->room_id = room_id;
-    memset(node->running_avg, 0, sizeof(node->running_avg));
-    node->avg_index = 0;
-    node->current_avg = 0.0;
-    node->last_modified = 0;
-    return node;
+// Switches to a reloaded map handed over by the control thread, and frees the replaced table once nobody reads it
+static void table_switch(datamgr_args_t *args, sensor_table_t **sensors, sensor_table_t **retired) {
+    char message[BUFFER_SIZE];
+    if (*retired && __atomic_load_n(&table_readers, __ATOMIC_SEQ_CST) == 0) sensor_table_free(retired);
+    // One replaced table at a time, a new map waits until the last one is freed
+    if (*retired || !__atomic_load_n(&args->pending, __ATOMIC_RELAXED)) return;
+
+    sensor_table_t *next = __atomic_exchange_n(&args->pending, NULL, __ATOMIC_ACQUIRE);
+    if (!next) return;
+    int kept = sensor_table_adopt(next, *sensors);
+    int before = (*sensors)->count;
+    __atomic_store_n(&args->sensors, next, __ATOMIC_SEQ_CST);
+    *retired = *sensors;
+    *sensors = next;
+    if (__atomic_load_n(&table_readers, __ATOMIC_SEQ_CST) == 0) sensor_table_free(retired);
+
+    // LOG
+    snprintf(message, BUFFER_SIZE, "Data Manager %d switched to the reloaded map: %d sensors (%d before), %d kept their state.",
+             args->worker, next->count, before, kept);
+    write_to_pipe(message);
 }
 
-// Update the running average
-void update_running_avg(sensor_node_t *node, double new_value) {
-    node->running_avg[node->avg_index] = new_value;
-    node->avg_index = (node->avg_index + 1) % RUN_AVG_LENGTH;
+void *datamgr_logic(void *arg) {
+    char message[BUFFER_SIZE];
+    datamgr_args_t *args = (datamgr_args_t *)arg;
+    sbuffer_t *buffer = args->buffer;
+
+    // LOG
+    snprintf(message, BUFFER_SIZE, "Data Manager %d started on shards %u to %u.",
+             args->worker, args->first_shard, args->first_shard + args->shard_count - 1);
+    write_to_pipe(message);
 
-    double sum = 0.0;
-    for (int i = 0; i < RUN_AVG_LENGTH; i++) {
-        sum += node->running_avg[i];
+    // Load room-sensor mapping, only the sensors of this worker
+    sensor_table_t *sensors = sensor_table_create();
+    if (!sensors || sensor_table_load(sensors, DATAMGR_MAP_FILE, owns_sensor, args) < 0) {
+        write_to_pipe("[ERROR] Unable to load " DATAMGR_MAP_FILE ".");
+        sensor_table_free(&sensors);
+        return NULL;
     }
-    node->current_avg = sum / RUN_AVG_LENGTH;
+    __atomic_store_n(&args->sensors, sensors, __ATOMIC_RELEASE);
+
+    sensor_data_t batch[SBUFFER_BATCH_SIZE];
+    sbuffer_handle_t handles[SBUFFER_BATCH_SIZE];
+    sensor_table_t *retired = NULL;
+    int count;
+    // Read unprocessed sensor data of the own shards, stop once the buffer is terminated and they are all processed
+    while ((count = sbuffer_read_shards(buffer, batch, handles, SBUFFER_BATCH_SIZE, SBUFFER_STAGE_DATAMGR,
+                                        args->first_shard, args->shard_count, IDLE_TIMEOUT_MS)) >= 0) {
+        // A reloaded map only takes effect between batches, the timeout makes an idle worker switch and free the old one
+        table_switch(args, &sensors, &retired);
+        if (count == 0) continue;
+        for (int i = 0; i < count; i++) {
+            process_sensor_data(sensors, &batch[i]);
+        }
+        // Only now the Storage Manager may store the batch
+        sbuffer_mark_processed_batch(buffer, handles, count);
+    }
+
+    // LOG
+    snprintf(message, BUFFER_SIZE, "Data Manager %d exited.", args->worker);
+    write_to_pipe(message);
+    // The control thread is stopped before the workers, nobody reads the tables anymore
+    __atomic_store_n(&args->sensors, NULL, __ATOMIC_RELEASE);
+    sensor_table_t *pending = __atomic_exchange_n(&args->pending, NULL, __ATOMIC_ACQUIRE);
+    sensor_table_free(&pending);
+    sensor_table_free(&retired);
+    sensor_table_free(&sensors);
+    return NULL;
+}
+
+// Update the running average of the sensor the data belongs to and log the result
+static void process_sensor_data(sensor_table_t *sensors, const sensor_data_t *data) {
+    char message[BUFFER_SIZE];
+
+    // Find the sensor node in the table
+    sensor_node_t *node = sensor_table_lookup(sensors, data->id);
+
+    if (!node) {
+        // Log if sensor ID is not found
+        snprintf(message, BUFFER_SIZE, "Received sensor data with invalid sensor node ID %d", data->id);
+        write_to_pipe(message);
+        return;
+    }
+
+    // Slide the window of the sensor, its aggregates are updated in constant time
+    window_add(&node->window, data->value, data->ts);
+    node->last_modified = data->ts;
+    // The statistics of the room are kept up to date as well, so they can be queried without going over its sensors
+    room_stats_add(node->room, data->value);
+    double avg = window_mean(&node->window);
+
+    // Check if the running average is out of bounds
+    if (avg < MIN_TEMP) {
+        snprintf(message, BUFFER_SIZE, "Sensor node %d reports it's too cold (avg temp = %f)", node->sensor_id, avg);
+        write_to_pipe(message);
+    } else if (avg > MAX_TEMP) {
+        snprintf(message, BUFFER_SIZE, "Sensor node %d reports it's too hot (avg temp = %f)", node->sensor_id, avg);
+        write_to_pipe(message);
+    }
+
+    // Log the processing
+    snprintf(message, BUFFER_SIZE,
+             "Processed sensor data {id: %d, value: %.2f, avg: %.2f, sd: %.2f, min: %.2f, max: %.2f, n: %d, ts: %ld}",
+             data->id, data->value, avg, window_stddev(&node->window), window_min(&node->window),
+             window_max(&node->window), window_count(&node->window), data->ts);
+    write_to_pipe(message);
 }
@@ -2,14 +2,91 @@
 #define DATAMGR_H
 
 #include "sbuffer.h"
+#include "sensortable.h"
 #include <pthread.h>
 
+#define DATAMGR_DEFAULT_WORKERS 1
+#define DATAMGR_MAX_WORKERS 64
+#define DATAMGR_MAP_FILE "room_sensor.map"
+
+/**
+ * Data Manager Arguments
+ *
+ * Every worker owns the shards [first_shard, first_shard + shard_count) of the buffer. The data of a sensor always
+ * goes to the same shard, so each worker keeps the state of its own sensors and no sensor state is shared. The order
+ * of the data of a sensor is that of its shard, which is also the order the Storage Manager sees it in.
+ *
+ * A reloaded map is handed to a worker through 'pending'. The worker picks it up between two batches, moves the state
+ * of the sensors it already had over and publishes it in 'sensors' with a single pointer exchange, so the lookups of
+ * the sensors never take a lock. The replaced table is freed once no reader of 'sensors' is left.
+ *
+ * @param buffer A pointer to the shared buffer
+ * @param worker Number of the worker, used in the log
+ * @param first_shard First shard the worker drains
+ * @param shard_count Number of shards the worker drains
+ * @param sensors Sensors of the worker, published by the worker once room_sensor.map is loaded, NULL until then
+ * @param pending Sensors of the worker in a reloaded room_sensor.map, NULL if there is no new map
+ */
+typedef struct {
+    sbuffer_t *buffer;
+    int worker;
+    unsigned int first_shard;
+    unsigned int shard_count;
+    sensor_table_t *sensors;
+    sensor_table_t *pending;
+} datamgr_args_t;
+
+/**
+ * Data Manager Control Thread Arguments
+ *
+ * @param workers The arguments of all Data Manager workers
+ * @param count Number of workers
+ * @param stats_fd Eventfd that becomes readable when the statistics of all rooms have to be logged
+ * @param reload_fd Eventfd that becomes readable when room_sensor.map has to be reloaded
+ * @param quit_fd Eventfd created by the caller, the thread exits once it becomes readable
+ */
+typedef struct {
+    datamgr_args_t *workers;
+    int count;
+    int stats_fd;
+    int reload_fd;
+    int quit_fd;
+} datamgr_control_args_t;
+
+/**
+ * Divides the shards of 'buffer' over 'workers' workers, as evenly as possible
+ * \param args an array of 'workers' arguments to fill in
+ * \param buffer the shared buffer, with at least 'workers' shards
+ * \param workers the number of workers
+ */
+void datamgr_partition(datamgr_args_t *args, sbuffer_t *buffer, int workers);
+
+/**
+ * Collects the statistics of room 'room_id' from all workers, without going over the sensors
+ * Safe to call while the workers are running, as long as they haven't exited yet
+ * \param workers the arguments of all Data Manager workers
+ * \param count the number of workers
+ * \param room_id the room
+ * \param summary where the merged statistics are stored
+ * \return 0 on success, -1 if no worker knows the room
+ */
+int datamgr_room_stats(datamgr_args_t *workers, int count, uint16_t room_id, room_stats_t *summary);
 
 /**
  * Data Manager Thread Logic
- * \param arg a pointer to the arguments
+ * \param arg a pointer to the arguments (datamgr_args_t)
  * \return void
  */
 void *datamgr_logic(void *arg);
 
+/**
+ * Data Manager Control Thread Logic
+ * Logs the readings, mean, extremes and quantiles of every room whenever 'stats_fd' becomes readable, and reloads
+ * room_sensor.map whenever 'reload_fd' becomes readable or the file is written or replaced (watched with inotify).
+ * A map that can't be loaded is logged and ignored, the workers keep the map they have.
+ * \param arg a pointer to the arguments (datamgr_control_args_t)
+ * \return void
+ */
+void *datamgr_control_logic(void *arg);
+
 #endif // DATAMGR_H
@@ -5,12 +5,17 @@
 #define _GNU_SOURCE
 
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
 
 #include "tcpsock.h"
 
@@ -54,13 +59,59 @@ struct tcpsock {
     long cookie;        /**< if the socket is bound, cookie should be equal to MAGIC_COOKIE */
     // remark: the use of magic cookies doesn't guarantee a 'bullet proof' test
     int sd;             /**< socket descriptor */
-    char *ip_addr;      /**< socket IP address */
-    int port;           /**< socket port number */
+    int family;         /**< AF_INET, or AF_UNIX for a local socket */
+    char *ip_addr;      /**< socket IP address, the path of the socket file for AF_UNIX */
+    int port;           /**< socket port number, 0 for AF_UNIX */
+    int owns_path;      /**< set on an AF_UNIX listener, that removes its socket file on close */
+    char *read_buffer;  /**< read-ahead buffer of tcp_receive_records, allocated on first use */
+    int read_start;     /**< offset of the first byte in read_buffer that wasn't returned yet */
+    int read_end;       /**< offset right after the last byte in read_buffer */
 };
 
 static tcpsock_t *tcp_sock_create();
 
+static int tcp_listen(tcpsock_t **sock, int port, int reuseport);
+
+static int tcp_port_free(int port);
+
+static int tcp_unix_address(struct sockaddr_un *addr, const char *path);
+
+static int tcp_set_address(tcpsock_t *s, const struct sockaddr_storage *addr);
+
 int tcp_passive_open(tcpsock_t **sock, int port) {
+    return tcp_listen(sock, port, 0);
+}
+
+int tcp_passive_open_reuseport(tcpsock_t **sock, int port) {
+    return tcp_listen(sock, port, 1);
+}
+
+int tcp_passive_open_reuseport_first(tcpsock_t **sock, int port) {
+    TCP_ERR_HANDLER(((port < MIN_PORT) || (port > MAX_PORT)), return TCP_ADDRESS_ERROR);
+    TCP_ERR_HANDLER(!tcp_port_free(port), return TCP_SOCKOP_ERROR);
+    return tcp_listen(sock, port, 1);
+}
+
+// Checks if 'port' is free by binding a plain socket to it, which fails next to any listener, with SO_REUSEPORT or not
+static int tcp_port_free(int port) {
+    struct sockaddr_in addr;
+    int sd = socket(PROTOCOLFAMILY, TYPE, PROTOCOL);
+    TCP_DEBUG_PRINTF(sd < 0, "Socket() failed with errno = %d [%s]", errno, strerror(errno));
+    TCP_ERR_HANDLER(sd < 0, return 0);
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    addr.sin_family = PROTOCOLFAMILY;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    int result = bind(sd, (struct sockaddr *) &addr, sizeof(addr));
+    int error = errno;
+    TCP_DEBUG_PRINTF(result == -1, "Bind() failed with errno = %d [%s]", error, strerror(error));
+    close(sd);
+    // The socket never listened, so the port is free again right away
+    errno = error;
+    return result == 0;
+}
+
+static int tcp_listen(tcpsock_t **sock, int port, int reuseport) {
     int result;
     struct sockaddr_in addr;
     TCP_ERR_HANDLER(((port < MIN_PORT) || (port > MAX_PORT)), return TCP_ADDRESS_ERROR);
@@ -69,6 +120,11 @@ int tcp_passive_open(tcpsock_t **sock, int port) {
     s->sd = socket(PROTOCOLFAMILY, TYPE, PROTOCOL);
     TCP_DEBUG_PRINTF(s->sd < 0, "Socket() failed with errno = %d [%s]", errno, strerror(errno));
     TCP_ERR_HANDLER(s->sd < 0, free(s);return TCP_SOCKOP_ERROR);
+    if (reuseport) {
+        result = setsockopt(s->sd, SOL_SOCKET, SO_REUSEPORT, &reuseport, sizeof(reuseport));
+        TCP_DEBUG_PRINTF(result == -1, "Setsockopt() failed with errno = %d [%s]", errno, strerror(errno));
+        TCP_ERR_HANDLER(result != 0, close(s->sd);free(s);return TCP_SOCKOP_ERROR);
+    }
     // Construct the server address structure
     memset(&addr, 0, sizeof(struct sockaddr_in));
     addr.sin_family = PROTOCOLFAMILY;
@@ -76,10 +132,10 @@ int tcp_passive_open(tcpsock_t **sock, int port) {
     addr.sin_port = htons(port);
     result = bind(s->sd, (struct sockaddr *) &addr, sizeof(addr));
     TCP_DEBUG_PRINTF(result == -1, "Bind() failed with errno = %d [%s]", errno, strerror(errno));
-    TCP_ERR_HANDLER(result != 0, free(s);return TCP_SOCKOP_ERROR);
+    TCP_ERR_HANDLER(result != 0, close(s->sd);free(s);return TCP_SOCKOP_ERROR);
     result = listen(s->sd, MAX_PENDING);
     TCP_DEBUG_PRINTF(result == -1, "Listen() failed with errno = %d [%s]", errno, strerror(errno));
-    TCP_ERR_HANDLER(result != 0, free(s);return TCP_SOCKOP_ERROR);
+    TCP_ERR_HANDLER(result != 0, close(s->sd);free(s);return TCP_SOCKOP_ERROR);
     s->ip_addr = NULL; // address set to INADDR_ANY - not a specific IP address
     s->port = port;
     s->cookie = MAGIC_COOKIE;
@@ -87,6 +143,33 @@ int tcp_passive_open(tcpsock_t **sock, int port) {
     return TCP_NO_ERROR;
 }
 
+int tcp_passive_open_unix(tcpsock_t **sock, const char *path) {
+    int result;
+    struct sockaddr_un addr;
+    TCP_ERR_HANDLER(tcp_unix_address(&addr, path) != 0, return TCP_ADDRESS_ERROR);
+    tcpsock_t *s = tcp_sock_create();
+    TCP_ERR_HANDLER(s == NULL, return TCP_MEMORY_ERROR);
+    s->ip_addr = strdup(path);
+    TCP_ERR_HANDLER(s->ip_addr == NULL, free(s);return TCP_MEMORY_ERROR);
+    s->sd = socket(AF_UNIX, TYPE, 0);
+    TCP_DEBUG_PRINTF(s->sd < 0, "Socket() failed with errno = %d [%s]", errno, strerror(errno));
+    TCP_ERR_HANDLER(s->sd < 0, free(s->ip_addr);free(s);return TCP_SOCKOP_ERROR);
+    // a socket file left behind by an earlier run would make bind fail
+    unlink(path);
+    result = bind(s->sd, (struct sockaddr *) &addr, sizeof(addr));
+    TCP_DEBUG_PRINTF(result == -1, "Bind() failed with errno = %d [%s]", errno, strerror(errno));
+    TCP_ERR_HANDLER(result != 0, close(s->sd);free(s->ip_addr);free(s);return TCP_SOCKOP_ERROR);
+    result = listen(s->sd, MAX_PENDING);
+    TCP_DEBUG_PRINTF(result == -1, "Listen() failed with errno = %d [%s]", errno, strerror(errno));
+    TCP_ERR_HANDLER(result != 0, unlink(path);close(s->sd);free(s->ip_addr);free(s);return TCP_SOCKOP_ERROR);
+    s->family = AF_UNIX;
+    s->port = 0;
+    s->owns_path = 1;
+    s->cookie = MAGIC_COOKIE;
+    *sock = s;
+    return TCP_NO_ERROR;
+}
+
 int tcp_active_open(tcpsock_t **sock, int remote_port, char *remote_ip) {
     struct sockaddr_in addr;
     tcpsock_t *client;
@@ -124,6 +207,28 @@ int tcp_active_open(tcpsock_t **sock, int remote_port, char *remote_ip) {
     return TCP_NO_ERROR;
 }
 
+int tcp_active_open_unix(tcpsock_t **sock, const char *path) {
+    struct sockaddr_un addr;
+    tcpsock_t *client;
+    int result;
+    TCP_ERR_HANDLER(tcp_unix_address(&addr, path) != 0, return TCP_ADDRESS_ERROR);
+    client = tcp_sock_create();
+    TCP_ERR_HANDLER(client == NULL, return TCP_MEMORY_ERROR);
+    client->ip_addr = strdup(path);
+    TCP_ERR_HANDLER(client->ip_addr == NULL, free(client);return TCP_MEMORY_ERROR);
+    client->sd = socket(AF_UNIX, TYPE, 0);
+    TCP_DEBUG_PRINTF(client->sd < 0, "Socket() failed with errno = %d [%s]", errno, strerror(errno));
+    TCP_ERR_HANDLER(client->sd < 0, free(client->ip_addr);free(client);return TCP_SOCKOP_ERROR);
+    result = connect(client->sd, (struct sockaddr *) &addr, sizeof(addr));
+    TCP_DEBUG_PRINTF(result == -1, "Connect() failed with errno = %d [%s]", errno, strerror(errno));
+    TCP_ERR_HANDLER(result != 0, close(client->sd);free(client->ip_addr);free(client);return TCP_SOCKOP_ERROR);
+    client->family = AF_UNIX;
+    client->port = 0;
+    client->cookie = MAGIC_COOKIE;
+    *sock = client;
+    return TCP_NO_ERROR;
+}
+
 int tcp_close(tcpsock_t **socket) {
     int result;
     if (socket == NULL) return TCP_SOCKET_ERROR;
@@ -132,8 +237,10 @@ int tcp_close(tcpsock_t **socket) {
     {
         if ((*socket)->ip_addr != NULL) // then assume memory is allocated and must be freed
         {
+            if ((*socket)->owns_path) unlink((*socket)->ip_addr);
             free((*socket)->ip_addr);
         }
+        free((*socket)->read_buffer);
         if ((*socket)->sd >= 0) {
             // maybe a connection is still open?
             result = shutdown((*socket)->sd, SHUT_RDWR);
@@ -150,29 +257,82 @@ int tcp_close(tcpsock_t **socket) {
     (*socket)->port = -1;
     (*socket)->sd = -1;
     (*socket)->ip_addr = NULL;
+    (*socket)->read_buffer = NULL;
     free(*socket);
     *socket = NULL;
     return TCP_NO_ERROR;
 }
 
-int tcp_wait_for_connection(tcpsock_t *socket, tcpsock_t **new_socket) {
-    struct sockaddr_in addr;
+// Accepts a single connection with accept4, 'flags' (SOCK_NONBLOCK, SOCK_CLOEXEC) apply to the new socket
+static int tcp_accept(tcpsock_t *socket, tcpsock_t **new_socket, int flags) {
+    struct sockaddr_storage addr;
     tcpsock_t *s;
-    unsigned int length = sizeof(struct sockaddr_in);
-    char *p;
+    unsigned int length = sizeof(addr);
+    int result;
 
     TCP_ERR_HANDLER(socket == NULL, return TCP_SOCKET_ERROR);
     TCP_ERR_HANDLER(socket->cookie != MAGIC_COOKIE, return TCP_SOCKET_ERROR);
     s = tcp_sock_create();
     TCP_ERR_HANDLER(s == NULL, return TCP_MEMORY_ERROR);
-    s->sd = accept(socket->sd, (struct sockaddr *) &addr, &length);
+    do {
+        s->sd = accept4(socket->sd, (struct sockaddr *) &addr, &length, flags);
+    } while ((s->sd == -1) && (errno == EINTR));
+    TCP_ERR_HANDLER((s->sd == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)), free(s);return TCP_WOULD_BLOCK);
     TCP_DEBUG_PRINTF(s->sd == -1, "Accept() failed with errno = %d [%s]", errno, strerror(errno));
     TCP_ERR_HANDLER(s->sd == -1, free(s);return TCP_SOCKOP_ERROR);
-    p = inet_ntoa(addr.sin_addr);  //returns addr to statically allocated buffer
-    s->ip_addr = (char *) malloc(sizeof(char) * CHAR_IP_ADDR_LENGTH);
-    TCP_ERR_HANDLER(s->ip_addr == NULL, free(s);return TCP_MEMORY_ERROR);
-    s->ip_addr = strncpy(s->ip_addr, p, CHAR_IP_ADDR_LENGTH);
-    s->port = ntohs(addr.sin_port);
+    if (socket->family == AF_UNIX) // the peer of a local connection is unnamed, it is known by the path it connected to
+    {
+        s->family = AF_UNIX;
+        s->port = 0;
+        s->ip_addr = strdup(socket->ip_addr);
+        result = (s->ip_addr == NULL) ? TCP_MEMORY_ERROR : TCP_NO_ERROR;
+    } else {
+        result = tcp_set_address(s, &addr);
+    }
+    TCP_ERR_HANDLER(result != TCP_NO_ERROR, close(s->sd);free(s);return result);
+    s->cookie = MAGIC_COOKIE;
+    *new_socket = s;
+    return TCP_NO_ERROR;
+}
+
+int tcp_wait_for_connection(tcpsock_t *socket, tcpsock_t **new_socket) {
+    return tcp_accept(socket, new_socket, 0);
+}
+
+int tcp_accept_batch(tcpsock_t *socket, tcpsock_t **new_sockets, int *count, int nonblocking) {
+    int accepted = 0, result = TCP_NO_ERROR;
+    int flags = SOCK_CLOEXEC | (nonblocking ? SOCK_NONBLOCK : 0);
+    while ((accepted < *count) && (result == TCP_NO_ERROR)) {
+        result = tcp_accept(socket, &new_sockets[accepted], flags);
+        if (result == TCP_NO_ERROR) accepted++;
+    }
+    *count = accepted;
+    // an error after the first connection shows up again on the next call, the accepted connections are returned first
+    if (accepted > 0) return TCP_NO_ERROR;
+    return result;
+}
+
+int tcp_wrap_connection(tcpsock_t **new_socket, int sd) {
+    struct sockaddr_storage addr;
+    tcpsock_t *s;
+    unsigned int length = sizeof(addr);
+    int result;
+
+    result = getpeername(sd, (struct sockaddr *) &addr, &length);
+    TCP_DEBUG_PRINTF(result == -1, "getpeername() failed with errno = %d [%s]", errno, strerror(errno));
+    TCP_ERR_HANDLER(result != 0, return TCP_SOCKOP_ERROR);
+    if (addr.ss_family == AF_UNIX) // the peer is unnamed, the local end carries the path it connected to
+    {
+        length = sizeof(addr);
+        result = getsockname(sd, (struct sockaddr *) &addr, &length);
+        TCP_DEBUG_PRINTF(result == -1, "getsockname() failed with errno = %d [%s]", errno, strerror(errno));
+        TCP_ERR_HANDLER(result != 0, return TCP_SOCKOP_ERROR);
+    }
+    s = tcp_sock_create();
+    TCP_ERR_HANDLER(s == NULL, return TCP_MEMORY_ERROR);
+    result = tcp_set_address(s, &addr);
+    TCP_ERR_HANDLER(result != TCP_NO_ERROR, free(s);return result);
+    s->sd = sd;
     s->cookie = MAGIC_COOKIE;
     *new_socket = s;
     return TCP_NO_ERROR;
@@ -208,16 +368,121 @@ int tcp_receive(tcpsock_t *socket, void *buffer, int *buf_size) {
         *buf_size = 0;
         return TCP_NO_ERROR;
     }
+    if (socket->read_start < socket->read_end) // data that was read ahead comes first
+    {
+        if (*buf_size > socket->read_end - socket->read_start) *buf_size = socket->read_end - socket->read_start;
+        memcpy(buffer, socket->read_buffer + socket->read_start, *buf_size);
+        socket->read_start += *buf_size;
+        return TCP_NO_ERROR;
+    }
     *buf_size = recv(socket->sd, buffer, *buf_size, 0);
     TCP_DEBUG_PRINTF(*buf_size == 0, "Recv() : no connection to peer\n");
     TCP_ERR_HANDLER(*buf_size == 0, return TCP_CONNECTION_CLOSED);
     TCP_DEBUG_PRINTF((*buf_size < 0) && (errno == ENOTCONN), "Recv() : no connection to peer\n");
     TCP_ERR_HANDLER((*buf_size < 0) && (errno == ENOTCONN), return TCP_CONNECTION_CLOSED);
+    TCP_ERR_HANDLER((*buf_size < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)), return TCP_WOULD_BLOCK);
     TCP_DEBUG_PRINTF(*buf_size < 0, "Recv() failed with errno = %d [%s]", errno, strerror(errno));
     TCP_ERR_HANDLER(*buf_size < 0, return TCP_SOCKOP_ERROR);
     return TCP_NO_ERROR;
 }
 
+int tcp_receive_records(tcpsock_t *socket, void *records, int record_size, int *count) {
+    int available, received;
+    TCP_ERR_HANDLER(socket == NULL, return TCP_SOCKET_ERROR);
+    TCP_ERR_HANDLER(socket->cookie != MAGIC_COOKIE, return TCP_SOCKET_ERROR);
+    TCP_ERR_HANDLER(((record_size <= 0) || (record_size > READ_AHEAD_SIZE)), return TCP_SOCKOP_ERROR);
+    if ((records == NULL) || (*count <= 0)) //nothing to read
+    {
+        *count = 0;
+        return TCP_NO_ERROR;
+    }
+    if (socket->read_buffer == NULL) {
+        socket->read_buffer = (char *) malloc(READ_AHEAD_SIZE);
+        TCP_ERR_HANDLER(socket->read_buffer == NULL, return TCP_MEMORY_ERROR);
+        socket->read_start = socket->read_end = 0;
+    }
+    while (socket->read_end - socket->read_start < record_size) {
+        // move the incomplete record to the front, so the rest of the buffer is free for a single large recv
+        available = socket->read_end - socket->read_start;
+        memmove(socket->read_buffer, socket->read_buffer + socket->read_start, available);
+        socket->read_start = 0;
+        socket->read_end = available;
+        received = recv(socket->sd, socket->read_buffer + available, READ_AHEAD_SIZE - available, 0);
+        TCP_DEBUG_PRINTF(received == 0, "Recv() : no connection to peer\n");
+        TCP_ERR_HANDLER(received == 0, *count = 0;return TCP_CONNECTION_CLOSED);
+        if ((received < 0) && (errno == EINTR)) continue;
+        TCP_ERR_HANDLER((received < 0) && (errno == ENOTCONN), *count = 0;return TCP_CONNECTION_CLOSED);
+        TCP_ERR_HANDLER((received < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)), *count = 0;return TCP_WOULD_BLOCK);
+        TCP_DEBUG_PRINTF(received < 0, "Recv() failed with errno = %d [%s]", errno, strerror(errno));
+        TCP_ERR_HANDLER(received < 0, *count = 0;return TCP_SOCKOP_ERROR);
+        socket->read_end += received;
+    }
+    available = (socket->read_end - socket->read_start) / record_size;
+    if (*count > available) *count = available;
+    memcpy(records, socket->read_buffer + socket->read_start, *count * record_size);
+    socket->read_start += *count * record_size;
+    return TCP_NO_ERROR;
+}
+
+int tcp_feed_records(tcpsock_t *socket, const void *data, int size, void *records, int record_size, int *count) {
+    int available;
+    TCP_ERR_HANDLER(socket == NULL, return TCP_SOCKET_ERROR);
+    TCP_ERR_HANDLER(socket->cookie != MAGIC_COOKIE, return TCP_SOCKET_ERROR);
+    TCP_ERR_HANDLER(((record_size <= 0) || (record_size > READ_AHEAD_SIZE) || (size < 0)), return TCP_SOCKOP_ERROR);
+    if (socket->read_buffer == NULL) {
+        socket->read_buffer = (char *) malloc(READ_AHEAD_SIZE);
+        TCP_ERR_HANDLER(socket->read_buffer == NULL, return TCP_MEMORY_ERROR);
+        socket->read_start = socket->read_end = 0;
+    }
+    if (size > 0) {
+        if (socket->read_end + size > READ_AHEAD_SIZE) // make room behind the bytes that weren't returned yet
+        {
+            available = socket->read_end - socket->read_start;
+            TCP_ERR_HANDLER(available + size > READ_AHEAD_SIZE, return TCP_SOCKOP_ERROR);
+            memmove(socket->read_buffer, socket->read_buffer + socket->read_start, available);
+            socket->read_start = 0;
+            socket->read_end = available;
+        }
+        memcpy(socket->read_buffer + socket->read_end, data, size);
+        socket->read_end += size;
+    }
+    if ((records == NULL) || (*count <= 0)) //nothing to return
+    {
+        *count = 0;
+        return TCP_NO_ERROR;
+    }
+    available = (socket->read_end - socket->read_start) / record_size;
+    if (*count > available) *count = available;
+    memcpy(records, socket->read_buffer + socket->read_start, *count * record_size);
+    socket->read_start += *count * record_size;
+    return TCP_NO_ERROR;
+}
+
+int tcp_set_nonblocking(tcpsock_t *socket) {
+    int flags;
+    TCP_ERR_HANDLER(socket == NULL, return TCP_SOCKET_ERROR);
+    TCP_ERR_HANDLER(socket->cookie != MAGIC_COOKIE, return TCP_SOCKET_ERROR);
+    flags = fcntl(socket->sd, F_GETFL, 0);
+    TCP_DEBUG_PRINTF(flags == -1, "Fcntl() failed with errno = %d [%s]", errno, strerror(errno));
+    TCP_ERR_HANDLER(flags == -1, return TCP_SOCKOP_ERROR);
+    flags = fcntl(socket->sd, F_SETFL, flags | O_NONBLOCK);
+    TCP_DEBUG_PRINTF(flags == -1, "Fcntl() failed with errno = %d [%s]", errno, strerror(errno));
+    TCP_ERR_HANDLER(flags == -1, return TCP_SOCKOP_ERROR);
+    return TCP_NO_ERROR;
+}
+
+int tcp_set_receive_timeout(tcpsock_t *socket, int seconds) {
+    int result;
+    struct timeval timeout = { .tv_sec = seconds, .tv_usec = 0 };
+    TCP_ERR_HANDLER(socket == NULL, return TCP_SOCKET_ERROR);
+    TCP_ERR_HANDLER(socket->cookie != MAGIC_COOKIE, return TCP_SOCKET_ERROR);
+    TCP_ERR_HANDLER(seconds < 0, return TCP_SOCKOP_ERROR);
+    result = setsockopt(socket->sd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    TCP_DEBUG_PRINTF(result == -1, "Setsockopt() failed with errno = %d [%s]", errno, strerror(errno));
+    TCP_ERR_HANDLER(result != 0, return TCP_SOCKOP_ERROR);
+    return TCP_NO_ERROR;
+}
+
 int tcp_get_ip_addr(tcpsock_t *socket, char **ip_addr) {
     TCP_ERR_HANDLER(socket == NULL, return TCP_SOCKET_ERROR);
     TCP_ERR_HANDLER(socket->cookie != MAGIC_COOKIE, return TCP_SOCKET_ERROR);
@@ -232,6 +497,35 @@ int tcp_get_port(tcpsock_t *socket, int *port) {
     return TCP_NO_ERROR;
 }
 
+int tcp_get_info(tcpsock_t *socket, tcpsock_info_t *info) {
+    struct tcp_info tcp;
+    unsigned int length = sizeof(tcp);
+    int queued, result;
+    TCP_ERR_HANDLER(socket == NULL, return TCP_SOCKET_ERROR);
+    TCP_ERR_HANDLER(socket->cookie != MAGIC_COOKIE, return TCP_SOCKET_ERROR);
+    memset(info, 0, sizeof(tcpsock_info_t));
+    if (socket->family != AF_UNIX) {
+        result = getsockopt(socket->sd, IPPROTO_TCP, TCP_INFO, &tcp, &length);
+        TCP_DEBUG_PRINTF(result == -1, "Getsockopt() failed with errno = %d [%s]", errno, strerror(errno));
+        TCP_ERR_HANDLER(result != 0, return TCP_SOCKOP_ERROR);
+        info->rtt_us = tcp.tcpi_rtt;
+        info->rtt_var_us = tcp.tcpi_rttvar;
+        info->retransmits = tcp.tcpi_total_retrans;
+    }
+    result = ioctl(socket->sd, FIONREAD, &queued);
+    TCP_DEBUG_PRINTF(result == -1, "Ioctl() failed with errno = %d [%s]", errno, strerror(errno));
+    TCP_ERR_HANDLER(result != 0, return TCP_SOCKOP_ERROR);
+    info->receive_queue = queued;
+    return TCP_NO_ERROR;
+}
+
+int tcp_get_family(tcpsock_t *socket, int *family) {
+    TCP_ERR_HANDLER(socket == NULL, return TCP_SOCKET_ERROR);
+    TCP_ERR_HANDLER(socket->cookie != MAGIC_COOKIE, return TCP_SOCKET_ERROR);
+    *family = socket->family;
+    return TCP_NO_ERROR;
+}
+
 int tcp_get_sd(tcpsock_t *socket, int *sd) {
     TCP_ERR_HANDLER(socket == NULL, return TCP_SOCKET_ERROR);
     TCP_ERR_HANDLER(socket->cookie != MAGIC_COOKIE, return TCP_SOCKET_ERROR);
@@ -247,6 +541,39 @@ static tcpsock_t *tcp_sock_create() {
         s->port = -1;
         s->ip_addr = NULL;
         s->sd = -1;
+        s->family = PROTOCOLFAMILY;
+        s->owns_path = 0;
+        s->read_buffer = NULL;
+        s->read_start = 0;
+        s->read_end = 0;
     }
     return s;
 }
+
+// Fills out 'addr' for the socket file 'path', returns -1 if 'path' is NULL, empty or too long
+static int tcp_unix_address(struct sockaddr_un *addr, const char *path) {
+    if ((path == NULL) || (path[0] == '\0') || (strlen(path) >= sizeof(addr->sun_path))) return -1;
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+// Sets the family, address and port of 's' from the peer address 'addr' of an AF_INET or AF_UNIX connection
+static int tcp_set_address(tcpsock_t *s, const struct sockaddr_storage *addr) {
+    char *p;
+    if (addr->ss_family == AF_UNIX) {
+        s->family = AF_UNIX;
+        s->port = 0;
+        s->ip_addr = strdup(((const struct sockaddr_un *) addr)->sun_path);
+        return (s->ip_addr == NULL) ? TCP_MEMORY_ERROR : TCP_NO_ERROR;
+    }
+    const struct sockaddr_in *in = (const struct sockaddr_in *) addr;
+    p = inet_ntoa(in->sin_addr);  //returns addr to statically allocated buffer
+    s->ip_addr = (char *) malloc(sizeof(char) * CHAR_IP_ADDR_LENGTH);
+    if (s->ip_addr == NULL) return TCP_MEMORY_ERROR;
+    s->ip_addr = strncpy(s->ip_addr, p, CHAR_IP_ADDR_LENGTH);
+    s->family = AF_INET;
+    s->port = ntohs(in->sin_port);
+    return TCP_NO_ERROR;
+}
@@ -14,11 +14,24 @@
 #define    TCP_SOCKOP_ERROR         3   // socket operator (socket, listen, bind, accept,...) error
 #define    TCP_CONNECTION_CLOSED    4   // send/receive indicate connection is closed
 #define    TCP_MEMORY_ERROR         5   // mem alloc error
+#define    TCP_WOULD_BLOCK          6   // non-blocking socket has nothing to receive or accept right now
 
 #define MAX_PENDING 10
+#define READ_AHEAD_SIZE 16384   // bytes tcp_receive_records tries to pull from the socket at once
 
 typedef struct tcpsock tcpsock_t;
 
+/**
+ * Transport statistics of a connection, as sampled by tcp_get_info
+ * A local (AF_UNIX) connection has no round trip time and no retransmits, those are 0
+ */
+typedef struct {
+    unsigned int rtt_us;            /**< smoothed round trip time in microseconds */
+    unsigned int rtt_var_us;        /**< variation of the round trip time in microseconds */
+    unsigned int retransmits;       /**< segments retransmitted since the connection was set up */
+    unsigned int receive_queue;     /**< bytes the kernel received that weren't read from the socket yet */
+} tcpsock_info_t;
+
 /**
  * Creates a new socket and opens this socket in 'passive listening mode' (waiting for an active connection setup request)
  * The socket is bound to port number 'port' and to any active IP interface of the system
@@ -33,6 +46,38 @@ typedef struct tcpsock tcpsock_t;
  */
 int tcp_passive_open(tcpsock_t **socket, int port);
 
+/**
+ * Works like tcp_passive_open, but sets SO_REUSEPORT on the socket before it is bound
+ * Every socket opened this way on the same port gets its own queue of connection setup requests, the kernel spreads
+ * new connections over them. Each socket can be served by its own thread without a shared accept.
+ * \param socket a double pointer, that will be filled out with the newly created socket
+ * \param port a port number between MIN_PORT and MAX_PORT
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_passive_open_reuseport(tcpsock_t **socket, int port);
+
+/**
+ * Works like tcp_passive_open_reuseport, but only if no other socket is bound to port 'port' yet
+ * A socket with SO_REUSEPORT quietly joins the group of any other process of the same user listening on the port, so
+ * the first socket of a group checks that the port is free with a plain bind before it opens the group.
+ * If the port is already in use, TCP_SOCKOP_ERROR is returned and errno is EADDRINUSE
+ * \param socket a double pointer, that will be filled out with the newly created socket
+ * \param port a port number between MIN_PORT and MAX_PORT
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_passive_open_reuseport_first(tcpsock_t **socket, int port);
+
+/**
+ * Works like tcp_passive_open, but opens a local (AF_UNIX) stream socket bound to the socket file 'path' instead of a port
+ * A socket file left behind at 'path' is removed first, tcp_close removes the file again
+ * Connections accepted on it are used with the same functions as TCP connections, without the cost of the TCP/IP stack
+ * If 'path' is NULL, empty or too long for a socket address, TCP_ADDRESS_ERROR is returned
+ * \param socket a double pointer, that will be filled out with the newly created socket
+ * \param path the path of the socket file
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_passive_open_unix(tcpsock_t **socket, const char *path);
+
 /**
  * Creates a new TCP socket and opens a TCP connection to the system with IP address 'remote_ip' on port 'remote_port'
  * The newly created socket is return as '*socket'
@@ -48,6 +93,15 @@ int tcp_passive_open(tcpsock_t **socket, int port);
  */
 int tcp_active_open(tcpsock_t **socket, int remote_port, char *remote_ip);
 
+/**
+ * Works like tcp_active_open, but connects to the local (AF_UNIX) socket bound to the socket file 'path'
+ * If 'path' is NULL, empty or too long for a socket address, TCP_ADDRESS_ERROR is returned
+ * \param socket a double pointer, that will be filled out with the newly created socket
+ * \param path the path of the socket file to connect to
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_active_open_unix(tcpsock_t **socket, const char *path);
+
 
 /**
  * The socket '*socket' is closed , allocated resources are freed and '*socket' is set to NULL
@@ -66,12 +120,39 @@ int tcp_close(tcpsock_t **socket);
  * If memory allocation for the new socket fails, TCP_MEMORY_ERROR is returned
  * If a socket operation (socket, listen, bind, accept, ...) fails, TCP_SOCKOP_ERROR is returned
  * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
+ * If 'socket' is non-blocking and no connection setup request is pending, TCP_WOULD_BLOCK is returned
  * \param socket the socket that needs to be monitored for a new incomming connection
  * \param new_socket a double pointer, that will be filled out with the newly created socket for the connection with the client
  * \return TCP_NO_ERROR if no error occurs during execution
  */
 int tcp_wait_for_connection(tcpsock_t *socket, tcpsock_t **new_socket);
 
+/**
+ * Accepts up to '*count' connections that are queued on the non-blocking listening socket 'socket', with accept4
+ * The new sockets are returned in 'new_sockets', already non-blocking if 'nonblocking' is set, so they need no extra system call
+ * The function sets '*count' to the number of accepted connections
+ * If no connection is queued, TCP_WOULD_BLOCK is returned
+ * If an accept fails before any connection was accepted, TCP_MEMORY_ERROR or TCP_SOCKOP_ERROR is returned
+ * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
+ * \param socket the listening socket
+ * \param new_sockets a pointer to an array of '*count' sockets, filled out with the newly created sockets
+ * \param count the maximum number of connections to accept, set to the number of connections accepted
+ * \param nonblocking put the new sockets in non-blocking mode
+ * \return TCP_NO_ERROR if at least one connection was accepted
+ */
+int tcp_accept_batch(tcpsock_t *socket, tcpsock_t **new_sockets, int *count, int nonblocking);
+
+/**
+ * Creates a new socket for the connection with socket descriptor 'sd', that was accepted outside of this library (e.g. by io_uring)
+ * The new socket owns 'sd': tcp_close closes it
+ * If memory allocation for the new socket fails, TCP_MEMORY_ERROR is returned
+ * If 'sd' is not a connected socket, TCP_SOCKOP_ERROR is returned
+ * \param new_socket a double pointer, that will be filled out with the newly created socket
+ * \param sd the socket descriptor of the connection
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_wrap_connection(tcpsock_t **new_socket, int sd);
+
 /**
  * Initiates a send command on the socket 'socket' and tries to send the total '*buf_size' bytes of data in 'buffer' (recall that the function might block for a while)
  * The function sets '*buf_size' to the number of bytes that were really sent, which might be less than the initial '*buf_size'
@@ -89,6 +170,8 @@ int tcp_send(tcpsock_t *socket, void *buffer, int *buf_size);
  * The function sets '*buf_size' to the number of bytes that were really received, which might be less than the inital '*buf_size'
  * If a socket error happens while receiving data or the connection is closed, TCP_SOCKOP_ERROR or TCP_CONNECTION_CLOSED is returned, respectively
  * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
+ * If 'socket' is non-blocking and no data is available, TCP_WOULD_BLOCK is returned and '*buf_size' is negative
+ * Data that tcp_receive_records already read ahead is returned first
  * \param socket the socket where the data needs to be received from
  * \param buffer a pointer to the buffer that can store the data that is received
  * \param buf_size the amount of bytes that will be read from the socket
@@ -96,8 +179,68 @@ int tcp_send(tcpsock_t *socket, void *buffer, int *buf_size);
  */
 int tcp_receive(tcpsock_t *socket, void *buffer, int *buf_size);
 
+/**
+ * Receives up to '*count' complete records of 'record_size' bytes each from the socket 'socket' and copies them to 'records'
+ * The socket reads ahead in chunks of READ_AHEAD_SIZE bytes, so a single recv serves many records. A record that is only partly
+ * received stays in the read-ahead buffer until the rest arrives, so records are never split or misaligned.
+ * Records already in the read-ahead buffer are returned without touching the socket. Otherwise the function waits until at least
+ * one record is complete, unless the socket is non-blocking, then TCP_WOULD_BLOCK is returned.
+ * The function sets '*count' to the number of records copied to 'records'
+ * If the connection is closed before a complete record is available, TCP_CONNECTION_CLOSED is returned, an incomplete last record is lost
+ * If a socket error happens while receiving data, TCP_SOCKOP_ERROR is returned
+ * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
+ * If 'record_size' is not between 1 and READ_AHEAD_SIZE, TCP_SOCKOP_ERROR is returned
+ * If memory allocation for the read-ahead buffer fails, TCP_MEMORY_ERROR is returned
+ * \param socket the socket where the records need to be received from
+ * \param records a pointer to the buffer that can store '*count' records
+ * \param record_size the size of a single record in bytes
+ * \param count the maximum number of records to receive, set to the number of records received
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_receive_records(tcpsock_t *socket, void *records, int record_size, int *count);
+
+/**
+ * Works like tcp_receive_records, but takes the bytes from 'data' instead of the socket, for data of 'socket' that was received
+ * outside of this library (e.g. by io_uring). The socket itself is never touched.
+ * The 'size' bytes in 'data' are appended to the read-ahead buffer, then up to '*count' complete records are copied to 'records'
+ * Records that didn't fit in 'records' and an incomplete last record stay in the read-ahead buffer, call again with 'size' 0 to get them
+ * The function sets '*count' to the number of records copied to 'records'
+ * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
+ * If 'record_size' is not between 1 and READ_AHEAD_SIZE, or the read-ahead buffer can't hold 'size' more bytes, TCP_SOCKOP_ERROR is returned
+ * If memory allocation for the read-ahead buffer fails, TCP_MEMORY_ERROR is returned
+ * \param socket the socket the data was received on
+ * \param data the received bytes
+ * \param size the number of bytes in 'data'
+ * \param records a pointer to the buffer that can store '*count' records
+ * \param record_size the size of a single record in bytes
+ * \param count the maximum number of records to return, set to the number of records returned
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_feed_records(tcpsock_t *socket, const void *data, int size, void *records, int record_size, int *count);
+
+/**
+ * Puts the socket 'socket' in non-blocking mode, tcp_receive and tcp_wait_for_connection then return TCP_WOULD_BLOCK instead of waiting
+ * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
+ * If the socket mode can't be changed, TCP_SOCKOP_ERROR is returned
+ * \param socket the socket to change
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_set_nonblocking(tcpsock_t *socket);
+
+/**
+ * Limits how long a receive on the blocking socket 'socket' waits for data to 'seconds'
+ * A receive that gets no data in time returns TCP_WOULD_BLOCK, 0 seconds waits forever again
+ * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
+ * If the timeout can't be set, TCP_SOCKOP_ERROR is returned
+ * \param socket the socket to change
+ * \param seconds the timeout in seconds
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_set_receive_timeout(tcpsock_t *socket, int seconds);
+
 /**
  * Set '*ip_addr' to the IP address of 'socket' (could be NULL if the IP address is not set)
+ * For a local (AF_UNIX) socket it is the path of the socket file
  * No memory allocation is done (pointer reference assignment!), hence, no free must be called to avoid a memory leak
  * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
  * \param socket the socket to get the ip address from
@@ -107,7 +250,7 @@ int tcp_receive(tcpsock_t *socket, void *buffer, int *buf_size);
 int tcp_get_ip_addr(tcpsock_t *socket, char **ip_addr);
 
 /**
- * Return the port number of the 'socket'
+ * Return the port number of the 'socket', 0 for a local (AF_UNIX) socket
  * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
  * \param socket the socket to get the port number from
  * \param port a pointer to an int that can hold the port number
@@ -115,6 +258,26 @@ int tcp_get_ip_addr(tcpsock_t *socket, char **ip_addr);
  */
 int tcp_get_port(tcpsock_t *socket, int *port);
 
+/**
+ * Samples the transport statistics of the connection 'socket' from the kernel (TCP_INFO and the size of the receive queue)
+ * The bytes that were read ahead by tcp_receive_records already don't count as queued
+ * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
+ * If the kernel can't report the statistics, TCP_SOCKOP_ERROR is returned
+ * \param socket the connection to sample
+ * \param info a pointer to the structure that will be filled out with the sample
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_get_info(tcpsock_t *socket, tcpsock_info_t *info);
+
+/**
+ * Return the address family of the 'socket': AF_INET, or AF_UNIX for a local socket
+ * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
+ * \param socket the socket to get the address family from
+ * \param family a pointer to an int that can hold the address family
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_get_family(tcpsock_t *socket, int *family);
+
 /**
  * Return the socket descriptor of the 'socket'
  * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
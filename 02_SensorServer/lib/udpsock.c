@@ -0,0 +1,188 @@
+#define _GNU_SOURCE
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "udpsock.h"
+
+//#define DEBUG
+
+#ifdef DEBUG
+#define UDP_DEBUG_PRINTF(condition,...)                                                         \
+        do {                                                                                    \
+           if((condition))                                                                      \
+           {                                                                                    \
+            fprintf(stderr,"\nIn %s - function %s at line %d: ", __FILE__, __func__, __LINE__); \
+            fprintf(stderr,__VA_ARGS__);                                                        \
+           }                                                                                    \
+        } while(0)
+#else
+#define UDP_DEBUG_PRINTF(...) (void)0
+#endif
+
+
+#define UDP_ERR_HANDLER(condition, ...)                                         \
+    do {                                                                        \
+        if ((condition))                                                        \
+        {                                                                       \
+          UDP_DEBUG_PRINTF(1,"error condition \"" #condition "\" is true\n");   \
+          __VA_ARGS__;                                                          \
+        }                                                                       \
+    } while(0)
+
+
+#define MAGIC_COOKIE    (long)(0x5D9A3C11E27)   // used to check if a socket is bound
+
+/**
+ * Structure for holding the UDP socket information
+ */
+struct udpsock {
+    long cookie;            /**< if the socket is bound, cookie should be equal to MAGIC_COOKIE */
+    int sd;                 /**< socket descriptor */
+    unsigned long dropped;  /**< datagrams dropped by the kernel, as reported with the last received datagram */
+};
+
+static udpsock_t *udp_sock_create() {
+    udpsock_t *s = (udpsock_t *) malloc(sizeof(udpsock_t));
+    if (s) // init the socket to default values
+    {
+        s->cookie = 0;  // socket is not yet bound!
+        s->sd = -1;
+        s->dropped = 0;
+    }
+    return s;
+}
+
+int udp_passive_open(udpsock_t **sock, int port) {
+    int result, on = 1;
+    struct sockaddr_in addr;
+    UDP_ERR_HANDLER(((port < UDP_MIN_PORT) || (port > UDP_MAX_PORT)), return UDP_ADDRESS_ERROR);
+    udpsock_t *s = udp_sock_create();
+    UDP_ERR_HANDLER(s == NULL, return UDP_MEMORY_ERROR);
+    s->sd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    UDP_DEBUG_PRINTF(s->sd < 0, "Socket() failed with errno = %d [%s]", errno, strerror(errno));
+    UDP_ERR_HANDLER(s->sd < 0, free(s);return UDP_SOCKOP_ERROR);
+    // every received datagram carries the number of datagrams the kernel dropped so far
+    result = setsockopt(s->sd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+    UDP_DEBUG_PRINTF(result == -1, "Setsockopt() failed with errno = %d [%s]", errno, strerror(errno));
+    UDP_ERR_HANDLER(result != 0, close(s->sd);free(s);return UDP_SOCKOP_ERROR);
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    result = bind(s->sd, (struct sockaddr *) &addr, sizeof(addr));
+    UDP_DEBUG_PRINTF(result == -1, "Bind() failed with errno = %d [%s]", errno, strerror(errno));
+    UDP_ERR_HANDLER(result != 0, close(s->sd);free(s);return UDP_SOCKOP_ERROR);
+    s->cookie = MAGIC_COOKIE;
+    *sock = s;
+    return UDP_NO_ERROR;
+}
+
+int udp_active_open(udpsock_t **sock, int remote_port, char *remote_ip) {
+    int result;
+    struct sockaddr_in addr;
+    UDP_ERR_HANDLER(((remote_port < UDP_MIN_PORT) || (remote_port > UDP_MAX_PORT)), return UDP_ADDRESS_ERROR);
+    UDP_ERR_HANDLER(remote_ip == NULL, return UDP_ADDRESS_ERROR);
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(remote_port);
+    result = inet_aton(remote_ip, &addr.sin_addr);
+    UDP_ERR_HANDLER(result == 0, return UDP_ADDRESS_ERROR);
+    udpsock_t *s = udp_sock_create();
+    UDP_ERR_HANDLER(s == NULL, return UDP_MEMORY_ERROR);
+    s->sd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    UDP_DEBUG_PRINTF(s->sd < 0, "Socket() failed with errno = %d [%s]", errno, strerror(errno));
+    UDP_ERR_HANDLER(s->sd < 0, free(s);return UDP_SOCKOP_ERROR);
+    // a connected UDP socket only fixes the destination, nothing is sent yet
+    result = connect(s->sd, (struct sockaddr *) &addr, sizeof(addr));
+    UDP_DEBUG_PRINTF(result == -1, "Connect() failed with errno = %d [%s]", errno, strerror(errno));
+    UDP_ERR_HANDLER(result != 0, close(s->sd);free(s);return UDP_SOCKOP_ERROR);
+    s->cookie = MAGIC_COOKIE;
+    *sock = s;
+    return UDP_NO_ERROR;
+}
+
+int udp_close(udpsock_t **socket) {
+    if (socket == NULL) return UDP_SOCKET_ERROR;
+    if (*socket == NULL) return UDP_SOCKET_ERROR;
+    if (((*socket)->cookie == MAGIC_COOKIE) && ((*socket)->sd >= 0)) {
+        int result = close((*socket)->sd);
+        UDP_DEBUG_PRINTF(result == -1, "Close() failed with errno = %d [%s]", errno, strerror(errno));
+        (void) result;
+    }
+    // overwrite memory before free to make socket invalid (even if memory is accidently reused)!
+    (*socket)->cookie = 0;
+    (*socket)->sd = -1;
+    free(*socket);
+    *socket = NULL;
+    return UDP_NO_ERROR;
+}
+
+int udp_send(udpsock_t *socket, void *buffer, int size) {
+    UDP_ERR_HANDLER(socket == NULL, return UDP_SOCKET_ERROR);
+    UDP_ERR_HANDLER(socket->cookie != MAGIC_COOKIE, return UDP_SOCKET_ERROR);
+    ssize_t sent = send(socket->sd, buffer, size, MSG_NOSIGNAL);
+    UDP_DEBUG_PRINTF(sent < 0, "Send() failed with errno = %d [%s]", errno, strerror(errno));
+    UDP_ERR_HANDLER(sent != size, return UDP_SOCKOP_ERROR);
+    return UDP_NO_ERROR;
+}
+
+int udp_receive_batch(udpsock_t *socket, void *datagrams, int datagram_size, int *sizes, int *count) {
+    struct mmsghdr messages[UDP_MAX_BATCH];
+    struct iovec iovecs[UDP_MAX_BATCH];
+    char controls[UDP_MAX_BATCH][CMSG_SPACE(sizeof(uint32_t))];
+    int received;
+
+    UDP_ERR_HANDLER(socket == NULL, return UDP_SOCKET_ERROR);
+    UDP_ERR_HANDLER(socket->cookie != MAGIC_COOKIE, return UDP_SOCKET_ERROR);
+    UDP_ERR_HANDLER(((*count < 1) || (*count > UDP_MAX_BATCH) || (datagram_size <= 0)), return UDP_SOCKOP_ERROR);
+    memset(messages, 0, *count * sizeof(struct mmsghdr));
+    for (int i = 0; i < *count; i++) {
+        iovecs[i].iov_base = (char *) datagrams + i * datagram_size;
+        iovecs[i].iov_len = datagram_size;
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+        messages[i].msg_hdr.msg_control = controls[i];
+        messages[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+    }
+    do {
+        received = recvmmsg(socket->sd, messages, *count, MSG_DONTWAIT, NULL);
+    } while ((received < 0) && (errno == EINTR));
+    UDP_ERR_HANDLER((received < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)), *count = 0;return UDP_WOULD_BLOCK);
+    UDP_DEBUG_PRINTF(received < 0, "Recvmmsg() failed with errno = %d [%s]", errno, strerror(errno));
+    UDP_ERR_HANDLER(received < 0, *count = 0;return UDP_SOCKOP_ERROR);
+    for (int i = 0; i < received; i++) {
+        struct msghdr *header = &messages[i].msg_hdr;
+        sizes[i] = (header->msg_flags & MSG_TRUNC) ? -1 : (int) messages[i].msg_len;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(header); cmsg != NULL; cmsg = CMSG_NXTHDR(header, cmsg)) {
+            if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SO_RXQ_OVFL)) {
+                uint32_t dropped;
+                memcpy(&dropped, CMSG_DATA(cmsg), sizeof(dropped));
+                socket->dropped = dropped;
+            }
+        }
+    }
+    *count = received;
+    return UDP_NO_ERROR;
+}
+
+int udp_get_dropped(udpsock_t *socket, unsigned long *dropped) {
+    UDP_ERR_HANDLER(socket == NULL, return UDP_SOCKET_ERROR);
+    UDP_ERR_HANDLER(socket->cookie != MAGIC_COOKIE, return UDP_SOCKET_ERROR);
+    *dropped = socket->dropped;
+    return UDP_NO_ERROR;
+}
+
+int udp_get_sd(udpsock_t *socket, int *sd) {
+    UDP_ERR_HANDLER(socket == NULL, return UDP_SOCKET_ERROR);
+    UDP_ERR_HANDLER(socket->cookie != MAGIC_COOKIE, return UDP_SOCKET_ERROR);
+    *sd = socket->sd;
+    return UDP_NO_ERROR;
+}
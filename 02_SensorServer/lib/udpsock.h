@@ -0,0 +1,98 @@
+#ifndef __UDPSOCK_H__
+#define __UDPSOCK_H__
+
+#define    UDP_NO_ERROR             0
+#define    UDP_SOCKET_ERROR         1   // invalid socket
+#define    UDP_ADDRESS_ERROR        2   // invalid port and/or IP address
+#define    UDP_SOCKOP_ERROR         3   // socket operator (socket, bind, recvmmsg,...) error
+#define    UDP_MEMORY_ERROR         5   // mem alloc error
+#define    UDP_WOULD_BLOCK          6   // no datagram is queued on the socket right now
+
+#define UDP_MIN_PORT    1024
+#define UDP_MAX_PORT    65536
+#define UDP_MAX_BATCH   64      // maximum number of datagrams udp_receive_batch returns at once
+
+typedef struct udpsock udpsock_t;
+
+/**
+ * Creates a new UDP socket bound to port number 'port' on any active IP interface of the system
+ * The socket counts the datagrams the kernel drops because its receive buffer is full, see udp_get_dropped
+ * This function is typically called by a server
+ * If port 'port' is not between UDP_MIN_PORT and UDP_MAX_PORT, UDP_ADDRESS_ERROR is returned
+ * If memory allocation for the newly created socket fails, UDP_MEMORY_ERROR is returned
+ * If a socket operation (socket, setsockopt, bind) fails, UDP_SOCKOP_ERROR is returned
+ * \param socket a double pointer, that will be filled out with the newly created socket
+ * \param port a port number between UDP_MIN_PORT and UDP_MAX_PORT
+ * \return UDP_NO_ERROR if no error occurs during execution
+ */
+int udp_passive_open(udpsock_t **socket, int port);
+
+/**
+ * Creates a new UDP socket that sends its datagrams to the system with IP address 'remote_ip' on port 'remote_port'
+ * This function is typically called by a client
+ * If port 'remote_port' is not between UDP_MIN_PORT and UDP_MAX_PORT, or 'remote_ip' is NULL or invalid, UDP_ADDRESS_ERROR is returned
+ * If memory allocation for the newly created socket fails, UDP_MEMORY_ERROR is returned
+ * If a socket operation (socket, connect) fails, UDP_SOCKOP_ERROR is returned
+ * \param socket a double pointer, that will be filled out with the newly created socket
+ * \param remote_port the remote port number to send to
+ * \param remote_ip the remote ip address to send to
+ * \return UDP_NO_ERROR if no error occurs during execution
+ */
+int udp_active_open(udpsock_t **socket, int remote_port, char *remote_ip);
+
+/**
+ * The socket '*socket' is closed, allocated resources are freed and '*socket' is set to NULL
+ * If 'socket' or '*socket' is NULL, nothing is done and UDP_SOCKET_ERROR is returned
+ * \param socket a double pointer, to the socket that needs to be closed
+ * \return UDP_NO_ERROR if no error occurs during execution
+ */
+int udp_close(udpsock_t **socket);
+
+/**
+ * Sends the 'size' bytes in 'buffer' as a single datagram on the socket 'socket', opened with udp_active_open
+ * There is no delivery guarantee: a datagram the network or the receiver drops is lost without notice
+ * If 'socket' is NULL or not yet bound, UDP_SOCKET_ERROR is returned
+ * If the datagram can't be sent, UDP_SOCKOP_ERROR is returned
+ * \param socket the socket to send on
+ * \param buffer a pointer to the data of the datagram
+ * \param size the size of the datagram in bytes
+ * \return UDP_NO_ERROR if no error occurs during execution
+ */
+int udp_send(udpsock_t *socket, void *buffer, int size);
+
+/**
+ * Receives up to '*count' queued datagrams on the socket 'socket' with a single system call (recvmmsg), without waiting
+ * Datagram i is copied to 'datagrams' + i * 'datagram_size' and its size stored in 'sizes'[i]
+ * A datagram larger than 'datagram_size' bytes is truncated, its size is then set to -1
+ * The function sets '*count' to the number of datagrams received
+ * If no datagram is queued, UDP_WOULD_BLOCK is returned
+ * If 'socket' is NULL or not yet bound, UDP_SOCKET_ERROR is returned
+ * If '*count' is not between 1 and UDP_MAX_BATCH, or receiving fails, UDP_SOCKOP_ERROR is returned
+ * \param socket the socket to receive from
+ * \param datagrams a pointer to the buffer that can store '*count' datagrams of 'datagram_size' bytes
+ * \param datagram_size the maximum size of a datagram in bytes
+ * \param sizes a pointer to an array of '*count' ints that will hold the sizes of the datagrams
+ * \param count the maximum number of datagrams to receive, set to the number of datagrams received
+ * \return UDP_NO_ERROR if no error occurs during execution
+ */
+int udp_receive_batch(udpsock_t *socket, void *datagrams, int datagram_size, int *sizes, int *count);
+
+/**
+ * Returns the number of datagrams the kernel dropped on 'socket' because its receive buffer was full, as of the last udp_receive_batch
+ * If 'socket' is NULL or not yet bound, UDP_SOCKET_ERROR is returned
+ * \param socket the socket to get the counter from
+ * \param dropped a pointer to an unsigned long that can hold the counter
+ * \return UDP_NO_ERROR if no error occurs during execution
+ */
+int udp_get_dropped(udpsock_t *socket, unsigned long *dropped);
+
+/**
+ * Return the socket descriptor of the 'socket'
+ * If 'socket' is NULL or not yet bound, UDP_SOCKET_ERROR is returned
+ * \param socket the socket to get the socket descriptor from
+ * \param sd a pointer to an int that can hold the socket descriptor
+ * \return UDP_NO_ERROR if no error occurs during execution
+ */
+int udp_get_sd(udpsock_t *socket, int *sd);
+
+#endif  //__UDPSOCK_H__
@@ -1,15 +1,21 @@
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <signal.h>
 #include <time.h>
 #include <sys/select.h>
 #include <sys/wait.h>
+#include <sys/eventfd.h>
 
 #include "config.h"
 #include "sbuffer.h"
 #include "connmgr.h"
+#include "udpmgr.h"
 #include "datamgr.h"
 #include "sensor_db.h"
 
@@ -20,6 +26,7 @@
 #define LOGGER_RETRIES_LIMIT 4
 
 #define LOG_FILE "gateway.log"
+#define SHARED_BUFFER_NAME "/sensor_gateway_%d"     // shared memory segment of the buffer, per port
 #define BUFFER_SIZE 1024
 
 // Buffer Sync
@@ -31,6 +38,14 @@ pthread_mutex_t pipe_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 int PIPE_READ, PIPE_WRITE;
 
+// Stop event of the Connection Manager, written by the handler of SIGINT and SIGTERM
+static int stop_fd = -1;
+// Statistics events of the Connection Manager and the Data Manager, written by the handler of SIGUSR1
+static int stats_fd = -1;
+static int rooms_fd = -1;
+// Reload event of the Data Manager, written by the handler of SIGHUP
+static int reload_fd = -1;
+
 int write_to_pipe(const char *message) {
     pthread_mutex_lock(&pipe_mutex);
 
@@ -58,7 +73,7 @@ ssize_t read_from_pipe(char *buffer, ssize_t size, int timeout_sec) {
     FD_ZERO(&read_fds);
     FD_SET(PIPE_READ, &read_fds);
 
-    int retval = select(PIPE_READ + 1, &read_fds, NULL, NULL, &timeout);
+    int retval = select(PIPE_READ + 1, &read_fds, NULL, NULL, timeout_sec < 0 ? NULL : &timeout);
     if (retval == -1) {
         perror("[ERROR] Select failed");
         return -1;
@@ -67,51 +82,319 @@ ssize_t read_from_pipe(char *buffer, ssize_t size, int timeout_sec) {
         return 0;
     }
 
-    return read(PIPE_READ, buffer, size);
+    // End of file: every write end is closed, nothing will ever come again
+    ssize_t bytes_read = read(PIPE_READ, buffer, size);
+    return bytes_read == 0 ? -1 : bytes_read;
+}
+
+// Handler of SIGINT and SIGTERM, lets the Connection Manager drain the gateway instead of killing it
+static void stop_handler(int signum) {
+    int saved_errno = errno;
+    uint64_t value = 1;
+    if (stop_fd >= 0 && write(stop_fd, &value, sizeof(value)) < 0) {
+        // Nothing can be reported from a signal handler
+    }
+    errno = saved_errno;
+}
+
+// Handler of SIGUSR1, lets the Connection Manager log the statistics of all open connections and the Data Manager
+// those of all rooms
+static void stats_handler(int signum) {
+    int saved_errno = errno;
+    uint64_t value = 1;
+    if (stats_fd >= 0 && write(stats_fd, &value, sizeof(value)) < 0) {
+        // Nothing can be reported from a signal handler
+    }
+    if (rooms_fd >= 0 && write(rooms_fd, &value, sizeof(value)) < 0) {
+        // Nothing can be reported from a signal handler
+    }
+    errno = saved_errno;
+}
+
+// Handler of SIGHUP, lets the Data Manager reload room_sensor.map
+static void reload_handler(int signum) {
+    int saved_errno = errno;
+    uint64_t value = 1;
+    if (reload_fd >= 0 && write(reload_fd, &value, sizeof(value)) < 0) {
+        // Nothing can be reported from a signal handler
+    }
+    errno = saved_errno;
+}
+
+// The child processes keep running through SIGINT and SIGTERM, the main process ends them once the gateway is drained
+// SIGUSR1 and SIGHUP are only meant for the main process, they would kill a child
+static void ignore_stop_signals(void) {
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTERM, SIG_IGN);
+    signal(SIGUSR1, SIG_IGN);
+    signal(SIGHUP, SIG_IGN);
+}
+
+/**
+ * Structure storing the Gateway Options
+ *
+ * @param buffer_capacity Number of slots in the shared buffer
+ * @param buffer_policy What the shared buffer does when it is full
+ * @param buffer_shards Number of independent queues in the shared buffer
+ * @param storage_process Run the Storage Manager in its own process, on a shared memory buffer
+ * @param connmgr_mode How the Connection Manager serves the Sensor Nodes
+ * @param reactors Number of reactor threads of the Connection Manager
+ * @param udp Also receive measurements as UDP datagrams on the port of the gateway
+ * @param connection_limit What max_clients limits, one of the CONNMGR_LIMIT_* values
+ * @param unix_path Path of a Unix domain socket for Sensor Nodes on the same host, NULL for TCP only
+ * @param datamgr_workers Number of Data Manager threads, each owning a part of the shards of the buffer
+ */
+typedef struct {
+    unsigned int buffer_capacity;
+    int buffer_policy;
+    unsigned int buffer_shards;
+    int storage_process;
+    int connmgr_mode;
+    int reactors;
+    int udp;
+    int connection_limit;
+    const char *unix_path;
+    int datamgr_workers;
+} gateway_options_t;
+
+/**
+ * Runs the Storage Manager in a child process and restarts it whenever it crashes
+ * The buffer lives in shared memory, so ingest keeps going and a new storage process continues where the last one stopped
+ * \param buffer the shared buffer
+ */
+void storage_supervisor(sbuffer_t *buffer) {
+    char message[BUFFER_SIZE];
+    sensor_db_args_t args = {
+        .buffer = buffer,
+        .append = 0
+    };
+
+    while (1) {
+        pid_t storage_pid = fork();
+        if (storage_pid < 0) {
+            perror("[ERROR] Fork of the storage process failed");
+            return;
+        }
+        if (storage_pid == 0) {
+            sensor_db_logic(&args);
+            sbuffer_free(buffer);
+            exit(EXIT_SUCCESS);
+        }
+
+        int status;
+        if (waitpid(storage_pid, &status, 0) == -1) {
+            perror("[ERROR] Failed to wait for storage process");
+            return;
+        }
+        if (!WIFSIGNALED(status)) return;
+
+        // LOG
+        snprintf(message, BUFFER_SIZE, "Storage process %d was killed by signal %d, restarting it.",
+                 storage_pid, WTERMSIG(status));
+        write_to_pipe(message);
+        args.append = 1;
+    }
 }
 
-void main_process(int port, int max_clients) {
+void main_process(int port, int max_clients, const gateway_options_t *options) {
     printf("Main process started. Port: %d, Max Clients: %d\n", port, max_clients);
 
     // Shared buffer initialization
-    sbuffer_t *shared_buffer = sbuffer_init();
+    sbuffer_t *shared_buffer;
+    if (options->storage_process) {
+        char name[SBUFFER_NAME_SIZE];
+        snprintf(name, sizeof(name), SHARED_BUFFER_NAME, port);
+        shared_buffer = sbuffer_init_shared(name, options->buffer_capacity, options->buffer_policy,
+                                            options->buffer_shards);
+    } else {
+        shared_buffer = sbuffer_init(options->buffer_capacity, options->buffer_policy, options->buffer_shards);
+    }
     if (!shared_buffer) {
         perror("[ERROR] Failed to initialize shared buffer");
         exit(EXIT_FAILURE);
     }
 
+    // The storage process is forked before any thread exists, so it starts from a clean copy of this process
+    pid_t storage_pid = -1;
+    if (options->storage_process) {
+        fflush(stdout);
+        storage_pid = fork();
+        if (storage_pid < 0) {
+            perror("[ERROR] Fork of the storage process failed");
+            sbuffer_free(shared_buffer);
+            exit(EXIT_FAILURE);
+        }
+        if (storage_pid == 0) {
+            ignore_stop_signals();
+            storage_supervisor(shared_buffer);
+            sbuffer_free(shared_buffer);
+            exit(EXIT_SUCCESS);
+        }
+    }
+
+    // SIGINT and SIGTERM drain the gateway: no new connections, every stage finishes what it holds, then all exit
+    stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (stop_fd < 0) {
+        perror("[ERROR] Failed to create the stop event of the Connection Manager");
+        sbuffer_free(shared_buffer);
+        exit(EXIT_FAILURE);
+    }
+    struct sigaction stop_action;
+    memset(&stop_action, 0, sizeof(stop_action));
+    stop_action.sa_handler = stop_handler;
+    stop_action.sa_flags = SA_RESTART;
+    sigemptyset(&stop_action.sa_mask);
+    sigaction(SIGINT, &stop_action, NULL);
+    sigaction(SIGTERM, &stop_action, NULL);
+
+    // SIGUSR1 dumps the statistics of the open connections and of the rooms to the log, the gateway keeps running
+    stats_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    rooms_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (stats_fd < 0 || rooms_fd < 0) {
+        perror("[ERROR] Failed to create the statistics events");
+    } else {
+        struct sigaction stats_action = stop_action;
+        stats_action.sa_handler = stats_handler;
+        sigaction(SIGUSR1, &stats_action, NULL);
+    }
+
+    // SIGHUP reloads room_sensor.map, the sensors that stay keep their running averages
+    reload_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reload_fd < 0) {
+        perror("[ERROR] Failed to create the reload event of the Data Manager");
+    } else {
+        struct sigaction reload_action = stop_action;
+        reload_action.sa_handler = reload_handler;
+        sigaction(SIGHUP, &reload_action, NULL);
+    }
+
     // Connection Manager Arguments
     connmgr_args_t connmgr_args = {
         .buffer = shared_buffer,
         .port = port,
-        .max_connections = max_clients
+        .max_connections = max_clients,
+        .mode = options->connmgr_mode,
+        .reactors = options->reactors,
+        .limit = options->connection_limit,
+        .stop_fd = stop_fd,
+        .unix_path = options->unix_path,
+        .stats_fd = stats_fd
     };
 
+    // UDP Manager Arguments
+    udpmgr_args_t udpmgr_args = {
+        .buffer = shared_buffer,
+        .port = port,
+        .stop_fd = -1
+    };
+    if (options->udp && (udpmgr_args.stop_fd = eventfd(0, EFD_CLOEXEC)) < 0) {
+        perror("[ERROR] Failed to create the stop event of the UDP Manager");
+        sbuffer_free(shared_buffer);
+        exit(EXIT_FAILURE);
+    }
+
+    // Storage Manager Arguments
+    sensor_db_args_t sensor_db_args = {
+        .buffer = shared_buffer,
+        .append = 0
+    };
+
+    // Data Manager Arguments, a worker per part of the shards
+    datamgr_args_t datamgr_args[DATAMGR_MAX_WORKERS];
+    datamgr_partition(datamgr_args, shared_buffer, options->datamgr_workers);
+
+    // Data Manager Control Arguments
+    datamgr_control_args_t datamgr_control_args = {
+        .workers = datamgr_args,
+        .count = options->datamgr_workers,
+        .stats_fd = rooms_fd,
+        .reload_fd = reload_fd,
+        .quit_fd = eventfd(0, EFD_CLOEXEC)
+    };
+    if (datamgr_control_args.quit_fd < 0) {
+        perror("[ERROR] Failed to create the stop event of the Data Manager control thread");
+        sbuffer_free(shared_buffer);
+        exit(EXIT_FAILURE);
+    }
+
     // Threads
-    pthread_t connmgr_tid, datamgr_tid, storagemgr_tid;
+    pthread_t connmgr_tid, udpmgr_tid, datamgr_tids[DATAMGR_MAX_WORKERS], datamgr_control_tid, storagemgr_tid;
 
     // Create threads with error handling
-    if (pthread_create(&connmgr_tid, NULL, connmgr_logic, &connmgr_args) != 0 ||
-        pthread_create(&datamgr_tid, NULL, datamgr_logic, shared_buffer) != 0 ||
-        pthread_create(&storagemgr_tid, NULL, sensor_db_logic, shared_buffer) != 0) {
+    int datamgr_started = 0;
+    while (datamgr_started < options->datamgr_workers &&
+           pthread_create(&datamgr_tids[datamgr_started], NULL, datamgr_logic, &datamgr_args[datamgr_started]) == 0) {
+        datamgr_started++;
+    }
+    if (datamgr_started < options->datamgr_workers ||
+        pthread_create(&datamgr_control_tid, NULL, datamgr_control_logic, &datamgr_control_args) != 0 ||
+        pthread_create(&connmgr_tid, NULL, connmgr_logic, &connmgr_args) != 0 ||
+        (options->udp && pthread_create(&udpmgr_tid, NULL, udpmgr_logic, &udpmgr_args) != 0) ||
+        (!options->storage_process &&
+         pthread_create(&storagemgr_tid, NULL, sensor_db_logic, &sensor_db_args) != 0)) {
         perror("[ERROR] Failed to create threads");
         sbuffer_free(shared_buffer);
         exit(EXIT_FAILURE);
     }
 
-    // Wait for threads to complete
+    // Wait for threads to complete, the UDP Manager runs as long as the Connection Manager
     pthread_join(connmgr_tid, NULL);
-    pthread_join(datamgr_tid, NULL);
-    pthread_join(storagemgr_tid, NULL);
+    if (options->udp) {
+        uint64_t stop = 1;
+        if (write(udpmgr_args.stop_fd, &stop, sizeof(stop)) < 0) perror("[ERROR] Stopping the UDP Manager failed");
+        pthread_join(udpmgr_tid, NULL);
+        close(udpmgr_args.stop_fd);
+    }
+    // The control thread stops before the workers, which free their sensor tables on exit
+    uint64_t quit = 1;
+    if (write(datamgr_control_args.quit_fd, &quit, sizeof(quit)) < 0) perror("[ERROR] Stopping the Data Manager control thread failed");
+    pthread_join(datamgr_control_tid, NULL);
+    close(datamgr_control_args.quit_fd);
+    // No more data comes in, the consumers finish what is left in the buffer
+    sbuffer_terminate(shared_buffer);
+    for (int i = 0; i < options->datamgr_workers; i++) {
+        pthread_join(datamgr_tids[i], NULL);
+    }
+    if (!options->storage_process) {
+        pthread_join(storagemgr_tid, NULL);
+    } else if (waitpid(storage_pid, NULL, 0) == -1) {
+        perror("[ERROR] Failed to wait for storage process");
+    }
+
+    // LOG
+    sbuffer_stats_t stats;
+    char message[BUFFER_SIZE];
+    sbuffer_get_stats(shared_buffer, &stats);
+    snprintf(message, BUFFER_SIZE,
+             "Shared buffer (%s): inserted %lu, stalls %lu, dropped oldest %lu, dropped newest %lu, spilled %lu, unspilled %lu, ingest full %lu",
+             sbuffer_policy_name(options->buffer_policy), stats.inserted, stats.stalls,
+             stats.dropped_oldest, stats.dropped_newest, stats.spilled, stats.unspilled, stats.ingest_full);
+    write_to_pipe(message);
 
     // Cleanup
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGUSR1, SIG_DFL);
+    signal(SIGHUP, SIG_DFL);
+    close(stop_fd);
+    stop_fd = -1;
+    if (stats_fd >= 0) close(stats_fd);
+    stats_fd = -1;
+    if (rooms_fd >= 0) close(rooms_fd);
+    rooms_fd = -1;
+    if (reload_fd >= 0) close(reload_fd);
+    reload_fd = -1;
     sbuffer_free(shared_buffer);
     pthread_mutex_destroy(&pipe_mutex);
 
     printf("Main process exited.\n");
 }
 
-void logger_process(void) {
+/**
+ * Writes every line that comes through the pipe to the log file
+ * Exits once the pipe is closed, or after LOGGER_RETRIES_LIMIT timeouts in a row unless 'long_running' is set
+ */
+void logger_process(int long_running) {
     printf("Logger Process started.\n");
     FILE *log_file = fopen(LOG_FILE, "w");
     if (!log_file) {
@@ -125,7 +408,8 @@ void logger_process(void) {
     int retries_count = 0;
 
     while (1) {
-        ssize_t bytes_read = read_from_pipe(buffer, sizeof(buffer) - 1, LOGGER_TIMEOUT_S);
+        // A long-running gateway may be silent for any time
+        ssize_t bytes_read = read_from_pipe(buffer, sizeof(buffer) - 1, long_running ? -1 : LOGGER_TIMEOUT_S);
 
         if (bytes_read > 0) {
             buffer[bytes_read] = '\0'; // Null-terminate the string
@@ -166,14 +450,122 @@ void logger_process(void) {
     printf("Logger process exited.\n");
 }
 
+/**
+ * Parses the count 'text' of option 'option', which has to be a number from 1 to 'max'
+ * \return the count, 0 after printing an error if 'text' isn't a valid count
+ */
+static unsigned long parse_count(const char *text, char option, unsigned long max) {
+    char *end;
+    errno = 0;
+    unsigned long value = strtoul(text, &end, 10);
+    if (errno != 0 || end == text || *end != '\0' || text[0] == '-' || value < 1 || value > max) {
+        fprintf(stderr, "Error: The value of -%c must be a number between 1 and %lu.\n", option, max);
+        return 0;
+    }
+    return value;
+}
+
+void print_help(const char *program) {
+    fprintf(stderr, "Gateway Init Hint: %s [options] <port> <max_clients>\n", program);
+    fprintf(stderr, "\t%-15s : number of slots in the shared buffer (default %d, at most %u)\n", "-c capacity", SBUFFER_DEFAULT_CAPACITY, SBUFFER_MAX_CAPACITY);
+    fprintf(stderr, "\t%-15s : block, drop-oldest, drop-newest or spill when the buffer is full (default block)\n", "-p policy");
+    fprintf(stderr, "\t%-15s : number of shards in the shared buffer, picked by sensor ID (default %d, at most %d)\n", "-s shards",
+            SBUFFER_DEFAULT_SHARDS, SBUFFER_MAX_SHARDS);
+    fprintf(stderr, "\t%-15s : run the Storage Manager in its own process, on a shared memory buffer\n", "-P");
+    fprintf(stderr, "\t%-15s : epoll to multiplex the Sensor Nodes over a few threads, uring to serve them from one io_uring (epoll if the kernel lacks it), threads for a thread per Sensor Node (default epoll)\n", "-m mode");
+    fprintf(stderr, "\t%-15s : number of reactor threads in epoll mode (default %d, at most %d)\n", "-r reactors", CONNMGR_DEFAULT_REACTORS, CONNMGR_MAX_REACTORS);
+    fprintf(stderr, "\t%-15s : also receive measurements as UDP datagrams on <port>\n", "-u");
+    fprintf(stderr, "\t%-15s : run until SIGINT or SIGTERM, <max_clients> Sensor Nodes at once; queue or reject the others\n", "-l limit");
+    fprintf(stderr, "\t%-15s : also accept Sensor Nodes on the same host on the Unix domain socket <path>\n", "-U path");
+    fprintf(stderr, "\t%-15s : number of Data Manager threads, the sensors are split over them by shard; raises -s to at least <workers> (default %d, at most %d)\n", "-w workers", DATAMGR_DEFAULT_WORKERS, DATAMGR_MAX_WORKERS);
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Gateway Init Hint: %s <port> <max_clients>\n", argv[0]);
+    gateway_options_t options = {
+        .buffer_capacity = SBUFFER_DEFAULT_CAPACITY,
+        .buffer_policy = SBUFFER_POLICY_BLOCK,
+        .buffer_shards = SBUFFER_DEFAULT_SHARDS,
+        .storage_process = 0,
+        .connmgr_mode = CONNMGR_MODE_EPOLL,
+        .reactors = CONNMGR_DEFAULT_REACTORS,
+        .udp = 0,
+        .connection_limit = CONNMGR_LIMIT_TOTAL,
+        .unix_path = NULL,
+        .datamgr_workers = DATAMGR_DEFAULT_WORKERS
+    };
+
+    int option;
+    while ((option = getopt(argc, argv, "c:p:s:Pm:r:ul:U:w:")) != -1) {
+        switch (option) {
+            case 'c':
+                options.buffer_capacity = (unsigned int)parse_count(optarg, option, SBUFFER_MAX_CAPACITY);
+                if (options.buffer_capacity == 0) return EXIT_FAILURE;
+                break;
+            case 'p':
+                options.buffer_policy = sbuffer_policy_from_name(optarg);
+                if (options.buffer_policy == SBUFFER_FAILURE) {
+                    fprintf(stderr, "Error: Unknown buffer policy '%s'.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 's':
+                options.buffer_shards = (unsigned int)parse_count(optarg, option, SBUFFER_MAX_SHARDS);
+                if (options.buffer_shards == 0) return EXIT_FAILURE;
+                break;
+            case 'P':
+                options.storage_process = 1;
+                break;
+            case 'm':
+                options.connmgr_mode = connmgr_mode_from_name(optarg);
+                if (options.connmgr_mode < 0) {
+                    fprintf(stderr, "Error: Unknown connection mode '%s'.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'r':
+                options.reactors = (int)parse_count(optarg, option, CONNMGR_MAX_REACTORS);
+                if (options.reactors == 0) return EXIT_FAILURE;
+                break;
+            case 'u':
+                options.udp = 1;
+                break;
+            case 'l':
+                options.connection_limit = connmgr_limit_from_name(optarg);
+                if (options.connection_limit < 0) {
+                    fprintf(stderr, "Error: Unknown connection limit '%s'.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'U':
+                options.unix_path = optarg;
+                break;
+            case 'w':
+                options.datamgr_workers = (int)parse_count(optarg, option, DATAMGR_MAX_WORKERS);
+                if (options.datamgr_workers == 0) return EXIT_FAILURE;
+                break;
+            default:
+                print_help(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind != 2) {
+        print_help(argv[0]);
         return EXIT_FAILURE;
     }
 
-    int port = atoi(argv[1]);
-    int max_clients = atoi(argv[2]);
+    if (options.storage_process && options.buffer_policy == SBUFFER_POLICY_SPILL) {
+        fprintf(stderr, "Error: The spill policy can't be used with a separate storage process.\n");
+        return EXIT_FAILURE;
+    }
+
+    // Every worker owns at least one shard
+    if (options.buffer_shards < (unsigned int)options.datamgr_workers) {
+        options.buffer_shards = (unsigned int)options.datamgr_workers;
+    }
+
+    int port = atoi(argv[optind]);
+    int max_clients = atoi(argv[optind + 1]);
 
     if (port <= 0 || max_clients <= 0) {
         fprintf(stderr, "Error: Invalid port or max_clients value.\n");
@@ -199,8 +591,9 @@ int main(int argc, char *argv[]) {
 
     // CHILD Process (Logger)
     if (process_id == 0) {
+        ignore_stop_signals();
         close(PIPE_WRITE);
-        logger_process();
+        logger_process(options.connection_limit != CONNMGR_LIMIT_TOTAL);
         close(PIPE_READ);
         return EXIT_SUCCESS;
     }
@@ -208,7 +601,7 @@ int main(int argc, char *argv[]) {
     // PARENT Process (Main)
     else {
         close(PIPE_READ);
-        main_process(port, max_clients);
+        main_process(port, max_clients, &options);
         close(PIPE_WRITE);
         // Wait for the CHILD process to exit
         if (waitpid(process_id, NULL, 0) == -1) {
@@ -0,0 +1,54 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include "config.h"
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Wire protocol between the Sensor Nodes and the gateway, all fields in host byte order
+ *
+ * Legacy: every measurement is sent as <sensor_id><temperature><timestamp> (PROTOCOL_RECORD_SIZE bytes), without framing.
+ *
+ * Framed: the Sensor Node opens with a hello, a record of the same size with sensor id PROTOCOL_HELLO_ID followed by
+ * <PROTOCOL_MAGIC><version> (4 bytes each) and 8 zero bytes. The gateway answers with a hello carrying the version it
+ * will speak. After that the Sensor Node sends frames: a header <sensor_id><count> (2 bytes each) followed by 'count'
+ * readings <temperature><timestamp>, at most PROTOCOL_MAX_READINGS per frame. A frame without readings is allowed.
+ * A legacy Sensor Node never sends a hello, so the gateway serves both on the same port. Sensor id PROTOCOL_HELLO_ID is reserved.
+ */
+#define PROTOCOL_RECORD_SIZE (sizeof(sensor_id_t) + sizeof(sensor_value_t) + sizeof(sensor_ts_t))
+#define PROTOCOL_HELLO_ID 0xFFFF
+#define PROTOCOL_MAGIC 0x46574753       // "SGWF"
+#define PROTOCOL_VERSION 1
+#define PROTOCOL_HEADER_SIZE (sizeof(sensor_id_t) + sizeof(uint16_t))
+#define PROTOCOL_READING_SIZE (sizeof(sensor_value_t) + sizeof(sensor_ts_t))
+#define PROTOCOL_MAX_READINGS 1024
+
+/**
+ * Writes a hello for protocol version 'version' to 'record', which holds PROTOCOL_RECORD_SIZE bytes
+ */
+static inline void protocol_hello_encode(unsigned char *record, uint32_t version) {
+    sensor_id_t id = PROTOCOL_HELLO_ID;
+    uint32_t magic = PROTOCOL_MAGIC;
+    memset(record, 0, PROTOCOL_RECORD_SIZE);
+    memcpy(record, &id, sizeof(id));
+    memcpy(record + sizeof(id), &magic, sizeof(magic));
+    memcpy(record + sizeof(id) + sizeof(magic), &version, sizeof(version));
+}
+
+/**
+ * Checks if the PROTOCOL_RECORD_SIZE bytes in 'record' are a hello
+ * \param version set to the protocol version of the hello
+ * \return 1 if 'record' is a hello, 0 if it is a legacy measurement
+ */
+static inline int protocol_hello_decode(const unsigned char *record, uint32_t *version) {
+    sensor_id_t id;
+    uint32_t magic;
+    memcpy(&id, record, sizeof(id));
+    memcpy(&magic, record + sizeof(id), sizeof(magic));
+    if (id != PROTOCOL_HELLO_ID || magic != PROTOCOL_MAGIC) return 0;
+    memcpy(version, record + sizeof(id) + sizeof(magic), sizeof(*version));
+    return 1;
+}
+
+#endif // PROTOCOL_H
@@ -0,0 +1,102 @@
+#define _GNU_SOURCE
+
+#include "roomstats.h"
+#include <math.h>
+
+#define GAMMA ((1.0 + ROOM_SKETCH_ACCURACY) / (1.0 - ROOM_SKETCH_ACCURACY))
+#define ZERO_BUCKET (-1)
+
+// Single writer, any number of readers: a plain read-modify-write by the owner, published with a relaxed store
+#define STAT_ADD(field, n) __atomic_store_n(&(field), (field) + (n), __ATOMIC_RELAXED)
+#define STAT_GET(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+static void stat_set_double(double *field, double value) {
+    __atomic_store(field, &value, __ATOMIC_RELAXED);
+}
+
+static double stat_get_double(const double *field) {
+    double value;
+    __atomic_load(field, &value, __ATOMIC_RELAXED);
+    return value;
+}
+
+// Position of the bucket of magnitude 'magnitude' > 0, ZERO_BUCKET if it is below the smallest bucket
+static int bucket_of(double magnitude) {
+    int position = (int) ceil(log(magnitude) / log(GAMMA)) + ROOM_SKETCH_BUCKETS / 2;
+    if (position < 0) return ZERO_BUCKET;
+    return position < ROOM_SKETCH_BUCKETS ? position : ROOM_SKETCH_BUCKETS - 1;
+}
+
+// Value in the middle of the bucket at 'position', off by at most ROOM_SKETCH_ACCURACY from anything in it
+static double bucket_value(int position) {
+    return 2.0 * pow(GAMMA, position - ROOM_SKETCH_BUCKETS / 2) / (GAMMA + 1.0);
+}
+
+// The extreme buckets also hold everything beyond them, while min and max are exact
+static double clamp(const room_stats_t *stats, double value) {
+    if (value < stats->min) return stats->min;
+    return value > stats->max ? stats->max : value;
+}
+
+void room_stats_add(room_stats_t *stats, double value) {
+    if (stats->count == 0 || value < stats->min) stat_set_double(&stats->min, value);
+    if (stats->count == 0 || value > stats->max) stat_set_double(&stats->max, value);
+    stat_set_double(&stats->sum, stats->sum + value);
+
+    int position = value != 0.0 ? bucket_of(fabs(value)) : ZERO_BUCKET;
+    if (position == ZERO_BUCKET) {
+        STAT_ADD(stats->zero, 1);
+    } else if (value > 0.0) {
+        STAT_ADD(stats->positive[position], 1);
+    } else {
+        STAT_ADD(stats->negative[position], 1);
+    }
+    // Last, so a reader that sees the reading counted also finds it in min and max
+    __atomic_store_n(&stats->count, stats->count + 1, __ATOMIC_RELEASE);
+}
+
+void room_stats_merge(room_stats_t *summary, const room_stats_t *stats) {
+    uint64_t count = __atomic_load_n(&stats->count, __ATOMIC_ACQUIRE);
+    summary->room_id = stats->room_id;
+    summary->sensors += STAT_GET(stats->sensors);
+    if (count == 0) return;
+
+    double min = stat_get_double(&stats->min), max = stat_get_double(&stats->max);
+    if (summary->count == 0 || min < summary->min) summary->min = min;
+    if (summary->count == 0 || max > summary->max) summary->max = max;
+    summary->count += count;
+    summary->sum += stat_get_double(&stats->sum);
+    summary->zero += STAT_GET(stats->zero);
+    for (int i = 0; i < ROOM_SKETCH_BUCKETS; i++) {
+        summary->positive[i] += STAT_GET(stats->positive[i]);
+        summary->negative[i] += STAT_GET(stats->negative[i]);
+    }
+}
+
+double room_stats_mean(const room_stats_t *stats) {
+    return stats->count > 0 ? stats->sum / stats->count : 0.0;
+}
+
+double room_stats_quantile(const room_stats_t *stats, double q) {
+    // The buckets may have moved on since 'count' was read, so the walk counts its own total
+    uint64_t total = stats->zero;
+    for (int i = 0; i < ROOM_SKETCH_BUCKETS; i++) total += stats->positive[i] + stats->negative[i];
+    if (total == 0) return 0.0;
+
+    q = q < 0.0 ? 0.0 : (q > 1.0 ? 1.0 : q);
+    uint64_t rank = (uint64_t) (q * (total - 1));
+    uint64_t seen = 0;
+
+    // From the most negative values over 0 to the most positive ones
+    for (int i = ROOM_SKETCH_BUCKETS - 1; i >= 0; i--) {
+        seen += stats->negative[i];
+        if (seen > rank) return clamp(stats, -bucket_value(i));
+    }
+    seen += stats->zero;
+    if (seen > rank) return clamp(stats, 0.0);
+    for (int i = 0; i < ROOM_SKETCH_BUCKETS; i++) {
+        seen += stats->positive[i];
+        if (seen > rank) return clamp(stats, bucket_value(i));
+    }
+    return stats->max;
+}
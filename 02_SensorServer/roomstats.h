@@ -0,0 +1,69 @@
+#ifndef ROOMSTATS_H
+#define ROOMSTATS_H
+
+#include <stdint.h>
+
+#define ROOM_SKETCH_ACCURACY 0.01       // relative error of the quantiles
+#define ROOM_SKETCH_BUCKETS 1024        // buckets per sign, they cover magnitudes from about 4e-5 to 2.7e4
+
+/**
+ * Statistics of the readings of the sensors of a room, since the gateway started
+ *
+ * Only the Data Manager worker that owns the sensors updates them, other threads may read them at any time: every
+ * field is written and read with relaxed atomics, so a reader sees each field whole but not all fields of the same
+ * moment. The quantiles come from a sketch of logarithmic buckets: a value v > 0 is counted in bucket
+ * ceil(log(v) / log(gamma)), with gamma = (1 + ROOM_SKETCH_ACCURACY) / (1 - ROOM_SKETCH_ACCURACY), so every quantile
+ * is off by at most ROOM_SKETCH_ACCURACY of its value, and sketches of the same room merge by adding up the buckets.
+ *
+ * @param room_id Room ID
+ * @param sensors Number of sensors of the room, set when the map is loaded
+ * @param count Number of readings
+ * @param sum Sum of the readings
+ * @param min Smallest reading
+ * @param max Largest reading
+ * @param zero Readings too close to 0 for the buckets
+ * @param positive Readings > 0 per bucket, bucket k at position k + ROOM_SKETCH_BUCKETS / 2
+ * @param negative Readings < 0 per bucket of their magnitude
+ */
+typedef struct {
+    uint16_t room_id;
+    int sensors;
+    uint64_t count;
+    double sum;
+    double min;
+    double max;
+    uint64_t zero;
+    uint64_t positive[ROOM_SKETCH_BUCKETS];
+    uint64_t negative[ROOM_SKETCH_BUCKETS];
+} room_stats_t;
+
+/**
+ * Adds reading 'value' to the statistics of a room, only to be called by the owner of 'stats'
+ * This takes constant time.
+ * \param stats the statistics of the room
+ * \param value the reading
+ */
+void room_stats_add(room_stats_t *stats, double value);
+
+/**
+ * Adds the statistics of 'stats' to 'summary', which may already hold the statistics of the same room of other workers
+ * Safe to call from any thread while the owner keeps adding readings.
+ * \param summary the merged statistics, zeroed before the first call
+ * \param stats the statistics to add
+ */
+void room_stats_merge(room_stats_t *summary, const room_stats_t *stats);
+
+/**
+ * Returns the mean of the readings in 'stats', 0 if there are none
+ */
+double room_stats_mean(const room_stats_t *stats);
+
+/**
+ * Returns an estimate of quantile 'q' of the readings in 'stats', within ROOM_SKETCH_ACCURACY of the real value
+ * \param stats the statistics, as merged by room_stats_merge
+ * \param q the quantile, between 0 and 1
+ * \return the estimate, 0 if there are no readings
+ */
+double room_stats_quantile(const room_stats_t *stats, double q);
+
+#endif // ROOMSTATS_H
@@ -1,187 +1,1151 @@
+#define _GNU_SOURCE
+
 #include "sbuffer.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
+#include <stdatomic.h>
+
+#define SBUFFER_CACHE_LINE 64
+
+#ifdef SBUFFER_FLOAT_VALUES
+typedef float sbuffer_value_t;
+#else
+typedef double sbuffer_value_t;
+#endif
 
 /**
- * basic node for the buffer, these nodes are linked together to create the buffer
+ * packed form of sensor_data_t as it is kept in the buffer and in the spill files
+ * The timestamp is stored as an offset in seconds to the epoch of the buffer, so a record takes 16 bytes
+ * instead of 24, or 12 bytes when compiled with SBUFFER_FLOAT_VALUES
  */
-typedef struct sbuffer_node {
-    sensor_data_t data;
-    int processed;
-    struct sbuffer_node *next;
-} sbuffer_node_t;
+typedef struct {
+    sbuffer_value_t value;
+    int32_t ts_offset;
+    sensor_id_t id;
+} sbuffer_record_t;
 
+#ifdef SBUFFER_FLOAT_VALUES
+_Static_assert(sizeof(sbuffer_record_t) == 12, "sbuffer_record_t is not packed");
+#else
+_Static_assert(sizeof(sbuffer_record_t) == 16, "sbuffer_record_t is not packed");
+#endif
 
 /**
- * a structure to keep track of the buffer
+ * a single preallocated slot of a ring, slots are reused once the last stage is done with them
  */
-struct sbuffer {
-    sbuffer_node_t *head;
-    sbuffer_node_t *tail;
+typedef struct {
+    sbuffer_record_t record;
+} sbuffer_slot_t;
+
+/**
+ * a slot of the lock-free ingest queue
+ * 'sequence' tells the state of the slot for the position 'p' that maps on it: equal to 'p' when the slot is free,
+ * 'p + 1' once a producer published its data and 'p + ingest_size' after it was collected into the ring
+ */
+typedef struct {
+    atomic_ulong sequence;
+    sbuffer_record_t record;
+} sbuffer_ingest_slot_t;
+
+/**
+ * read position of one consumer stage, padded to a full cache line
+ */
+typedef struct {
+    _Alignas(SBUFFER_CACHE_LINE) unsigned long position;
+} sbuffer_cursor_t;
+
+/**
+ * one independent queue of the buffer, all data of a sensor goes to the same shard
+ * 'tail' is only advanced by the producers, every consumer stage only advances its own cursor.
+ * A stage can only read data that the previous stage has already passed, the last stage
+ * frees the slots. Each of these positions lives on its own cache line.
+ * Producers don't touch the ring directly: they publish into the bounded multi-producer 'ingest' queue without
+ * taking the mutex, whoever holds the mutex next collects the published data into the ring.
+ * The ingest slots count against the capacity, so the ring and the ingest queue together never hold more than it.
+ */
+typedef struct {
     pthread_mutex_t mutex;
-    pthread_cond_t cond;
+    atomic_uint frees;          // bumped whenever the last stage frees slots, blocked producers sleep on it
+    int blocked;                // number of producers sleeping on 'frees'
+    int shared;                 // set if the buffer is shared between processes
+    unsigned int index;         // position of the shard in the buffer, part of every handle
+    unsigned int capacity;      // always a power of two
+    unsigned int mask;          // capacity - 1, used to map a position on a slot
+    unsigned int ingest_size;   // ingest slots in use, a power of two, the ring only holds 'capacity - ingest_size'
     int terminate;
+    int policy;                 // what to do with new data when the ring is full
+    int spill_fd;               // temporary file holding spilled data, -1 if not used
+    unsigned long spill_head;   // index of the oldest record in the spill file
+    unsigned long spill_tail;   // index of the next free record in the spill file
+    sbuffer_stats_t stats;
+    _Alignas(SBUFFER_CACHE_LINE) unsigned long tail;    // position of the next free slot
+    sbuffer_cursor_t cursors[SBUFFER_STAGES];           // position of the next slot for each stage
+    _Alignas(SBUFFER_CACHE_LINE) atomic_ulong ingest_tail;  // next ingest position to claim, shared by the producers
+    _Alignas(SBUFFER_CACHE_LINE) unsigned long ingest_head; // next ingest position to collect, only used under the mutex
+    sbuffer_ingest_slot_t ingest[SBUFFER_INGEST_CAPACITY];
+    _Alignas(SBUFFER_CACHE_LINE) sbuffer_slot_t slots[];
+} sbuffer_shard_t;
+
+/**
+ * consumers of a stage that ran out of data sleep here
+ * Producers only make a system call when 'sleepers' says somebody is actually waiting. Sleeping is a futex wait
+ * on 'wakeups', which holds no state about the sleepers, so a process that dies while sleeping can't block anybody.
+ */
+typedef struct {
+    _Alignas(SBUFFER_CACHE_LINE) atomic_int sleepers;
+    atomic_uint wakeups;        // bumped on every wakeup, so a sleeper can tell it missed nothing
+    atomic_uint next_shard;     // where the next read of this stage starts, spreads the work over the shards
+} sbuffer_waiter_t;
+
+/**
+ * a structure to keep track of the buffer
+ * The shards are laid out right after this header, each one 'shard_size' bytes. Nothing in the buffer is a pointer,
+ * so a shared buffer works no matter where each process maps it.
+ */
+struct sbuffer {
+    unsigned int shard_count;
+    size_t shard_size;
+    size_t size;                    // total size of the buffer, including all shards
+    time_t epoch;                   // creation time of the buffer, timestamps are stored relative to it
+    int shared;                     // set if the buffer lives in a shared memory segment
+    pid_t owner;                    // process that created the shared buffer, only it removes the segment
+    unsigned long long owner_start; // start time of 'owner', tells it apart from a later process with the same pid
+    char name[SBUFFER_NAME_SIZE];   // name of the shared memory segment
+    atomic_int ready;               // set once the creator has initialized everything
+    atomic_int terminate;
+    sbuffer_waiter_t waiters[SBUFFER_STAGES];
+    _Alignas(SBUFFER_CACHE_LINE) unsigned char shards[];
 };
 
+/**
+ * Rounds up to the next power of two, SBUFFER_MAX_CAPACITY is a power of two so the doubling can't wrap
+ * A shard needs at least two ingest slots, a single one can't tell published from free, and room in the ring for
+ * as many, so the result is at least 4
+ */
+static unsigned int sbuffer_round_capacity(unsigned int capacity) {
+    unsigned int rounded = 4;
+    while (rounded < capacity && rounded < SBUFFER_MAX_CAPACITY) rounded <<= 1;
+    return rounded;
+}
+
+static size_t sbuffer_align(size_t size) {
+    return (size + SBUFFER_CACHE_LINE - 1) & ~((size_t)SBUFFER_CACHE_LINE - 1);
+}
 
-sbuffer_t *sbuffer_init() {
-    sbuffer_t *buffer = (sbuffer_t *)malloc(sizeof(sbuffer_t));
-    if (!buffer) return NULL;
+/**
+ * Sleeps as long as '*word' still equals 'expected', until woken up or until 'deadline' on the monotonic clock has passed
+ * \return ETIMEDOUT when the deadline has passed, 0 otherwise
+ */
+static int sbuffer_futex_wait(atomic_uint *word, unsigned int expected, const struct timespec *deadline, int shared) {
+    int operation = FUTEX_WAIT_BITSET | (shared ? 0 : FUTEX_PRIVATE_FLAG);
+    if (syscall(SYS_futex, word, operation, expected, deadline, NULL, FUTEX_BITSET_MATCH_ANY) == -1 &&
+        errno == ETIMEDOUT) {
+        return ETIMEDOUT;
+    }
+    return 0;
+}
 
-    buffer->head = NULL;
-    buffer->tail = NULL;
-    buffer->terminate = 0;
-    pthread_mutex_init(&buffer->mutex, NULL);
-    pthread_cond_init(&buffer->cond, NULL);
+// Wakes up everybody sleeping on '*word', which must have been changed first
+static void sbuffer_futex_wake(atomic_uint *word, int shared) {
+    int operation = FUTEX_WAKE | (shared ? 0 : FUTEX_PRIVATE_FLAG);
+    syscall(SYS_futex, word, operation, INT_MAX, NULL, NULL, 0);
+}
 
-    return buffer;
+static sbuffer_shard_t *sbuffer_shard(sbuffer_t *buffer, unsigned int index) {
+    return (sbuffer_shard_t *)(buffer->shards + index * buffer->shard_size);
 }
 
-int sbuffer_free(sbuffer_t *buffer) {
-    if (!buffer) return SBUFFER_FAILURE;
+static sbuffer_slot_t *sbuffer_slot(sbuffer_shard_t *shard, unsigned long position) {
+    return &shard->slots[position & shard->mask];
+}
 
-    pthread_mutex_lock(&buffer->mutex);
-    sbuffer_node_t *current = buffer->head;
-    while (current) {
-        sbuffer_node_t *next = current->next;
-        free(current);
-        current = next;
-    }
-    pthread_mutex_unlock(&buffer->mutex);
+/**
+ * A handle combines the ring position of the data with its shard
+ * The position is never reused within a shard, so a handle stays unique for the lifetime of the buffer
+ */
+static sbuffer_handle_t sbuffer_handle(sbuffer_t *buffer, sbuffer_shard_t *shard, unsigned long position) {
+    return position * buffer->shard_count + shard->index;
+}
+
+// Packs 'data' into '*record', timestamps more than 68 years away from the epoch of the buffer are clamped
+static void sbuffer_pack(sbuffer_t *buffer, const sensor_data_t *data, sbuffer_record_t *record) {
+    long long offset = (long long)data->ts - (long long)buffer->epoch;
+    if (offset > INT32_MAX) offset = INT32_MAX;
+    if (offset < INT32_MIN) offset = INT32_MIN;
+    record->value = (sbuffer_value_t)data->value;
+    record->ts_offset = (int32_t)offset;
+    record->id = data->id;
+}
+
+static void sbuffer_unpack(sbuffer_t *buffer, const sbuffer_record_t *record, sensor_data_t *data) {
+    data->id = record->id;
+    data->value = (sensor_value_t)record->value;
+    data->ts = buffer->epoch + (sensor_ts_t)record->ts_offset;
+}
+
+static int sbuffer_valid_stage(int stage) {
+    return stage >= 0 && stage < SBUFFER_STAGES;
+}
+
+// Position up to which 'stage' is allowed to read, must be called with the shard mutex locked
+static unsigned long sbuffer_stage_limit(sbuffer_shard_t *shard, int stage) {
+    return stage == 0 ? shard->tail : shard->cursors[stage - 1].position;
+}
+
+// Position of the oldest slot still in use, must be called with the shard mutex locked
+static unsigned long sbuffer_head(sbuffer_shard_t *shard) {
+    return shard->cursors[SBUFFER_STAGES - 1].position;
+}
+
+// The part of the capacity that is left for the ring, the rest belongs to the ingest queue
+static int sbuffer_is_full(sbuffer_shard_t *shard) {
+    return shard->tail - sbuffer_head(shard) >= shard->capacity - shard->ingest_size;
+}
+
+static int sbuffer_spill_pending(sbuffer_shard_t *shard) {
+    return shard->spill_head != shard->spill_tail;
+}
+
+static sbuffer_ingest_slot_t *sbuffer_ingest_slot(sbuffer_shard_t *shard, unsigned long position) {
+    return &shard->ingest[position & (shard->ingest_size - 1)];
+}
+
+// Checks if producers claimed ingest slots that weren't collected yet, published or not
+static int sbuffer_ingest_pending(sbuffer_shard_t *shard) {
+    return atomic_load(&shard->ingest_tail) != shard->ingest_head;
+}
+
+// Checks if the oldest claimed ingest slot is published, must be called with the shard mutex locked
+static int sbuffer_ingest_ready(sbuffer_shard_t *shard) {
+    sbuffer_ingest_slot_t *slot = sbuffer_ingest_slot(shard, shard->ingest_head);
+    return atomic_load_explicit(&slot->sequence, memory_order_acquire) == shard->ingest_head + 1;
+}
+
+// Checks if collecting the ingest queue would move anything, a blocking shard can't take data while it is full
+static int sbuffer_ingest_collectable(sbuffer_shard_t *shard) {
+    if (!sbuffer_ingest_ready(shard)) return 0;
+    return shard->policy != SBUFFER_POLICY_BLOCK || !sbuffer_is_full(shard);
+}
+
+static int sbuffer_shard_empty(sbuffer_shard_t *shard) {
+    return sbuffer_head(shard) == shard->tail && !sbuffer_spill_pending(shard) && !sbuffer_ingest_pending(shard);
+}
+
+// A stage is done with a shard once it has passed all data, including data that is still spilled or ingested
+static int sbuffer_shard_stage_done(sbuffer_shard_t *shard, int stage) {
+    return shard->cursors[stage].position == shard->tail && !sbuffer_spill_pending(shard) &&
+           !sbuffer_ingest_pending(shard);
+}
+
+// Checks if 'stage' has something to read in 'shard', must be called with the shard mutex locked
+static int sbuffer_shard_readable(sbuffer_shard_t *shard, int stage) {
+    if (shard->cursors[stage].position != sbuffer_stage_limit(shard, stage)) return 1;
+    return stage == 0 && sbuffer_ingest_collectable(shard);
+}
+
+// Wakes up the consumers of 'stage' if any of them is sleeping
+static void sbuffer_wake(sbuffer_t *buffer, int stage) {
+    sbuffer_waiter_t *waiter = &buffer->waiters[stage];
+    // Orders the data published before this call against the load of 'sleepers', see sbuffer_wait()
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&waiter->sleepers) == 0) return;
 
-    pthread_mutex_destroy(&buffer->mutex);
-    pthread_cond_destroy(&buffer->cond);
-    free(buffer);
+    atomic_fetch_add(&waiter->wakeups, 1);
+    sbuffer_futex_wake(&waiter->wakeups, buffer->shared);
+}
+
+// Tells producers blocked on a full shard that slots were freed, must be called with the shard mutex locked
+static void sbuffer_wake_producers(sbuffer_shard_t *shard) {
+    atomic_fetch_add(&shard->frees, 1);
+    if (shard->blocked > 0) sbuffer_futex_wake(&shard->frees, shard->shared);
+}
+
+// Appends 'record' to the spill file, must be called with the shard mutex locked
+static int sbuffer_spill(sbuffer_shard_t *shard, const sbuffer_record_t *record) {
+    off_t offset = (off_t)(shard->spill_tail * sizeof(sbuffer_record_t));
+    if (pwrite(shard->spill_fd, record, sizeof(sbuffer_record_t), offset) != sizeof(sbuffer_record_t)) {
+        return SBUFFER_FAILURE;
+    }
+    shard->spill_tail++;
+    shard->stats.spilled++;
     return SBUFFER_SUCCESS;
 }
 
-int sbuffer_insert(sbuffer_t *buffer, const sensor_data_t *data) {
-    if (!buffer || !data) return SBUFFER_NO_DATA;
+// Moves spilled data back into free slots, oldest first, must be called with the shard mutex locked
+static int sbuffer_unspill(sbuffer_shard_t *shard) {
+    int refilled = 0;
+    while (sbuffer_spill_pending(shard) && !sbuffer_is_full(shard)) {
+        off_t offset = (off_t)(shard->spill_head * sizeof(sbuffer_record_t));
+        sbuffer_slot_t *slot = sbuffer_slot(shard, shard->tail);
+        if (pread(shard->spill_fd, &slot->record, sizeof(sbuffer_record_t), offset) != sizeof(sbuffer_record_t)) break;
+        shard->spill_head++;
+        shard->tail++;
+        shard->stats.unspilled++;
+        refilled = 1;
+    }
+    if (shard->spill_head == shard->spill_tail && shard->spill_tail > 0) {
+        // Spill file is drained, give the disk space back
+        shard->spill_head = shard->spill_tail = 0;
+        if (ftruncate(shard->spill_fd, 0) != 0) perror("[ERROR] Truncating the sbuffer spill file failed");
+    }
+    return refilled;
+}
 
-    sbuffer_node_t *new_node = (sbuffer_node_t *)malloc(sizeof(sbuffer_node_t));
-    if (!new_node) return SBUFFER_FAILURE;
+// Throws away the oldest data in the ring, every stage that hasn't passed it yet skips it
+static void sbuffer_drop_oldest(sbuffer_shard_t *shard) {
+    unsigned long head = sbuffer_head(shard);
+    for (int stage = 0; stage < SBUFFER_STAGES; stage++) {
+        if (shard->cursors[stage].position == head) shard->cursors[stage].position++;
+    }
+    shard->stats.dropped_oldest++;
+}
+
+/**
+ * Restores the invariants of a shard whose mutex was held by a process that died, must be called with the mutex locked
+ * Every critical section only moves positions forward one step at a time, so the dead process can only have left
+ * the cursors out of order or a collected ingest slot behind the ingest head. The ingest head only follows slots
+ * producers have published, so it can't have passed the ingest tail.
+ */
+static void sbuffer_repair(sbuffer_shard_t *shard) {
+    // head <= storage cursor <= Data Manager cursor <= tail, a cursor ahead of the one before it is pulled back
+    unsigned long limit = shard->tail;
+    for (int stage = 0; stage < SBUFFER_STAGES; stage++) {
+        sbuffer_cursor_t *cursor = &shard->cursors[stage];
+        if ((long)(limit - cursor->position) < 0) cursor->position = limit;
+        limit = cursor->position;
+    }
 
-    new_node->data = *data;
-    new_node->processed = 0;
-    new_node->next = NULL;
+    // The ring never holds more than its part of the capacity, the oldest data is dropped to get back there
+    unsigned long room = shard->capacity - shard->ingest_size;
+    while (shard->tail - sbuffer_head(shard) > room) sbuffer_drop_oldest(shard);
 
-    pthread_mutex_lock(&buffer->mutex);
+    // A slot handed back to the producers while the ingest head didn't move yet was already placed in the ring
+    sbuffer_ingest_slot_t *slot = sbuffer_ingest_slot(shard, shard->ingest_head);
+    if (shard->ingest_head != atomic_load(&shard->ingest_tail) &&
+        atomic_load(&slot->sequence) == shard->ingest_head + shard->ingest_size) {
+        shard->ingest_head++;
+    }
+}
 
-    if (buffer->tail) {
-        buffer->tail->next = new_node;
-    } else {
-        buffer->head = new_node;
+// Locks the mutex of 'shard', if the process holding it died the shard is repaired and the lock taken over
+static void sbuffer_lock(sbuffer_shard_t *shard) {
+    if (pthread_mutex_lock(&shard->mutex) == EOWNERDEAD) {
+        sbuffer_repair(shard);
+        pthread_mutex_consistent(&shard->mutex);
     }
-    buffer->tail = new_node;
+}
 
-    pthread_cond_signal(&buffer->cond);
-    pthread_mutex_unlock(&buffer->mutex);
+/**
+ * Puts 'record' behind the newest data of the shard, applying the overflow policy when the ring is full
+ * Must be called with the shard mutex locked
+ * \return SBUFFER_SUCCESS if the data is in the ring, SBUFFER_NO_DATA if it was dropped or spilled and
+ * SBUFFER_FAILURE if the ring is full and the policy is to block
+ */
+static int sbuffer_place(sbuffer_shard_t *shard, const sbuffer_record_t *record) {
+    // Once data is spilled, newer data has to follow it through the spill file to keep the order
+    if (sbuffer_is_full(shard) || sbuffer_spill_pending(shard)) {
+        if (shard->policy == SBUFFER_POLICY_BLOCK) {
+            return SBUFFER_FAILURE;
+        } else if (shard->policy == SBUFFER_POLICY_DROP_NEWEST) {
+            shard->stats.dropped_newest++;
+            return SBUFFER_NO_DATA;
+        } else if (shard->policy == SBUFFER_POLICY_DROP_OLDEST) {
+            sbuffer_drop_oldest(shard);
+        } else {
+            if (sbuffer_spill(shard, record) != SBUFFER_SUCCESS) {
+                // Nothing else left to do with it when the disk is full as well
+                shard->stats.dropped_newest++;
+            }
+            return SBUFFER_NO_DATA;
+        }
+    }
 
+    sbuffer_slot(shard, shard->tail)->record = *record;
+    shard->tail++;
+    shard->stats.inserted++;
     return SBUFFER_SUCCESS;
 }
 
-int sbuffer_remove(sbuffer_t *buffer, sensor_data_t *data) {
-    if (!buffer || !data) return SBUFFER_NO_DATA;
+/**
+ * Moves the published data of the ingest queue into the ring, oldest first, must be called with the shard mutex locked
+ * Stops at the first slot that is claimed but not published yet, or when a blocking ring is full
+ * \return the number of sensor data that ended up in the ring
+ */
+static int sbuffer_collect(sbuffer_shard_t *shard) {
+    int placed = 0;
+    while (sbuffer_ingest_ready(shard)) {
+        sbuffer_ingest_slot_t *slot = sbuffer_ingest_slot(shard, shard->ingest_head);
+        int result = sbuffer_place(shard, &slot->record);
+        if (result == SBUFFER_FAILURE) break;
+        if (result == SBUFFER_SUCCESS) placed++;
+
+        // Hand the slot back to the producers for the next lap
+        atomic_store_explicit(&slot->sequence, shard->ingest_head + shard->ingest_size, memory_order_release);
+        shard->ingest_head++;
+    }
+    return placed;
+}
 
-    pthread_mutex_lock(&buffer->mutex);
+/**
+ * Publishes 'count' sensor data in the ingest queue of 'shard' without taking any lock
+ * All slots are claimed with a single compare-and-swap, so the data of one batch stays together
+ * \return SBUFFER_SUCCESS on success and SBUFFER_FAILURE if there is no room for all of them
+ */
+static int sbuffer_ingest_push(sbuffer_t *buffer, sbuffer_shard_t *shard, const sensor_data_t *data, int count) {
+    unsigned long position = atomic_load_explicit(&shard->ingest_tail, memory_order_relaxed);
+    while (1) {
+        // Slots are collected in order, so if the last slot of the batch is free all others are as well
+        unsigned long last = position + (unsigned long)count - 1;
+        unsigned long sequence = atomic_load_explicit(&sbuffer_ingest_slot(shard, last)->sequence,
+                                                      memory_order_acquire);
+        long difference = (long)(sequence - last);
+        if (difference < 0) return SBUFFER_FAILURE;
+        if (difference == 0 &&
+            atomic_compare_exchange_weak_explicit(&shard->ingest_tail, &position, position + (unsigned long)count,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+            break;
+        }
+        if (difference > 0) position = atomic_load_explicit(&shard->ingest_tail, memory_order_relaxed);
+    }
 
-    while (!buffer->head && !buffer->terminate) {
-        pthread_cond_wait(&buffer->cond, &buffer->mutex);
+    for (int i = 0; i < count; i++) {
+        sbuffer_ingest_slot_t *slot = sbuffer_ingest_slot(shard, position + (unsigned long)i);
+        sbuffer_pack(buffer, &data[i], &slot->record);
+        atomic_store_explicit(&slot->sequence, position + (unsigned long)i + 1, memory_order_release);
     }
+    return SBUFFER_SUCCESS;
+}
+
+/**
+ * Must be called after 'stage' moved its cursor in 'shard', with the shard mutex locked
+ * For the last stage the freed slots are reused and blocked producers are woken up
+ * \return the stage that has new data to read because of this, -1 if none
+ */
+static int sbuffer_stage_advanced(sbuffer_shard_t *shard, int stage) {
+    if (stage + 1 < SBUFFER_STAGES) return stage + 1;
+
+    sbuffer_wake_producers(shard);
+    // Spilled data is older than anything still waiting in the ingest queue
+    int refilled = sbuffer_unspill(shard);
+    refilled += sbuffer_collect(shard);
+    return refilled ? 0 : -1;
+}
+
+/**
+ * Inserts 'count' sensor data into a single shard
+ * All data goes through the ingest queue, so the order of every producer is kept. Only when the ingest queue is
+ * full the producer takes the shard mutex to collect it into the ring itself, applying the overflow policy.
+ * \return SBUFFER_SUCCESS on success and SBUFFER_FAILURE if the buffer was terminated before all data was inserted
+ */
+static int sbuffer_shard_insert(sbuffer_t *buffer, sbuffer_shard_t *shard, const sensor_data_t *data, int count) {
+    int inserted = 0;
+    int fell_back = 0;
+    int stalled = 0;
+    int result = SBUFFER_SUCCESS;
+    while (inserted < count) {
+        // Data pushed after the consumers saw the terminated buffer empty would never be read
+        if (atomic_load(&buffer->terminate)) {
+            result = SBUFFER_FAILURE;
+            break;
+        }
+        int size = (int)shard->ingest_size;
+        int batch = count - inserted < size ? count - inserted : size;
+        if (sbuffer_ingest_push(buffer, shard, &data[inserted], batch) == SBUFFER_SUCCESS) {
+            inserted += batch;
+            // The Data Manager is only woken up if it is actually sleeping
+            sbuffer_wake(buffer, 0);
+            continue;
+        }
 
-    sbuffer_node_t *current = buffer->head;
-    sbuffer_node_t *prev = NULL;
+        sbuffer_lock(shard);
+        if (!fell_back) shard->stats.ingest_full++;
+        fell_back = 1;
 
-    while (current) {
-        if (current->processed) {
-            *data = current->data;
-            if (prev) {
-                prev->next = current->next;
+        unsigned long head = shard->ingest_head;
+        int placed = sbuffer_collect(shard);
+        int writing = 0;
+        if (shard->ingest_head == head) {
+            if (!sbuffer_ingest_ready(shard)) {
+                // The oldest slot is claimed but another producer is still writing it
+                writing = 1;
+            } else if (shard->terminate) {
+                result = SBUFFER_FAILURE;
             } else {
-                buffer->head = current->next;
-            }
-            if (!current->next) {
-                buffer->tail = prev;
+                // The ring is full and the policy is to block
+                if (!stalled) shard->stats.stalls++;
+                stalled = 1;
+                unsigned int frees = atomic_load(&shard->frees);
+                shard->blocked++;
+                pthread_mutex_unlock(&shard->mutex);
+                sbuffer_futex_wait(&shard->frees, frees, NULL, shard->shared);
+                sbuffer_lock(shard);
+                shard->blocked--;
             }
-            free(current);
-            pthread_mutex_unlock(&buffer->mutex);
-            return SBUFFER_SUCCESS;
         }
-        prev = current;
-        current = current->next;
+
+        pthread_mutex_unlock(&shard->mutex);
+
+        if (placed > 0) sbuffer_wake(buffer, 0);
+        if (result != SBUFFER_SUCCESS) break;
+        if (writing) sched_yield();
     }
+    return result;
+}
 
-    pthread_mutex_unlock(&buffer->mutex);
-    return SBUFFER_FAILURE;
+/**
+ * Copies up to 'max' sensor data of 'stage' from a single shard into 'out', and their handles into 'handles' if not NULL
+ * The cursor of the stage only moves if 'advance' is set, otherwise the data is just peeked at
+ * \return the number of sensor data copied
+ */
+static int sbuffer_shard_read(sbuffer_t *buffer, sbuffer_shard_t *shard, sensor_data_t *out,
+                              sbuffer_handle_t *handles, int max, int stage, int advance) {
+    sbuffer_lock(shard);
+
+    if (stage == 0) sbuffer_collect(shard);
+
+    sbuffer_cursor_t *cursor = &shard->cursors[stage];
+    unsigned long limit = sbuffer_stage_limit(shard, stage);
+    unsigned long position = cursor->position;
+    int count = 0;
+    while (position != limit && count < max) {
+        if (handles) handles[count] = sbuffer_handle(buffer, shard, position);
+        sbuffer_unpack(buffer, &sbuffer_slot(shard, position)->record, &out[count++]);
+        position++;
+    }
+
+    int wake_stage = -1;
+    if (advance && count > 0) {
+        cursor->position = position;
+        wake_stage = sbuffer_stage_advanced(shard, stage);
+    }
+
+    pthread_mutex_unlock(&shard->mutex);
+
+    if (wake_stage >= 0) sbuffer_wake(buffer, wake_stage);
+    return count;
 }
 
+/**
+ * Reads from the shards [first, first + count) of 'stage', starting at a different shard every call
+ * The data a shard returned is consecutive and in the order of its ring
+ * \return the number of sensor data copied to 'out'
+ */
+static int sbuffer_shards_read(sbuffer_t *buffer, sensor_data_t *out, sbuffer_handle_t *handles, int max, int stage,
+                               unsigned int first, unsigned int count, int advance) {
+    unsigned int start = atomic_fetch_add(&buffer->waiters[stage].next_shard, 1);
+    int total = 0;
+    for (unsigned int i = 0; i < count && total < max; i++) {
+        sbuffer_shard_t *shard = sbuffer_shard(buffer, first + (start + i) % count);
+        total += sbuffer_shard_read(buffer, shard, out + total, handles ? handles + total : NULL, max - total,
+                                    stage, advance);
+    }
+    return total;
+}
 
-int sbuffer_is_empty(sbuffer_t *buffer) {
-    if (!buffer) return SBUFFER_FAILURE;
+// Checks if 'stage' is done with all shards [first, first + count), which requires a terminated buffer
+static int sbuffer_shards_done(sbuffer_t *buffer, int stage, unsigned int first, unsigned int count) {
+    if (!atomic_load(&buffer->terminate)) return 0;
 
-    pthread_mutex_lock(&buffer->mutex);
-    int is_empty = (buffer->head == NULL);
-    pthread_mutex_unlock(&buffer->mutex);
+    for (unsigned int i = first; i < first + count; i++) {
+        sbuffer_shard_t *shard = sbuffer_shard(buffer, i);
+        sbuffer_lock(shard);
+        int done = sbuffer_shard_stage_done(shard, stage);
+        pthread_mutex_unlock(&shard->mutex);
+        if (!done) return 0;
+    }
+    return 1;
+}
 
-    return is_empty;
+// Checks if 'stage' has anything to read in the shards [first, first + count)
+static int sbuffer_shards_readable(sbuffer_t *buffer, int stage, unsigned int first, unsigned int count) {
+    for (unsigned int i = first; i < first + count; i++) {
+        sbuffer_shard_t *shard = sbuffer_shard(buffer, i);
+        sbuffer_lock(shard);
+        int readable = sbuffer_shard_readable(shard, stage);
+        pthread_mutex_unlock(&shard->mutex);
+        if (readable) return 1;
+    }
+    return 0;
 }
 
-int sbuffer_read_unprocessed(sbuffer_t *buffer, sensor_data_t *data, int processed_flag) {
-    if (!buffer || !data) return SBUFFER_NO_DATA;
+/**
+ * Sleeps until 'stage' might have data to read in the shards [first, first + count)
+ * The consumer registers as sleeper before checking the shards a last time, so an insert can't slip by unnoticed
+ * \return SBUFFER_SUCCESS when there might be data, SBUFFER_NO_DATA on timeout and SBUFFER_FAILURE if the stage is done
+ */
+static int sbuffer_wait(sbuffer_t *buffer, int stage, unsigned int first, unsigned int count,
+                        const struct timespec *deadline) {
+    sbuffer_waiter_t *waiter = &buffer->waiters[stage];
 
-    pthread_mutex_lock(&buffer->mutex);
+    atomic_fetch_add(&waiter->sleepers, 1);
+    unsigned int wakeups = atomic_load(&waiter->wakeups);
+    // Pairs with the fence in sbuffer_wake(): either the producer sees the sleeper or the check below sees its data
+    atomic_thread_fence(memory_order_seq_cst);
 
-    sbuffer_node_t *current = buffer->head;
-    while (current) {
-        if (current->processed == processed_flag) {
-            *data = current->data;
-            pthread_mutex_unlock(&buffer->mutex);
-            return SBUFFER_SUCCESS;
+    int result = SBUFFER_SUCCESS;
+    if (sbuffer_shards_readable(buffer, stage, first, count)) {
+        result = SBUFFER_SUCCESS;
+    } else if (sbuffer_shards_done(buffer, stage, first, count)) {
+        result = SBUFFER_FAILURE;
+    } else {
+        while (atomic_load(&waiter->wakeups) == wakeups && result == SBUFFER_SUCCESS) {
+            if (sbuffer_futex_wait(&waiter->wakeups, wakeups, deadline, buffer->shared) == ETIMEDOUT) {
+                result = SBUFFER_NO_DATA;
+            }
         }
-        current = current->next;
     }
 
-    if (buffer->terminate && !buffer->head) {
-        pthread_mutex_unlock(&buffer->mutex);
+    atomic_fetch_sub(&waiter->sleepers, 1);
+    return result;
+}
+
+/**
+ * Reads from the shards [first, first + count) of 'stage', waiting until there is data, the stage is done or 'deadline' has passed
+ * \return the number of sensor data copied to 'out', 0 on timeout or if the stage is done (see '*result')
+ */
+static int sbuffer_shards_read_wait(sbuffer_t *buffer, sensor_data_t *out, sbuffer_handle_t *handles, int max, int stage,
+                                    unsigned int first, unsigned int count, int advance,
+                                    const struct timespec *deadline, int *result) {
+    while (1) {
+        int read = sbuffer_shards_read(buffer, out, handles, max, stage, first, count, advance);
+        if (read > 0) {
+            *result = SBUFFER_SUCCESS;
+            return read;
+        }
+        *result = sbuffer_wait(buffer, stage, first, count, deadline);
+        if (*result != SBUFFER_SUCCESS) return 0;
+    }
+}
+
+// Sets 'deadline' to 'timeout_ms' milliseconds from now on the clock of the futex waits
+static void sbuffer_deadline(int timeout_ms, struct timespec *deadline) {
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += timeout_ms / 1000;
+    deadline->tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+/**
+ * Moves the cursor of 'stage' past the data with handle 'handle', which has to be the data under the cursor
+ * \return SBUFFER_SUCCESS on success and SBUFFER_FAILURE if 'handle' is not the next data of the stage
+ */
+static int sbuffer_acknowledge(sbuffer_t *buffer, sbuffer_handle_t handle, int stage) {
+    sbuffer_shard_t *shard = sbuffer_shard(buffer, handle % buffer->shard_count);
+    unsigned long position = handle / buffer->shard_count;
+    sbuffer_lock(shard);
+
+    sbuffer_cursor_t *cursor = &shard->cursors[stage];
+    if (cursor->position != position || position == sbuffer_stage_limit(shard, stage)) {
+        // Already acknowledged, thrown away by SBUFFER_POLICY_DROP_OLDEST or not read yet
+        pthread_mutex_unlock(&shard->mutex);
         return SBUFFER_FAILURE;
     }
+    cursor->position++;
+    int wake_stage = sbuffer_stage_advanced(shard, stage);
 
-    pthread_mutex_unlock(&buffer->mutex);
-    return SBUFFER_FAILURE;
+    pthread_mutex_unlock(&shard->mutex);
+
+    if (wake_stage >= 0) sbuffer_wake(buffer, wake_stage);
+    return SBUFFER_SUCCESS;
+}
+
+/**
+ * Moves the cursor of 'stage' past the data at 'position' of 'shard', and so past all data before it
+ * Data the cursor already passed, because SBUFFER_POLICY_DROP_OLDEST threw it away, is skipped
+ * \return the stage that has new data to read because of this, -1 if none
+ */
+static int sbuffer_acknowledge_up_to(sbuffer_shard_t *shard, unsigned long position, int stage) {
+    sbuffer_lock(shard);
+
+    sbuffer_cursor_t *cursor = &shard->cursors[stage];
+    int wake_stage = -1;
+    // The positions only grow, so the difference tells which one is ahead
+    if ((long) (position - cursor->position) >= 0 && position != sbuffer_stage_limit(shard, stage)) {
+        cursor->position = position + 1;
+        wake_stage = sbuffer_stage_advanced(shard, stage);
+    }
+
+    pthread_mutex_unlock(&shard->mutex);
+    return wake_stage;
+}
+
+/**
+ * Moves the cursor of 'stage' past a batch of handles read for it, one shard at a time
+ * The stages that got new data to read are woken up once for the whole batch
+ */
+static void sbuffer_acknowledge_batch(sbuffer_t *buffer, const sbuffer_handle_t *handles, int count, int stage) {
+    int wake[SBUFFER_STAGES] = {0};
+    for (int i = 0; i < count; i++) {
+        unsigned int shard = handles[i] % buffer->shard_count;
+        // Only the last handle of every run of the same shard moves its cursor
+        if (i + 1 < count && handles[i + 1] % buffer->shard_count == shard) continue;
+        int wake_stage = sbuffer_acknowledge_up_to(sbuffer_shard(buffer, shard), handles[i] / buffer->shard_count,
+                                                   stage);
+        if (wake_stage >= 0) wake[wake_stage] = 1;
+    }
+    for (int i = 0; i < SBUFFER_STAGES; i++) {
+        if (wake[i]) sbuffer_wake(buffer, i);
+    }
+}
+
+
+/**
+ * Computes the layout of a buffer with room for 'capacity' sensor data over 'shards' shards
+ * \return the total size of the buffer in bytes
+ */
+static size_t sbuffer_layout(unsigned int capacity, unsigned int shards, unsigned int *shard_capacity,
+                             size_t *shard_size) {
+    // The capacity is spread over the shards, rounded up without the sum that could wrap
+    *shard_capacity = sbuffer_round_capacity(capacity / shards + (capacity % shards != 0));
+    *shard_size = sbuffer_align(sizeof(sbuffer_shard_t) + *shard_capacity * sizeof(sbuffer_slot_t));
+    return sbuffer_align(sizeof(sbuffer_t)) + shards * *shard_size;
 }
 
+/**
+ * Initializes the zeroed memory of 'buffer', of which the size and layout are already filled in
+ * For a shared buffer all locks work across processes and survive the death of the process holding them
+ * \return SBUFFER_SUCCESS on success and SBUFFER_FAILURE if the spill files couldn't be created
+ */
+static int sbuffer_setup(sbuffer_t *buffer, unsigned int shard_capacity, int policy) {
+    atomic_init(&buffer->terminate, 0);
+    buffer->epoch = time(NULL);
+
+    pthread_mutexattr_t mutex_attr;
+    pthread_mutexattr_init(&mutex_attr);
+    if (buffer->shared) {
+        pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&mutex_attr, PTHREAD_MUTEX_ROBUST);
+    }
 
-int sbuffer_mark_processed(sbuffer_t *buffer, const sensor_data_t *data) {
-    if (!buffer || !data) return SBUFFER_NO_DATA;
+    for (int stage = 0; stage < SBUFFER_STAGES; stage++) {
+        sbuffer_waiter_t *waiter = &buffer->waiters[stage];
+        atomic_init(&waiter->sleepers, 0);
+        atomic_init(&waiter->wakeups, 0);
+        atomic_init(&waiter->next_shard, 0);
+    }
 
-    pthread_mutex_lock(&buffer->mutex);
+    int result = SBUFFER_SUCCESS;
+    unsigned int initialized = 0;
+    while (initialized < buffer->shard_count) {
+        sbuffer_shard_t *shard = sbuffer_shard(buffer, initialized);
+        shard->index = initialized;
+        shard->capacity = shard_capacity;
+        shard->mask = shard_capacity - 1;
+        // At most half of the capacity goes to the ingest queue, a power of two as well
+        shard->ingest_size = shard_capacity / 2 < SBUFFER_INGEST_CAPACITY ? shard_capacity / 2 : SBUFFER_INGEST_CAPACITY;
+        shard->tail = 0;
+        shard->terminate = 0;
+        shard->policy = policy;
+        shard->spill_fd = -1;
+        shard->spill_head = 0;
+        shard->spill_tail = 0;
+        atomic_init(&shard->ingest_tail, 0);
+        shard->ingest_head = 0;
+        for (unsigned long position = 0; position < shard->ingest_size; position++) {
+            atomic_init(&shard->ingest[position].sequence, position);
+        }
+        for (int stage = 0; stage < SBUFFER_STAGES; stage++) {
+            shard->cursors[stage].position = 0;
+        }
+        atomic_init(&shard->frees, 0);
+        shard->blocked = 0;
+        shard->shared = buffer->shared;
+        pthread_mutex_init(&shard->mutex, &mutex_attr);
+        initialized++;
 
-    sbuffer_node_t *current = buffer->head;
-    while (current) {
-        if (current->data.id == data->id && current->data.ts == data->ts) {
-            current->processed = 1;
-            pthread_cond_broadcast(&buffer->cond);
-            pthread_mutex_unlock(&buffer->mutex);
-            return SBUFFER_SUCCESS;
+        if (policy == SBUFFER_POLICY_SPILL) {
+            // The spill file is unlinked right away, it disappears as soon as it is closed
+            char path[] = "/tmp/sbuffer_spill_XXXXXX";
+            shard->spill_fd = mkstemp(path);
+            if (shard->spill_fd < 0) {
+                result = SBUFFER_FAILURE;
+                break;
+            }
+            unlink(path);
         }
-        current = current->next;
     }
+    // Only the shards that were initialized get cleaned up
+    buffer->shard_count = initialized;
 
-    pthread_mutex_unlock(&buffer->mutex);
-    return SBUFFER_FAILURE;
+    pthread_mutexattr_destroy(&mutex_attr);
+    atomic_store(&buffer->ready, 1);
+    return result;
+}
+
+// Destroys all locks and closes the spill files of the buffer, the memory itself is not freed
+static void sbuffer_teardown(sbuffer_t *buffer) {
+    for (unsigned int i = 0; i < buffer->shard_count; i++) {
+        sbuffer_shard_t *shard = sbuffer_shard(buffer, i);
+        if (shard->spill_fd >= 0) close(shard->spill_fd);
+        pthread_mutex_destroy(&shard->mutex);
+    }
+}
+
+
+sbuffer_t *sbuffer_init(unsigned int capacity, int policy, unsigned int shards) {
+    if (policy < SBUFFER_POLICY_BLOCK || policy > SBUFFER_POLICY_SPILL) return NULL;
+    if (capacity > SBUFFER_MAX_CAPACITY || shards > SBUFFER_MAX_SHARDS) return NULL;
+    if (capacity == 0) capacity = SBUFFER_DEFAULT_CAPACITY;
+    if (shards == 0) shards = 1;
+
+    unsigned int shard_capacity;
+    size_t shard_size;
+    size_t size = sbuffer_layout(capacity, shards, &shard_capacity, &shard_size);
+
+    sbuffer_t *buffer = (sbuffer_t *)aligned_alloc(SBUFFER_CACHE_LINE, size);
+    if (!buffer) return NULL;
+    memset(buffer, 0, size);
+
+    buffer->shard_count = shards;
+    buffer->shard_size = shard_size;
+    buffer->size = size;
+    buffer->shared = 0;
+
+    if (sbuffer_setup(buffer, shard_capacity, policy) != SBUFFER_SUCCESS) {
+        sbuffer_free(buffer);
+        return NULL;
+    }
+    return buffer;
+}
+
+/**
+ * Reads the start time of process 'pid' since boot, field 22 of /proc/<pid>/stat
+ * \return the start time in clock ticks, 0 if the process doesn't exist
+ */
+static unsigned long long sbuffer_start_time(pid_t pid) {
+    char path[32];
+    char line[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE *file = fopen(path, "r");
+    if (!file) return 0;
+    char *read = fgets(line, sizeof(line), file);
+    fclose(file);
+    if (!read) return 0;
+
+    // The command name in field 2 can hold spaces and parentheses, the fields after it start at the last ')'
+    char *field = strrchr(line, ')');
+    if (!field) return 0;
+    for (int number = 2; number < 22 && field; number++) field = strchr(field + 1, ' ');
+    return field ? strtoull(field + 1, NULL, 10) : 0;
+}
+
+/**
+ * Checks if the shared memory segment 'name' was left behind by a process that is gone
+ * A segment that is still being set up, or whose creator is alive, is in use. The start time of the creator is
+ * compared as well, since its pid may have been reused by an unrelated process.
+ * \return 1 if the segment can be replaced, 0 if it is in use, errno is then EEXIST
+ */
+static int sbuffer_stale(const char *name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return errno == ENOENT;
+
+    int stale = 0;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(sbuffer_t)) {
+        sbuffer_t *buffer = (sbuffer_t *)mmap(NULL, sizeof(sbuffer_t), PROT_READ, MAP_SHARED, fd, 0);
+        if (buffer != MAP_FAILED) {
+            pid_t owner = buffer->owner;
+            stale = owner > 0 && ((kill(owner, 0) != 0 && errno == ESRCH) ||
+                                  sbuffer_start_time(owner) != buffer->owner_start);
+            munmap(buffer, sizeof(sbuffer_t));
+        }
+    }
+    close(fd);
+    errno = EEXIST;
+    return stale;
+}
+
+sbuffer_t *sbuffer_init_shared(const char *name, unsigned int capacity, int policy, unsigned int shards) {
+    // A spill file descriptor only means something in the process that opened it
+    if (policy < SBUFFER_POLICY_BLOCK || policy >= SBUFFER_POLICY_SPILL) return NULL;
+    if (!name || strlen(name) >= SBUFFER_NAME_SIZE) return NULL;
+    if (capacity > SBUFFER_MAX_CAPACITY || shards > SBUFFER_MAX_SHARDS) return NULL;
+    if (capacity == 0) capacity = SBUFFER_DEFAULT_CAPACITY;
+    if (shards == 0) shards = 1;
+
+    unsigned int shard_capacity;
+    size_t shard_size;
+    size_t size = sbuffer_layout(capacity, shards, &shard_capacity, &shard_size);
+
+    // A segment left behind by a crashed gateway is replaced, the one of a running gateway is left alone
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST && sbuffer_stale(name)) {
+        shm_unlink(name);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    if (fd < 0) return NULL;
+    if (ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    // The new segment is already zeroed, mmap always returns page aligned memory
+    sbuffer_t *buffer = (sbuffer_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (buffer == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    buffer->shard_count = shards;
+    buffer->shard_size = shard_size;
+    buffer->size = size;
+    buffer->shared = 1;
+    // The start time goes first, a segment without an owner counts as being set up
+    buffer->owner_start = sbuffer_start_time(getpid());
+    buffer->owner = getpid();
+    strcpy(buffer->name, name);
+
+    if (sbuffer_setup(buffer, shard_capacity, policy) != SBUFFER_SUCCESS) {
+        // Unmaps and removes the segment, as this process owns it
+        sbuffer_free(buffer);
+        return NULL;
+    }
+    return buffer;
+}
+
+sbuffer_t *sbuffer_attach(const char *name) {
+    if (!name) return NULL;
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) return NULL;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(sbuffer_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    sbuffer_t *buffer = (sbuffer_t *)mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (buffer == MAP_FAILED) return NULL;
+
+    // The creator might still be setting up the buffer
+    if (!atomic_load(&buffer->ready) || buffer->size != (size_t)info.st_size) {
+        munmap(buffer, (size_t)info.st_size);
+        return NULL;
+    }
+    return buffer;
+}
+
+int sbuffer_free(sbuffer_t *buffer) {
+    if (!buffer) return SBUFFER_FAILURE;
+
+    if (!buffer->shared) {
+        sbuffer_teardown(buffer);
+        free(buffer);
+        return SBUFFER_SUCCESS;
+    }
+
+    // Other processes only unmap their view, the creator removes the segment as well
+    if (buffer->owner == getpid()) {
+        sbuffer_teardown(buffer);
+        shm_unlink(buffer->name);
+    }
+    return munmap(buffer, buffer->size) == 0 ? SBUFFER_SUCCESS : SBUFFER_FAILURE;
+}
+
+unsigned int sbuffer_shard_count(sbuffer_t *buffer) {
+    return buffer ? buffer->shard_count : 0;
+}
+
+unsigned int sbuffer_shard_of(sbuffer_t *buffer, sensor_id_t id) {
+    return id % buffer->shard_count;
+}
+
+int sbuffer_insert(sbuffer_t *buffer, const sensor_data_t *data) {
+    return sbuffer_insert_batch(buffer, data, 1);
+}
+
+int sbuffer_insert_batch(sbuffer_t *buffer, const sensor_data_t *data, int count) {
+    if (!buffer || !data || count <= 0) return SBUFFER_NO_DATA;
+
+    int result = SBUFFER_SUCCESS;
+    int start = 0;
+    while (start < count) {
+        // Insert every run of data that belongs to the same shard in one go
+        unsigned int shard = sbuffer_shard_of(buffer, data[start].id);
+        int end = start + 1;
+        while (end < count && sbuffer_shard_of(buffer, data[end].id) == shard) end++;
+
+        if (sbuffer_shard_insert(buffer, sbuffer_shard(buffer, shard), &data[start], end - start) != SBUFFER_SUCCESS) {
+            result = SBUFFER_FAILURE;
+        }
+        start = end;
+    }
+    return result;
+}
+
+int sbuffer_remove(sbuffer_t *buffer, sbuffer_handle_t handle) {
+    if (!buffer) return SBUFFER_FAILURE;
+
+    // Only data the Data Manager has passed can be removed, this frees its slot
+    return sbuffer_acknowledge(buffer, handle, SBUFFER_STAGE_STORAGE);
+}
+
+
+int sbuffer_is_empty(sbuffer_t *buffer) {
+    if (!buffer) return SBUFFER_FAILURE;
+
+    for (unsigned int i = 0; i < buffer->shard_count; i++) {
+        sbuffer_shard_t *shard = sbuffer_shard(buffer, i);
+        sbuffer_lock(shard);
+        int is_empty = sbuffer_shard_empty(shard);
+        pthread_mutex_unlock(&shard->mutex);
+        if (!is_empty) return 0;
+    }
+    return 1;
+}
+
+int sbuffer_read_unprocessed(sbuffer_t *buffer, sensor_data_t *data, sbuffer_handle_t *handle, int stage) {
+    if (!buffer || !data || !sbuffer_valid_stage(stage)) return SBUFFER_NO_DATA;
+
+    int read = sbuffer_shards_read(buffer, data, handle, 1, stage, 0, buffer->shard_count, 0);
+    return read > 0 ? SBUFFER_SUCCESS : SBUFFER_FAILURE;
+}
+
+
+int sbuffer_mark_processed(sbuffer_t *buffer, sbuffer_handle_t handle) {
+    if (!buffer) return SBUFFER_FAILURE;
+    return sbuffer_acknowledge(buffer, handle, SBUFFER_STAGE_DATAMGR);
+}
+
+int sbuffer_read_wait(sbuffer_t *buffer, sensor_data_t *data, sbuffer_handle_t *handle, int stage, int timeout_ms) {
+    if (!buffer || !data || !sbuffer_valid_stage(stage)) return SBUFFER_FAILURE;
+
+    struct timespec deadline;
+    if (timeout_ms >= 0) sbuffer_deadline(timeout_ms, &deadline);
+
+    int result;
+    sbuffer_shards_read_wait(buffer, data, handle, 1, stage, 0, buffer->shard_count, 0,
+                             timeout_ms >= 0 ? &deadline : NULL, &result);
+    return result;
+}
+
+int sbuffer_read_batch(sbuffer_t *buffer, sensor_data_t *out, sbuffer_handle_t *handles, int max, int stage,
+                       int timeout_ms) {
+    if (!buffer || !out || !handles || max <= 0 || !sbuffer_valid_stage(stage)) return SBUFFER_FAILURE;
+
+    struct timespec deadline;
+    if (timeout_ms >= 0) sbuffer_deadline(timeout_ms, &deadline);
+
+    int result;
+    int read = sbuffer_shards_read_wait(buffer, out, handles, max, stage, 0, buffer->shard_count, 0,
+                                        timeout_ms >= 0 ? &deadline : NULL, &result);
+    return result == SBUFFER_FAILURE ? SBUFFER_FAILURE : read;
+}
+
+int sbuffer_read_shards(sbuffer_t *buffer, sensor_data_t *out, sbuffer_handle_t *handles, int max, int stage,
+                        unsigned int first, unsigned int count, int timeout_ms) {
+    if (!buffer || !out || !handles || max <= 0 || !sbuffer_valid_stage(stage)) return SBUFFER_FAILURE;
+    if (count == 0 || first + count > buffer->shard_count) return SBUFFER_FAILURE;
+
+    struct timespec deadline;
+    if (timeout_ms >= 0) sbuffer_deadline(timeout_ms, &deadline);
+
+    int result;
+    int read = sbuffer_shards_read_wait(buffer, out, handles, max, stage, first, count, 0,
+                                        timeout_ms >= 0 ? &deadline : NULL, &result);
+    return result == SBUFFER_FAILURE ? SBUFFER_FAILURE : read;
+}
+
+int sbuffer_mark_processed_batch(sbuffer_t *buffer, const sbuffer_handle_t *handles, int count) {
+    if (!buffer || !handles || count < 0) return SBUFFER_FAILURE;
+    sbuffer_acknowledge_batch(buffer, handles, count, SBUFFER_STAGE_DATAMGR);
+    return SBUFFER_SUCCESS;
+}
+
+int sbuffer_remove_batch(sbuffer_t *buffer, const sbuffer_handle_t *handles, int count) {
+    if (!buffer || !handles || count < 0) return SBUFFER_FAILURE;
+    // Frees the slots, blocked producers are woken up per shard
+    sbuffer_acknowledge_batch(buffer, handles, count, SBUFFER_STAGE_STORAGE);
+    return SBUFFER_SUCCESS;
+}
+
+int sbuffer_drain_batch(sbuffer_t *buffer, sensor_data_t *out, int max, int stage) {
+    if (!buffer) return 0;
+    return sbuffer_drain_shards(buffer, out, max, stage, 0, buffer->shard_count);
+}
+
+int sbuffer_drain_shards(sbuffer_t *buffer, sensor_data_t *out, int max, int stage,
+                         unsigned int first, unsigned int count) {
+    if (!buffer || !out || max <= 0 || !sbuffer_valid_stage(stage)) return 0;
+    if (count == 0 || first + count > buffer->shard_count) return 0;
+
+    int result;
+    return sbuffer_shards_read_wait(buffer, out, NULL, max, stage, first, count, 1, NULL, &result);
 }
 
 void sbuffer_terminate(sbuffer_t *buffer) {
-    pthread_mutex_lock(&buffer->mutex);
-    buffer->terminate = 1;
-    pthread_cond_broadcast(&buffer->cond);
-    pthread_mutex_unlock(&buffer->mutex);
+    atomic_store(&buffer->terminate, 1);
+
+    for (unsigned int i = 0; i < buffer->shard_count; i++) {
+        sbuffer_shard_t *shard = sbuffer_shard(buffer, i);
+        sbuffer_lock(shard);
+        shard->terminate = 1;
+        sbuffer_wake_producers(shard);
+        pthread_mutex_unlock(&shard->mutex);
+    }
+
+    for (int stage = 0; stage < SBUFFER_STAGES; stage++) {
+        sbuffer_waiter_t *waiter = &buffer->waiters[stage];
+        atomic_fetch_add(&waiter->wakeups, 1);
+        sbuffer_futex_wake(&waiter->wakeups, buffer->shared);
+    }
 }
 
 int sbuffer_is_terminated(sbuffer_t *buffer) {
-    pthread_mutex_lock(&buffer->mutex);
-    int result = (buffer->terminate && !buffer->head);
-    pthread_mutex_unlock(&buffer->mutex);
-    return result;
+    return atomic_load(&buffer->terminate) && sbuffer_is_empty(buffer);
+}
+
+int sbuffer_get_stats(sbuffer_t *buffer, sbuffer_stats_t *stats) {
+    if (!buffer || !stats) return SBUFFER_FAILURE;
+
+    memset(stats, 0, sizeof(*stats));
+    for (unsigned int i = 0; i < buffer->shard_count; i++) {
+        sbuffer_shard_t *shard = sbuffer_shard(buffer, i);
+        sbuffer_lock(shard);
+        stats->inserted += shard->stats.inserted;
+        stats->stalls += shard->stats.stalls;
+        stats->dropped_oldest += shard->stats.dropped_oldest;
+        stats->dropped_newest += shard->stats.dropped_newest;
+        stats->spilled += shard->stats.spilled;
+        stats->unspilled += shard->stats.unspilled;
+        stats->ingest_full += shard->stats.ingest_full;
+        pthread_mutex_unlock(&shard->mutex);
+    }
+    return SBUFFER_SUCCESS;
+}
+
+const char *sbuffer_policy_name(int policy) {
+    switch (policy) {
+        case SBUFFER_POLICY_BLOCK:       return "block";
+        case SBUFFER_POLICY_DROP_OLDEST: return "drop-oldest";
+        case SBUFFER_POLICY_DROP_NEWEST: return "drop-newest";
+        case SBUFFER_POLICY_SPILL:       return "spill";
+        default:                         return NULL;
+    }
+}
+
+int sbuffer_policy_from_name(const char *name) {
+    for (int policy = SBUFFER_POLICY_BLOCK; policy <= SBUFFER_POLICY_SPILL; policy++) {
+        if (name && strcmp(name, sbuffer_policy_name(policy)) == 0) return policy;
+    }
+    return SBUFFER_FAILURE;
 }
@@ -8,24 +8,119 @@
 #define SBUFFER_SUCCESS 0
 #define SBUFFER_NO_DATA 1
 
+#define SBUFFER_DEFAULT_CAPACITY 1024
+#define SBUFFER_BATCH_SIZE 64       // number of sensor data the stages move per lock
+#define SBUFFER_MAX_CAPACITY (1U << 24)  // largest capacity, 256 MiB of slots
+#define SBUFFER_DEFAULT_SHARDS 1
+#define SBUFFER_MAX_SHARDS 256
+#define SBUFFER_INGEST_CAPACITY 256 // most lock-free ingest slots in front of a shard, a power of two, part of its capacity
+#define SBUFFER_NAME_SIZE 64        // maximum length of the name of a shared buffer, including the terminator
+
+// Data is kept packed in the buffer, 16 bytes per sensor data. Compile with -DSBUFFER_FLOAT_VALUES to store the
+// values as float instead, 12 bytes per sensor data at the cost of precision.
+
+// What to do with new data when the buffer is full
+#define SBUFFER_POLICY_BLOCK 0          // block the producer until a slot is freed
+#define SBUFFER_POLICY_DROP_OLDEST 1    // throw away the oldest data, even if it wasn't processed yet
+#define SBUFFER_POLICY_DROP_NEWEST 2    // throw away the new data
+#define SBUFFER_POLICY_SPILL 3          // append the new data to a temporary file, it is moved back as slots free up
+
+// Consumer stages, every stage only sees data the previous stage has already passed
+#define SBUFFER_STAGE_DATAMGR 0
+#define SBUFFER_STAGE_STORAGE 1
+#define SBUFFER_STAGES 2
+
 typedef struct sbuffer sbuffer_t;
 
 /**
- * Allocates and initializes a new shared buffer
- * \param buffer a double pointer to the buffer that needs to be initialized
- * \return SBUFFER_SUCCESS on success and SBUFFER_FAILURE if an error occurred
+ * Identifies a single sensor data in the buffer, assigned when the data enters the ring of its shard
+ * Handles of the same shard increase monotonically, so two readings of one sensor never share a handle
+ */
+typedef unsigned long sbuffer_handle_t;
+
+/**
+ * Counters of the buffer, every overflow policy has its own counters
+ *
+ * @param inserted Data inserted into the ring
+ * @param stalls Number of times a producer blocked on a full buffer (SBUFFER_POLICY_BLOCK)
+ * @param dropped_oldest Unconsumed data thrown away to make room (SBUFFER_POLICY_DROP_OLDEST)
+ * @param dropped_newest New data thrown away (SBUFFER_POLICY_DROP_NEWEST, or SBUFFER_POLICY_SPILL when the spill file can't be written)
+ * @param spilled Data written to the spill file (SBUFFER_POLICY_SPILL)
+ * @param unspilled Data moved back from the spill file into the ring (SBUFFER_POLICY_SPILL)
+ * @param ingest_full Number of times a producer found the lock-free ingest queue full and had to take the shard lock
+ */
+typedef struct {
+    unsigned long inserted;
+    unsigned long stalls;
+    unsigned long dropped_oldest;
+    unsigned long dropped_newest;
+    unsigned long spilled;
+    unsigned long unspilled;
+    unsigned long ingest_full;
+} sbuffer_stats_t;
+
+/**
+ * Allocates and initializes a new shared buffer with room for 'capacity' sensor data
+ * The buffer is split in 'shards' independent queues with their own lock, the data of a sensor always goes
+ * to the same shard so the order per sensor is kept. The capacity is spread over the shards.
+ * All slots are allocated up front, the capacity of a shard is rounded up to the next power of two, at least 4.
+ * Up to half of it, at most SBUFFER_INGEST_CAPACITY, takes the data producers publish without a lock.
+ * \param capacity the number of slots in the buffer, 0 selects SBUFFER_DEFAULT_CAPACITY, at most SBUFFER_MAX_CAPACITY
+ * \param policy one of the SBUFFER_POLICY_* values, decides what happens with new data when a shard is full
+ * \param shards the number of shards, 0 selects a single shard, at most SBUFFER_MAX_SHARDS
+ * \return a pointer to the new buffer, NULL if an error occurred
+ */
+sbuffer_t *sbuffer_init(unsigned int capacity, int policy, unsigned int shards);
+
+/**
+ * Creates a new shared buffer in the POSIX shared memory segment 'name', with process-shared synchronization
+ * Other processes get access with sbuffer_attach, or by inheriting the mapping with fork(). Locks held by a
+ * process that dies are taken over by the next process that needs them, so a crashing consumer doesn't block the others.
+ * SBUFFER_POLICY_SPILL is not supported, since the spill files only exist in the creating process.
+ * A segment with the same name left behind by an earlier run is replaced, but only once the process that created it is
+ * gone: while it runs, creating the buffer fails with errno set to EEXIST.
+ * \param name the name of the segment, e.g. "/sensor_gateway", at most SBUFFER_NAME_SIZE - 1 characters
+ * \param capacity the number of slots in the buffer, 0 selects SBUFFER_DEFAULT_CAPACITY, at most SBUFFER_MAX_CAPACITY
+ * \param policy one of the SBUFFER_POLICY_* values except SBUFFER_POLICY_SPILL
+ * \param shards the number of shards, 0 selects a single shard, at most SBUFFER_MAX_SHARDS
+ * \return a pointer to the new buffer, NULL if an error occurred
  */
-sbuffer_t *sbuffer_init();
+sbuffer_t *sbuffer_init_shared(const char *name, unsigned int capacity, int policy, unsigned int shards);
+
+/**
+ * Maps the shared buffer created by sbuffer_init_shared in another process
+ * \param name the name of the segment
+ * \return a pointer to the buffer, NULL if it doesn't exist or isn't initialized yet
+ */
+sbuffer_t *sbuffer_attach(const char *name);
 
 /**
  * All allocated resources are freed and cleaned up
+ * For a shared buffer this only unmaps it, unless the caller is the process that created it. The creator also
+ * removes the segment, so it has to be the last one to free the buffer.
  * \param buffer a double pointer to the buffer that needs to be freed
  * \return SBUFFER_SUCCESS on success and SBUFFER_FAILURE if an error occurred
  */
 int sbuffer_free(sbuffer_t *buffer);
 
+/**
+ * Returns the number of shards of the buffer
+ * \param buffer a pointer to the buffer that is used
+ * \return the number of shards
+ */
+unsigned int sbuffer_shard_count(sbuffer_t *buffer);
+
+/**
+ * Returns the shard that holds the data of sensor 'id'
+ * \param buffer a pointer to the buffer that is used
+ * \param id the sensor ID
+ * \return the index of the shard
+ */
+unsigned int sbuffer_shard_of(sbuffer_t *buffer, sensor_id_t id);
+
 /**
  * Inserts the sensor data in 'data' at the end of 'buffer' (at the 'tail')
+ * If 'buffer' is full, the overflow policy of the buffer decides what happens (SBUFFER_POLICY_BLOCK blocks until a slot is removed)
  * \param buffer a pointer to the buffer that is used
  * \param data a pointer to sensor_data_t data, that will be copied into the buffer
  * \return SBUFFER_SUCCESS on success and SBUFFER_FAILURE if an error occured
@@ -33,30 +128,143 @@ int sbuffer_free(sbuffer_t *buffer);
 int sbuffer_insert(sbuffer_t *buffer, const sensor_data_t *data);
 
 /**
- * Removes the first sensor data in 'buffer' (at the 'head') and returns this sensor data as '*data'
- * If 'buffer' is empty, the function doesn't block until new sensor data becomes available but returns SBUFFER_NO_DATA
+ * Inserts 'count' sensor data from the array 'data' at the end of 'buffer', in order
+ * Every run of data for the same shard is claimed in the lock-free ingest queue of that shard with a single
+ * compare-and-swap, producers only fall back to the shard lock when the ingest queue is full.
+ * The Data Manager is only woken up if it is actually sleeping.
+ * If 'buffer' is full, the overflow policy of the buffer decides what happens
  * \param buffer a pointer to the buffer that is used
- * \param data a pointer to pre-allocated sensor_data_t space, the data will be copied into this structure. No new memory is allocated for 'data' in this function.
- * \return SBUFFER_SUCCESS on success and SBUFFER_FAILURE if an error occurred
+ * \param data an array of 'count' sensor data, that will be copied into the buffer
+ * \param count the number of sensor data in 'data'
+ * \return SBUFFER_SUCCESS on success and SBUFFER_FAILURE if the buffer was terminated before all data was inserted
+ */
+int sbuffer_insert_batch(sbuffer_t *buffer, const sensor_data_t *data, int count);
+
+/**
+ * Removes the sensor data with handle 'handle' from the buffer, its slot is freed for new data (used by Storage Manager)
+ * The handle must be the one under the storage cursor, as returned by sbuffer_read_unprocessed or sbuffer_read_wait
+ * for SBUFFER_STAGE_STORAGE. This takes constant time.
+ * \param buffer a pointer to the buffer that is used
+ * \param handle the handle of the sensor data to remove
+ * \return SBUFFER_SUCCESS on success and SBUFFER_FAILURE if 'handle' is not the next data of the storage stage
  */
-int sbuffer_remove(sbuffer_t *buffer, sensor_data_t *data);
+int sbuffer_remove(sbuffer_t *buffer, sbuffer_handle_t handle);
 
 /**
- * Reads the next unprocessed node (used by Data Manager)
+ * Removes a batch of sensor data read by sbuffer_read_batch or sbuffer_read_shards for SBUFFER_STAGE_STORAGE
+ * (used by Storage Manager)
+ * The storage cursor of every shard in the batch moves past its last data and the freed slots take new data.
+ * Until then the data stays in the buffer, so a Storage Manager that dies before it has stored a batch reads it again.
+ * \param buffer a pointer to the buffer that is used
+ * \param handles the handles as returned by sbuffer_read_batch or sbuffer_read_shards
+ * \param count the number of handles
+ * \return SBUFFER_SUCCESS on success and SBUFFER_FAILURE if the arguments are invalid
+ */
+int sbuffer_remove_batch(sbuffer_t *buffer, const sbuffer_handle_t *handles, int count);
+
+/**
+ * Reads the data under the cursor of 'stage' without moving the cursor
+ * The Data Manager stage sees every inserted data, the Storage Manager stage only data marked as processed
  * \param buffer a pointer to the buffer that is used
  * \param data a pointer to sensor_data_t data, that will be copied into the buffer
- * \param processed_flag 0 for unprocessed, 1 for processed data
- * \return SBUFFER_SUCCESS on success and SBUFFER_FAILURE if an error occurred
+ * \param handle a pointer where the handle of the data is stored, can be NULL
+ * \param stage SBUFFER_STAGE_DATAMGR or SBUFFER_STAGE_STORAGE
+ * \return SBUFFER_SUCCESS on success and SBUFFER_FAILURE if the stage has nothing to read
  */
-int sbuffer_read_unprocessed(sbuffer_t *buffer, sensor_data_t *data, int processed_flag);
+int sbuffer_read_unprocessed(sbuffer_t *buffer, sensor_data_t *data, sbuffer_handle_t *handle, int stage);
 
 /**
- * Marks the data as processed (used by Data Manager)
+ * Reads the data under the cursor of 'stage' without moving the cursor, waiting for data if there is none yet
+ * The caller is woken up as soon as data is inserted (or marked as processed for the storage stage)
  * \param buffer a pointer to the buffer that is used
- * \param data a pointer to sensor_data_t data, that will be marked as processed
- * \return SBUFFER_SUCCESS on success and SBUFFER_FAILURE if an error occurred
+ * \param data a pointer to sensor_data_t data, that will be copied into the buffer
+ * \param handle a pointer where the handle of the data is stored, can be NULL
+ * \param stage SBUFFER_STAGE_DATAMGR or SBUFFER_STAGE_STORAGE
+ * \param timeout_ms the maximum time to wait in milliseconds, a negative value waits forever
+ * \return SBUFFER_SUCCESS on success, SBUFFER_NO_DATA on timeout and SBUFFER_FAILURE once the buffer is
+ * terminated and 'stage' has handled all data
+ */
+int sbuffer_read_wait(sbuffer_t *buffer, sensor_data_t *data, sbuffer_handle_t *handle, int stage, int timeout_ms);
+
+/**
+ * Copies up to 'max' sensor data from the cursors of 'stage' into 'out' without moving the cursors, waiting for data
+ * if there is none yet
+ * The data stays with 'stage' until it is marked as processed, so the next stage never sees data that wasn't handled.
+ * \param buffer a pointer to the buffer that is used
+ * \param out a pre-allocated array with room for 'max' sensor data
+ * \param handles a pre-allocated array with room for 'max' handles, the handles of the data are stored here
+ * \param max the maximum number of sensor data to read
+ * \param stage SBUFFER_STAGE_DATAMGR or SBUFFER_STAGE_STORAGE
+ * \param timeout_ms the maximum time to wait in milliseconds, a negative value waits forever
+ * \return the number of sensor data copied to 'out', 0 on timeout and SBUFFER_FAILURE once the buffer is terminated
+ * and 'stage' has handled all data
+ */
+int sbuffer_read_batch(sbuffer_t *buffer, sensor_data_t *out, sbuffer_handle_t *handles, int max, int stage,
+                       int timeout_ms);
+
+/**
+ * Same as sbuffer_read_batch, but only reads from the shards [first, first + count)
+ * This allows several consumers of one stage to each own a part of the shards
+ * \param buffer a pointer to the buffer that is used
+ * \param out a pre-allocated array with room for 'max' sensor data
+ * \param handles a pre-allocated array with room for 'max' handles, the handles of the data are stored here
+ * \param max the maximum number of sensor data to read
+ * \param stage SBUFFER_STAGE_DATAMGR or SBUFFER_STAGE_STORAGE
+ * \param first the first shard to service
+ * \param count the number of shards to service
+ * \param timeout_ms the maximum time to wait in milliseconds, a negative value waits forever
+ * \return the number of sensor data copied to 'out', 0 on timeout and SBUFFER_FAILURE once the buffer is terminated
+ * and 'stage' has handled all data in these shards
+ */
+int sbuffer_read_shards(sbuffer_t *buffer, sensor_data_t *out, sbuffer_handle_t *handles, int max, int stage,
+                        unsigned int first, unsigned int count, int timeout_ms);
+
+/**
+ * Copies up to 'max' sensor data from the cursor of 'stage' into 'out' and moves the cursor past them
+ * The drained data is passed on to the next stage right away, data drained by the storage stage is removed
+ * If 'stage' has nothing to read, the function blocks until it has or until the buffer is terminated
+ * \param buffer a pointer to the buffer that is used
+ * \param out a pre-allocated array with room for 'max' sensor data
+ * \param max the maximum number of sensor data to drain
+ * \param stage SBUFFER_STAGE_DATAMGR or SBUFFER_STAGE_STORAGE
+ * \return the number of sensor data copied to 'out', 0 once the buffer is terminated and 'stage' has handled all data
+ */
+int sbuffer_drain_batch(sbuffer_t *buffer, sensor_data_t *out, int max, int stage);
+
+/**
+ * Same as sbuffer_drain_batch, but only services the shards [first, first + count)
+ * This allows several consumers of one stage to each own a part of the shards
+ * \param buffer a pointer to the buffer that is used
+ * \param out a pre-allocated array with room for 'max' sensor data
+ * \param max the maximum number of sensor data to drain
+ * \param stage SBUFFER_STAGE_DATAMGR or SBUFFER_STAGE_STORAGE
+ * \param first the first shard to service
+ * \param count the number of shards to service
+ * \return the number of sensor data copied to 'out', 0 once the buffer is terminated and 'stage' has handled all data in these shards
+ */
+int sbuffer_drain_shards(sbuffer_t *buffer, sensor_data_t *out, int max, int stage,
+                         unsigned int first, unsigned int count);
+
+/**
+ * Marks the sensor data with handle 'handle' as processed and moves the Data Manager cursor past it (used by Data Manager)
+ * This makes the data available to the Storage Manager. The handle must be the one under the Data Manager cursor,
+ * as returned by sbuffer_read_unprocessed or sbuffer_read_wait for SBUFFER_STAGE_DATAMGR. This takes constant time.
+ * \param buffer a pointer to the buffer that is used
+ * \param handle the handle of the sensor data to mark
+ * \return SBUFFER_SUCCESS on success and SBUFFER_FAILURE if 'handle' is not the next data of the Data Manager stage
  */
-int sbuffer_mark_processed(sbuffer_t *buffer, const sensor_data_t *data);
+int sbuffer_mark_processed(sbuffer_t *buffer, sbuffer_handle_t handle);
+
+/**
+ * Marks a batch of sensor data read by sbuffer_read_batch or sbuffer_read_shards for SBUFFER_STAGE_DATAMGR as processed
+ * (used by Data Manager)
+ * The Data Manager cursor of every shard in the batch moves past its last data, and the Storage Manager is woken up once.
+ * \param buffer a pointer to the buffer that is used
+ * \param handles the handles as returned by sbuffer_read_batch or sbuffer_read_shards
+ * \param count the number of handles
+ * \return SBUFFER_SUCCESS on success and SBUFFER_FAILURE if the arguments are invalid
+ */
+int sbuffer_mark_processed_batch(sbuffer_t *buffer, const sbuffer_handle_t *handles, int count);
 
 /**
  * Checks if the buffer is empty
@@ -79,5 +287,27 @@ void sbuffer_terminate(sbuffer_t *buffer);
  */
 int sbuffer_is_terminated(sbuffer_t *buffer);
 
+/**
+ * Copies the counters of the buffer into '*stats'
+ * \param buffer a pointer to the buffer that is used
+ * \param stats a pointer to pre-allocated sbuffer_stats_t space
+ * \return SBUFFER_SUCCESS on success and SBUFFER_FAILURE if an error occurred
+ */
+int sbuffer_get_stats(sbuffer_t *buffer, sbuffer_stats_t *stats);
+
+/**
+ * Returns the name of an overflow policy as used on the command line ("block", "drop-oldest", "drop-newest", "spill")
+ * \param policy one of the SBUFFER_POLICY_* values
+ * \return the name of the policy, NULL if 'policy' is invalid
+ */
+const char *sbuffer_policy_name(int policy);
+
+/**
+ * Looks up an overflow policy by its name
+ * \param name the name of the policy, as returned by sbuffer_policy_name
+ * \return the SBUFFER_POLICY_* value, SBUFFER_FAILURE if 'name' is unknown
+ */
+int sbuffer_policy_from_name(const char *name);
+
 
 #endif // SBUFFER_H
@@ -0,0 +1,209 @@
+/**
+ * Stress test of the shared buffer, run by test_sbuffer.sh
+ *
+ * Many producer threads insert sequence-numbered readings, alone and in batches, so several producers always share the
+ * lock-free ingest queue of a shard. Data Manager threads own disjoint shard ranges and mark their batches as processed
+ * once they have seen them, a Storage Manager thread reads everything after them and removes each batch it has seen.
+ * Every (producer, sequence) pair has to reach both stages exactly once, and in the order the producer inserted it.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "config.h"
+#include "sbuffer.h"
+
+#define MAX_BATCH 8     // largest batch a producer inserts at once
+
+/**
+ * Arguments of a producer thread
+ *
+ * @param buffer Buffer to insert into
+ * @param producer Producer number, also the sensor ID of its readings
+ * @param readings Number of readings to insert
+ * @param base Timestamp of sequence number 0, the sequence number of a reading is its timestamp minus this
+ */
+typedef struct {
+    sbuffer_t *buffer;
+    int producer;
+    int readings;
+    time_t base;
+} producer_args_t;
+
+/**
+ * Arguments of a consumer thread
+ *
+ * @param buffer Buffer to read from
+ * @param stage SBUFFER_STAGE_DATAMGR or SBUFFER_STAGE_STORAGE
+ * @param first_shard First shard of a Data Manager thread
+ * @param shard_count Number of shards of a Data Manager thread
+ */
+typedef struct {
+    sbuffer_t *buffer;
+    int stage;
+    unsigned int first_shard;
+    unsigned int shard_count;
+} consumer_args_t;
+
+static int producers;
+static int readings;
+static time_t base;
+static unsigned char *seen[SBUFFER_STAGES];     // times every (producer, sequence) reached a stage
+static long *last[SBUFFER_STAGES];              // last sequence number of every producer a stage saw
+static long out_of_order[SBUFFER_STAGES];
+
+void *producer_logic(void *arg) {
+    producer_args_t *args = (producer_args_t *)arg;
+    sensor_data_t batch[MAX_BATCH];
+    unsigned int seed = (unsigned int)args->producer;
+
+    int sequence = 0;
+    while (sequence < args->readings) {
+        // Alternate single inserts with batches of random size
+        int count = 1 + rand_r(&seed) % MAX_BATCH;
+        if (count > args->readings - sequence) count = args->readings - sequence;
+        for (int i = 0; i < count; i++) {
+            batch[i].id = (sensor_id_t)args->producer;
+            batch[i].value = args->producer;
+            batch[i].ts = args->base + sequence + i;
+        }
+        int result = count == 1 ? sbuffer_insert(args->buffer, batch) : sbuffer_insert_batch(args->buffer, batch, count);
+        if (result != SBUFFER_SUCCESS) {
+            fprintf(stderr, "producer %d: insert failed at sequence %d\n", args->producer, sequence);
+            return NULL;
+        }
+        sequence += count;
+    }
+    return NULL;
+}
+
+// Counts 'data' as seen by 'stage', only one thread of a stage ever sees the readings of a producer
+static void check(int stage, const sensor_data_t *data) {
+    long sequence = (long)(data->ts - base);
+    if (data->id >= producers || sequence < 0 || sequence >= readings) {
+        fprintf(stderr, "stage %d: reading of sensor %u with sequence %ld was never inserted\n",
+                stage, data->id, sequence);
+        __atomic_fetch_add(&out_of_order[stage], 1, __ATOMIC_RELAXED);
+        return;
+    }
+    __atomic_fetch_add(&seen[stage][(long)data->id * readings + sequence], 1, __ATOMIC_RELAXED);
+    if (sequence <= last[stage][data->id]) __atomic_fetch_add(&out_of_order[stage], 1, __ATOMIC_RELAXED);
+    last[stage][data->id] = sequence;
+}
+
+void *consumer_logic(void *arg) {
+    consumer_args_t *args = (consumer_args_t *)arg;
+    sensor_data_t batch[SBUFFER_BATCH_SIZE];
+    sbuffer_handle_t handles[SBUFFER_BATCH_SIZE];
+    int count;
+
+    if (args->stage == SBUFFER_STAGE_STORAGE) {
+        // Same loop as the Storage Manager: read, store, then remove the batch
+        while ((count = sbuffer_read_batch(args->buffer, batch, handles, SBUFFER_BATCH_SIZE, SBUFFER_STAGE_STORAGE,
+                                           -1)) > 0) {
+            for (int i = 0; i < count; i++) check(SBUFFER_STAGE_STORAGE, &batch[i]);
+            sbuffer_remove_batch(args->buffer, handles, count);
+        }
+        return NULL;
+    }
+
+    // Same loop as the Data Manager: read, handle, then pass the batch on
+    while ((count = sbuffer_read_shards(args->buffer, batch, handles, SBUFFER_BATCH_SIZE, SBUFFER_STAGE_DATAMGR,
+                                        args->first_shard, args->shard_count, -1)) > 0) {
+        for (int i = 0; i < count; i++) check(SBUFFER_STAGE_DATAMGR, &batch[i]);
+        sbuffer_mark_processed_batch(args->buffer, handles, count);
+    }
+    return NULL;
+}
+
+/**
+ * argv[1] = number of producer threads
+ * argv[2] = readings per producer
+ * argv[3] = number of shards
+ * argv[4] = number of Data Manager threads, at most the number of shards
+ * argv[5] = capacity of the buffer
+ * argv[6] = overflow policy, one that never loses data: block or spill
+ */
+int main(int argc, char *argv[]) {
+    if (argc != 7) {
+        printf("Usage: %s <producers> <readings> <shards> <datamgr threads> <capacity> <policy>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    producers = atoi(argv[1]);
+    readings = atoi(argv[2]);
+    unsigned int shards = (unsigned int)atoi(argv[3]);
+    int workers = atoi(argv[4]);
+    unsigned int capacity = (unsigned int)atoi(argv[5]);
+    int policy = sbuffer_policy_from_name(argv[6]);
+    if (producers <= 0 || producers > UINT16_MAX + 1 || readings <= 0 || workers <= 0 ||
+        (unsigned int)workers > shards || (policy != SBUFFER_POLICY_BLOCK && policy != SBUFFER_POLICY_SPILL)) {
+        fprintf(stderr, "invalid arguments\n");
+        return EXIT_FAILURE;
+    }
+
+    sbuffer_t *buffer = sbuffer_init(capacity, policy, shards);
+    if (!buffer) {
+        fprintf(stderr, "failed to create the buffer\n");
+        return EXIT_FAILURE;
+    }
+    base = time(NULL);
+    for (int stage = 0; stage < SBUFFER_STAGES; stage++) {
+        seen[stage] = calloc((size_t)producers * readings, 1);
+        last[stage] = malloc(producers * sizeof(long));
+        if (!seen[stage] || !last[stage]) {
+            fprintf(stderr, "out of memory\n");
+            return EXIT_FAILURE;
+        }
+        for (int i = 0; i < producers; i++) last[stage][i] = -1;
+    }
+
+    // The Data Manager threads split the shards like datamgr_partition does
+    pthread_t consumer_threads[workers + 1];
+    consumer_args_t consumer_args[workers + 1];
+    for (int i = 0; i <= workers; i++) {
+        consumer_args[i].buffer = buffer;
+        consumer_args[i].stage = i < workers ? SBUFFER_STAGE_DATAMGR : SBUFFER_STAGE_STORAGE;
+        consumer_args[i].first_shard = shards * i / workers;
+        consumer_args[i].shard_count = shards * (i + 1) / workers - consumer_args[i].first_shard;
+        pthread_create(&consumer_threads[i], NULL, consumer_logic, &consumer_args[i]);
+    }
+
+    pthread_t *producer_threads = malloc(producers * sizeof(pthread_t));
+    producer_args_t *producer_args = malloc(producers * sizeof(producer_args_t));
+    for (int i = 0; i < producers; i++) {
+        producer_args[i] = (producer_args_t){ .buffer = buffer, .producer = i, .readings = readings, .base = base };
+        pthread_create(&producer_threads[i], NULL, producer_logic, &producer_args[i]);
+    }
+    for (int i = 0; i < producers; i++) pthread_join(producer_threads[i], NULL);
+
+    // The consumers still handle everything that was inserted before they return
+    sbuffer_terminate(buffer);
+    for (int i = 0; i <= workers; i++) pthread_join(consumer_threads[i], NULL);
+
+    int failed = 0;
+    for (int stage = 0; stage < SBUFFER_STAGES; stage++) {
+        long lost = 0, duplicated = 0;
+        for (long i = 0; i < (long)producers * readings; i++) {
+            if (seen[stage][i] == 0) lost++;
+            if (seen[stage][i] > 1) duplicated++;
+        }
+        printf("stage %d: %ld lost, %ld seen more than once, %ld out of order\n",
+               stage, lost, duplicated, out_of_order[stage]);
+        if (lost || duplicated || out_of_order[stage]) failed = 1;
+        free(seen[stage]);
+        free(last[stage]);
+    }
+    if (!sbuffer_is_empty(buffer)) {
+        printf("the buffer isn't empty after both stages are done\n");
+        failed = 1;
+    }
+
+    free(producer_threads);
+    free(producer_args);
+    sbuffer_free(buffer);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
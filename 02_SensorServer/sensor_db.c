@@ -11,43 +11,48 @@ void *sensor_db_logic(void *arg) {
     char message[BUFFER_SIZE];
     write_to_pipe("Storage Manager started.");
 
-    sbuffer_t *buffer = (sbuffer_t *)arg;
+    sensor_db_args_t *args = (sensor_db_args_t *)arg;
+    sbuffer_t *buffer = args->buffer;
 
-    FILE *csv_file = fopen(CSV_FILE, "w");
+    FILE *csv_file = fopen(CSV_FILE, args->append ? "a" : "w");
     if (!csv_file) {
         write_to_pipe("ERROR: Unable to open CSV file.");
         return NULL;
     }
+    else if (args->append) {
+        write_to_pipe("The data.csv file has been reopened.");
+    }
     else {
         write_to_pipe("A new data.csv file has been created.");
+        // CSV Header
+        fprintf(csv_file, "SensorID,Value,Timestamp\n");
     }
 
-    // CSV Header
-    fprintf(csv_file, "SensorID,Value,Timestamp\n");
-
-    sensor_data_t data;
-    while (1) {
-        // Check if the buffer has already been terminated
-        if (sbuffer_is_terminated(buffer)) {
+    sensor_data_t batch[SBUFFER_BATCH_SIZE];
+    sbuffer_handle_t handles[SBUFFER_BATCH_SIZE];
+    int count;
+    // Read data the Data Manager has already processed, stop once the buffer is terminated and drained.
+    // A batch only leaves the buffer once it is flushed, so a storage process that dies halfway loses nothing.
+    while ((count = sbuffer_read_batch(buffer, batch, handles, SBUFFER_BATCH_SIZE, SBUFFER_STAGE_STORAGE, -1)) > 0) {
+        // Save to CSV, flushing once for the whole batch
+        for (int i = 0; i < count; i++) {
+            fprintf(csv_file, "%d,%.2f,%ld\n", batch[i].id, batch[i].value, batch[i].ts);
+        }
+        if (fflush(csv_file) != 0) {
+            // LOG
+            snprintf(message, BUFFER_SIZE, "ERROR: Writing to the CSV file failed, %d readings stay in the buffer.",
+                     count);
+            write_to_pipe(message);
             break;
         }
+        sbuffer_remove_batch(buffer, handles, count);
 
-        // Read processed data (processed_flag == 1)
-        if (sbuffer_read_unprocessed(buffer, &data, 1) == 0) {
-            // Save to CSV
-            fprintf(csv_file, "%d,%.2f,%ld\n", data.id, data.value, data.ts);
-            fflush(csv_file);
-
-            // Remove from buffer, as it's already saved to csv
-            sbuffer_remove(buffer, &data);
-
+        for (int i = 0; i < count; i++) {
             // LOG
             snprintf(message, BUFFER_SIZE,
                      "Data insertion from sensor %d succeeded.",
-                     data.id);
+                     batch[i].id);
             write_to_pipe(message);
-        } else {
-            sleep(1);
         }
     }
 
@@ -3,9 +3,20 @@
 
 #include "sbuffer.h"
 
+/**
+ * Structure storing the Storage Manager Arguments
+ *
+ * @param buffer Pointer to the shared buffer
+ * @param append Set to keep the existing data.csv, used when a storage process is restarted
+ */
+typedef struct {
+    sbuffer_t *buffer;
+    int append;
+} sensor_db_args_t;
+
 /**
  * Storage Manager Thread Logic
- * \param arg a pointer to the arguments
+ * \param arg a pointer to the arguments (sensor_db_args_t)
  * \return void
  */
 void *sensor_db_logic(void *arg);
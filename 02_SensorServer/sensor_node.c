@@ -10,7 +10,9 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include "config.h"
+#include "protocol.h"
 #include "lib/tcpsock.h"
+#include "lib/udpsock.h"
 
 // conditional compilation option to control the number of measurements this sensor node wil generate
 #if (LOOPS > 1)
@@ -55,26 +57,76 @@
 
 void print_help(void);
 
+/**
+ * Sends all 'size' bytes in 'data', even if the socket takes them in several parts
+ * \return 0 on success, -1 if an error occurred
+ */
+static int send_all(tcpsock_t *client, unsigned char *data, int size) {
+    while (size > 0) {
+        int bytes = size;
+        if (tcp_send(client, (void *) data, &bytes) != TCP_NO_ERROR) return -1;
+        data += bytes;
+        size -= bytes;
+    }
+    return 0;
+}
+
+/**
+ * Opens the framed protocol with a hello and waits for the hello of the gateway
+ * \return 0 if the gateway speaks the framed protocol, -1 otherwise
+ */
+static int handshake(tcpsock_t *client) {
+    unsigned char hello[PROTOCOL_RECORD_SIZE];
+    uint32_t version;
+    int received = 0;
+
+    protocol_hello_encode(hello, PROTOCOL_VERSION);
+    if (send_all(client, hello, PROTOCOL_RECORD_SIZE) != 0) return -1;
+    while (received < PROTOCOL_RECORD_SIZE) {
+        int bytes = PROTOCOL_RECORD_SIZE - received;
+        if (tcp_receive(client, (void *) (hello + received), &bytes) != TCP_NO_ERROR) return -1;
+        received += bytes;
+    }
+    if (!protocol_hello_decode(hello, &version) || version < 1 || version > PROTOCOL_VERSION) return -1;
+    return 0;
+}
+
+/**
+ * Sends the 'readings' readings collected in 'frame' as a single frame of sensor 'id'
+ * \return 0 on success, -1 if an error occurred
+ */
+static int send_frame(tcpsock_t *client, unsigned char *frame, sensor_id_t id, uint16_t readings) {
+    memcpy(frame, &id, sizeof(id));
+    memcpy(frame + sizeof(id), &readings, sizeof(readings));
+    return send_all(client, frame, PROTOCOL_HEADER_SIZE + readings * PROTOCOL_READING_SIZE);
+}
+
 /**
  * For starting the sensor node 4 command line arguments are needed. These should be given in the order below
  * and can then be used through the argv[] variable
  *
  * argv[1] = sensor ID
  * argv[2] = sleep time
- * argv[3] = server IP
+ * argv[3] = server IP, or the path of the Unix domain socket of a gateway on the same host (contains a '/')
  * argv[4] = server port
+ * argv[5] = readings per frame (optional), switches to the framed protocol
+ *           or "udp" (optional), sends every measurement as a datagram instead of over TCP
  */
 
 int main(int argc, char *argv[]) {
     sensor_data_t data;
     int server_port;
     char server_ip[] = "000.000.000.000";
-    tcpsock_t *client;
+    char *server_path = NULL;
+    tcpsock_t *client = NULL;
+    udpsock_t *udp_client = NULL;
     int i, bytes, sleep_time;
+    int batch = 0, readings = 0, udp = 0;
+    static unsigned char frame[PROTOCOL_HEADER_SIZE + PROTOCOL_MAX_READINGS * PROTOCOL_READING_SIZE];
 
     LOG_OPEN();
 
-    if (argc != 5) {
+    if (argc != 5 && argc != 6) {
         print_help();
         exit(EXIT_SUCCESS);
     } else {
@@ -82,32 +134,64 @@ int main(int argc, char *argv[]) {
         data.id = atoi(argv[1]);
         sleep_time = atoi(argv[2]);
         strncpy(server_ip, argv[3], strlen(server_ip));
+        if (strchr(argv[3], '/') != NULL) server_path = argv[3];
         server_port = atoi(argv[4]);
+        if (argc == 6 && strcmp(argv[5], "udp") == 0) udp = 1;
+        else if (argc == 6) batch = atoi(argv[5]);
+        if (batch > PROTOCOL_MAX_READINGS) batch = PROTOCOL_MAX_READINGS;
     }
 
     srand48(time(NULL));
 
     // open TCP connection to the server; server is listening to SERVER_IP and PORT
-    if (tcp_active_open(&client, server_port, server_ip) != TCP_NO_ERROR) exit(EXIT_FAILURE);
+    if (udp) {
+        if (udp_active_open(&udp_client, server_port, server_ip) != UDP_NO_ERROR) exit(EXIT_FAILURE);
+    } else if (server_path) {
+        // a gateway on the same host, the port is ignored
+        if (tcp_active_open_unix(&client, server_path) != TCP_NO_ERROR) exit(EXIT_FAILURE);
+    } else if (tcp_active_open(&client, server_port, server_ip) != TCP_NO_ERROR) exit(EXIT_FAILURE);
+    if (batch > 0 && handshake(client) != 0) exit(EXIT_FAILURE);
     data.value = INITIAL_TEMPERATURE;
     i = LOOPS;
     while (i) {
         data.value = data.value + TEMP_DEV * ((drand48() - 0.5) / 10);
         time(&data.ts);
-        // send data to server in this order (!!): <sensor_id><temperature><timestamp>
-        // remark: don't send as a struct!
-        bytes = sizeof(data.id);
-        if (tcp_send(client, (void *) &data.id, &bytes) != TCP_NO_ERROR) exit(EXIT_FAILURE);
-        bytes = sizeof(data.value);
-        if (tcp_send(client, (void *) &data.value, &bytes) != TCP_NO_ERROR) exit(EXIT_FAILURE);
-        bytes = sizeof(data.ts);
-        if (tcp_send(client, (void *) &data.ts, &bytes) != TCP_NO_ERROR) exit(EXIT_FAILURE);
+        if (udp) {
+            // a datagram holds the measurement in the same order: <sensor_id><temperature><timestamp>
+            unsigned char record[PROTOCOL_RECORD_SIZE];
+            memcpy(record, &data.id, sizeof(data.id));
+            memcpy(record + sizeof(data.id), &data.value, sizeof(data.value));
+            memcpy(record + sizeof(data.id) + sizeof(data.value), &data.ts, sizeof(data.ts));
+            if (udp_send(udp_client, record, PROTOCOL_RECORD_SIZE) != UDP_NO_ERROR) exit(EXIT_FAILURE);
+        } else if (batch > 0) {
+            // collect the readings as <temperature><timestamp>, a full frame goes out with a single send
+            unsigned char *reading = frame + PROTOCOL_HEADER_SIZE + readings * PROTOCOL_READING_SIZE;
+            memcpy(reading, &data.value, sizeof(data.value));
+            memcpy(reading + sizeof(data.value), &data.ts, sizeof(data.ts));
+            if (++readings == batch) {
+                if (send_frame(client, frame, data.id, readings) != 0) exit(EXIT_FAILURE);
+                readings = 0;
+            }
+        } else {
+            // send data to server in this order (!!): <sensor_id><temperature><timestamp>
+            // remark: don't send as a struct!
+            bytes = sizeof(data.id);
+            if (tcp_send(client, (void *) &data.id, &bytes) != TCP_NO_ERROR) exit(EXIT_FAILURE);
+            bytes = sizeof(data.value);
+            if (tcp_send(client, (void *) &data.value, &bytes) != TCP_NO_ERROR) exit(EXIT_FAILURE);
+            bytes = sizeof(data.ts);
+            if (tcp_send(client, (void *) &data.ts, &bytes) != TCP_NO_ERROR) exit(EXIT_FAILURE);
+        }
         LOG_PRINTF(data.id, data.value, data.ts);
         sleep(sleep_time);
         UPDATE(i);
     }
 
-    if (tcp_close(&client) != TCP_NO_ERROR) exit(EXIT_FAILURE);
+    // the last frame may not be full
+    if (readings > 0 && send_frame(client, frame, data.id, readings) != 0) exit(EXIT_FAILURE);
+    if (udp) {
+        if (udp_close(&udp_client) != UDP_NO_ERROR) exit(EXIT_FAILURE);
+    } else if (tcp_close(&client) != TCP_NO_ERROR) exit(EXIT_FAILURE);
 
     LOG_CLOSE();
 
@@ -118,9 +202,10 @@ int main(int argc, char *argv[]) {
  * Helper method to print a message on how to use this application
  */
 void print_help(void) {
-    printf("Use this program with 4 command line options: \n");
+    printf("Use this program with 4 or 5 command line options: \n");
     printf("\t%-15s : a unique sensor node ID\n", "\'ID\'");
     printf("\t%-15s : node sleep time (in sec) between two measurements\n", "\'sleep time\'");
-    printf("\t%-15s : TCP server IP address\n", "\'server IP\'");
+    printf("\t%-15s : TCP server IP address, or the path of the Unix domain socket of the gateway\n", "\'server IP\'");
     printf("\t%-15s : TCP server port number\n", "\'server port\'");
+    printf("\t%-15s : optional, send the measurements in frames of this many readings, or \"udp\" to send datagrams\n", "\'batch\'");
 }
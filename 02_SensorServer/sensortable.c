@@ -0,0 +1,240 @@
+#define _GNU_SOURCE
+
+#include "sensortable.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_CAPACITY 64
+#define MAX_SENSORS (SENSOR_TABLE_IDS - 1)     // the positions + 1 have to fit in the 16 bit index
+#define MAX_LINE 256
+#define MAX_WORD 32
+
+#define LINE_INVALID (-1)
+#define LINE_EMPTY 0        // blank or only a comment
+#define LINE_WINDOW 1       // "window <window>"
+#define LINE_ROOM 2         // "window room <room id> <window>"
+#define LINE_SENSOR 3       // "<room id> <sensor id> [<window>]"
+
+/**
+ * Sensor line of a map file, added once the windows of all rooms are known
+ */
+typedef struct {
+    uint16_t room_id;
+    uint16_t sensor_id;
+    window_spec_t window;       // samples and seconds are 0 if the line doesn't give a window
+} map_sensor_t;
+
+/**
+ * "window room" line of a map file
+ */
+typedef struct {
+    uint16_t room_id;
+    window_spec_t window;
+} map_room_t;
+
+sensor_table_t *sensor_table_create(void) {
+    // Zeroed, so every index entry starts out as SENSOR_TABLE_NONE
+    sensor_table_t *table = calloc(1, sizeof(sensor_table_t));
+    if (!table) return NULL;
+    table->nodes = malloc(INITIAL_CAPACITY * sizeof(sensor_node_t));
+    if (!table->nodes) {
+        free(table);
+        return NULL;
+    }
+    table->capacity = INITIAL_CAPACITY;
+    return table;
+}
+
+// Returns the statistics of room 'room_id', which are added if the room is new; NULL if memory allocation failed
+static room_stats_t *sensor_table_add_room(sensor_table_t *table, uint16_t room_id) {
+    room_stats_t *room = sensor_table_room(table, room_id);
+    if (room) return room;
+
+    if (table->room_count == MAX_SENSORS) return NULL;
+    if (table->room_count == table->room_capacity) {
+        int capacity = table->room_capacity > 0 ? table->room_capacity * 2 : INITIAL_CAPACITY;
+        if (capacity > MAX_SENSORS) capacity = MAX_SENSORS;
+        room_stats_t **rooms = realloc(table->rooms, capacity * sizeof(room_stats_t *));
+        if (!rooms) return NULL;
+        table->rooms = rooms;
+        table->room_capacity = capacity;
+    }
+
+    room = calloc(1, sizeof(room_stats_t));
+    if (!room) return NULL;
+    room->room_id = room_id;
+    table->rooms[table->room_count] = room;
+    table->room_index[room_id] = ++table->room_count;
+    return room;
+}
+
+sensor_node_t *sensor_table_add(sensor_table_t *table, sensor_id_t sensor_id, uint16_t room_id, window_spec_t window) {
+    room_stats_t *room = sensor_table_add_room(table, room_id);
+    if (!room) return NULL;
+
+    sensor_node_t *node = sensor_table_lookup(table, sensor_id);
+    if (node) {
+        node->room->sensors--;
+        node->room_id = room_id;
+        node->room = room;
+        room->sensors++;
+        if (node->window.spec.samples != window.samples || node->window.spec.seconds != window.seconds) {
+            window_free(&node->window);
+            if (window_init(&node->window, window) != 0) return NULL;
+        }
+        return node;
+    }
+
+    if (table->count == MAX_SENSORS) return NULL;
+    if (table->count == table->capacity) {
+        int capacity = table->capacity * 2 > MAX_SENSORS ? MAX_SENSORS : table->capacity * 2;
+        sensor_node_t *nodes = realloc(table->nodes, capacity * sizeof(sensor_node_t));
+        if (!nodes) return NULL;
+        table->nodes = nodes;
+        table->capacity = capacity;
+    }
+
+    node = &table->nodes[table->count];
+    memset(node, 0, sizeof(sensor_node_t));
+    if (window_init(&node->window, window) != 0) return NULL;
+    node->sensor_id = sensor_id;
+    node->room_id = room_id;
+    node->room = room;
+    room->sensors++;
+    table->index[sensor_id] = ++table->count;
+    return node;
+}
+
+// Parses a room or sensor id, returns -1 if 'text' isn't one
+static int parse_id(const char *text, uint16_t *id) {
+    char *end;
+    unsigned long value = strtoul(text, &end, 10);
+    if (end == text || *end != '\0' || text[0] == '-' || value > UINT16_MAX) return -1;
+    *id = (uint16_t) value;
+    return 0;
+}
+
+// Parses a line of a map file into the default window, a room window or a sensor, returns its LINE_* kind
+static int parse_line(char *line, window_spec_t *window, map_room_t *room, map_sensor_t *sensor) {
+    char words[4][MAX_WORD];
+    char *comment = strchr(line, '#');
+    if (comment) *comment = '\0';
+
+    int count = sscanf(line, "%31s %31s %31s %31s", words[0], words[1], words[2], words[3]);
+    if (count <= 0) return LINE_EMPTY;
+
+    if (strcmp(words[0], "window") == 0) {
+        if (count == 2) return window_parse(words[1], window) == 0 ? LINE_WINDOW : LINE_INVALID;
+        if (count != 4 || strcmp(words[1], "room") != 0) return LINE_INVALID;
+        if (parse_id(words[2], &room->room_id) != 0) return LINE_INVALID;
+        return window_parse(words[3], &room->window) == 0 ? LINE_ROOM : LINE_INVALID;
+    }
+
+    if (count > 3) return LINE_INVALID;
+    if (parse_id(words[0], &sensor->room_id) != 0 || parse_id(words[1], &sensor->sensor_id) != 0) return LINE_INVALID;
+    memset(&sensor->window, 0, sizeof(window_spec_t));
+    if (count == 3 && window_parse(words[2], &sensor->window) != 0) return LINE_INVALID;
+    return LINE_SENSOR;
+}
+
+int sensor_table_load(sensor_table_t *table, const char *path, int (*keep)(sensor_id_t, void *), void *arg) {
+    FILE *map_file = fopen(path, "r");
+    if (!map_file) return -1;
+
+    // The windows may come after the sensors they apply to, so the sensors are only added once the file is read
+    window_spec_t fallback = {.samples = RUN_AVG_LENGTH, .seconds = 0};
+    map_sensor_t *sensors = NULL;
+    map_room_t *rooms = NULL;
+    int sensor_count = 0, room_count = 0, valid = 1;
+    char line[MAX_LINE];
+    while (valid && fgets(line, MAX_LINE, map_file)) {
+        map_sensor_t sensor;
+        map_room_t room;
+        switch (parse_line(line, &fallback, &room, &sensor)) {
+            case LINE_INVALID:
+                valid = 0;
+                break;
+            case LINE_ROOM: {
+                map_room_t *grown = realloc(rooms, (room_count + 1) * sizeof(map_room_t));
+                if (grown) {
+                    rooms = grown;
+                    rooms[room_count++] = room;
+                }
+                valid = grown != NULL;
+                break;
+            }
+            case LINE_SENSOR: {
+                map_sensor_t *grown = realloc(sensors, (sensor_count + 1) * sizeof(map_sensor_t));
+                if (grown) {
+                    sensors = grown;
+                    sensors[sensor_count++] = sensor;
+                }
+                valid = grown != NULL;
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    fclose(map_file);
+
+    // A window of the sensor itself goes before the one of its room, which goes before the one of the whole file
+    for (int i = 0; valid && i < sensor_count; i++) {
+        if (keep && !keep(sensors[i].sensor_id, arg)) continue;
+        window_spec_t window = sensors[i].window;
+        for (int j = room_count - 1; window.samples == 0 && window.seconds == 0 && j >= 0; j--) {
+            if (rooms[j].room_id == sensors[i].room_id) window = rooms[j].window;
+        }
+        if (window.samples == 0 && window.seconds == 0) window = fallback;
+        valid = sensor_table_add(table, sensors[i].sensor_id, sensors[i].room_id, window) != NULL;
+    }
+
+    free(sensors);
+    free(rooms);
+    return valid ? sensor_count : -1;
+}
+
+int sensor_table_adopt(sensor_table_t *table, sensor_table_t *old) {
+    int kept = 0;
+    for (int i = 0; i < table->count; i++) {
+        sensor_node_t *node = &table->nodes[i];
+        sensor_node_t *previous = sensor_table_lookup(old, node->sensor_id);
+        if (!previous || previous->window.spec.samples != node->window.spec.samples ||
+            previous->window.spec.seconds != node->window.spec.seconds) {
+            continue;
+        }
+
+        // Swapped rather than copied, so both tables still free exactly what they hold
+        window_t window = node->window;
+        node->window = previous->window;
+        previous->window = window;
+        node->last_modified = previous->last_modified;
+        kept++;
+    }
+
+    for (int i = 0; i < table->room_count; i++) {
+        room_stats_t *room = table->rooms[i];
+        room_stats_t *previous = sensor_table_room(old, room->room_id);
+        if (!previous) continue;
+        // The number of sensors is that of the new map
+        int sensors = room->sensors;
+        memcpy(room, previous, sizeof(room_stats_t));
+        room->sensors = sensors;
+    }
+    return kept;
+}
+
+void sensor_table_free(sensor_table_t **table) {
+    if (!table || !*table) return;
+    for (int i = 0; i < (*table)->count; i++) {
+        window_free(&(*table)->nodes[i].window);
+    }
+    free((*table)->nodes);
+    for (int i = 0; i < (*table)->room_count; i++) {
+        free((*table)->rooms[i]);
+    }
+    free((*table)->rooms);
+    free(*table);
+    *table = NULL;
+}
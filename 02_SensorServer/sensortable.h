@@ -0,0 +1,118 @@
+#ifndef SENSORTABLE_H
+#define SENSORTABLE_H
+
+#include "config.h"
+#include "roomstats.h"
+#include "window.h"
+#include <stdint.h>
+#include <time.h>
+
+#define RUN_AVG_LENGTH 5            // window in samples of the sensors the map file doesn't give a window
+#define SENSOR_TABLE_IDS (1 << (8 * sizeof(sensor_id_t)))  // every possible sensor id has an entry in the index
+#define SENSOR_TABLE_NONE 0                                 // index entry of a sensor id that isn't in the table
+
+/**
+ * State the Data Manager keeps per sensor
+ *
+ * @param sensor_id Sensor ID
+ * @param room_id Room the sensor is in
+ * @param room Statistics of the room the sensor is in
+ * @param window Sliding window over the recent values of the sensor, with their average, spread and extremes
+ * @param last_modified Last modified timestamp
+ */
+typedef struct {
+    uint16_t sensor_id;
+    uint16_t room_id;
+    room_stats_t *room;
+    window_t window;
+    time_t last_modified;
+} sensor_node_t;
+
+/**
+ * Registry of the sensors of room_sensor.map, not thread-safe
+ *
+ * The states of the sensors are stored next to each other in 'nodes'. A sensor id is only 16 bits, so 'index' has an
+ * entry for every possible id holding the position of its state plus one, or SENSOR_TABLE_NONE. A lookup is a single
+ * load from the index and one from the array, no matter how many sensors there are. The rooms of the sensors are
+ * indexed the same way, every room has its statistics, which the sensors point to.
+ *
+ * @param index Position + 1 of the state of every sensor id in 'nodes', SENSOR_TABLE_NONE if it isn't registered
+ * @param nodes States of the registered sensors, in the order they were added
+ * @param count Number of registered sensors
+ * @param capacity Number of states 'nodes' has room for
+ * @param room_index Position + 1 of the statistics of every room id in 'rooms', SENSOR_TABLE_NONE if it has no sensors
+ * @param rooms Statistics of the rooms, allocated one by one so they never move
+ * @param room_count Number of rooms
+ * @param room_capacity Number of statistics 'rooms' has room for
+ */
+typedef struct {
+    uint16_t index[SENSOR_TABLE_IDS];
+    sensor_node_t *nodes;
+    int count;
+    int capacity;
+    uint16_t room_index[SENSOR_TABLE_IDS];
+    room_stats_t **rooms;
+    int room_count;
+    int room_capacity;
+} sensor_table_t;
+
+/**
+ * Creates an empty table
+ * \return the table, NULL if memory allocation failed
+ */
+sensor_table_t *sensor_table_create(void);
+
+/**
+ * Registers sensor 'sensor_id' in room 'room_id' with a fresh state and a window of length 'window'
+ * A sensor that is registered already moves to 'room_id' and keeps its state, unless the length of its window changes
+ * \param table the table
+ * \return the state of the sensor, NULL if memory allocation failed or all sensor ids but one are registered already
+ */
+sensor_node_t *sensor_table_add(sensor_table_t *table, sensor_id_t sensor_id, uint16_t room_id, window_spec_t window);
+
+/**
+ * Registers every sensor of the map file 'path'. Everything after a '#' is a comment, every other line is one of
+ *   "<room id> <sensor id> [<window>]"     a sensor, with its own window
+ *   "window room <room id> <window>"       the window of the sensors of a room that don't have their own
+ *   "window <window>"                      the window of the other sensors, RUN_AVG_LENGTH samples if there is none
+ * where a window is "<n>" for the last n samples or "<n>s" for the samples of the last n seconds (see window_parse)
+ * \param table the table
+ * \param path the path of the map file
+ * \param keep called with every sensor id and 'arg', only the sensors it returns non-zero for are added; NULL adds all
+ * \param arg passed on to 'keep'
+ * \return the number of sensor lines read, -1 if the file can't be opened, has an invalid line or a sensor can't be added
+ */
+int sensor_table_load(sensor_table_t *table, const char *path, int (*keep)(sensor_id_t, void *), void *arg);
+
+/**
+ * Moves the state of every sensor that is in both tables from 'old' to 'table', and the statistics of every room
+ * that is in both, used to switch to a reloaded map file without losing the running averages
+ * A sensor whose window changed length starts over with an empty window. 'old' keeps the fresh states of 'table'.
+ * \param table the new table, as loaded from the map file
+ * \param old the table that is replaced
+ * \return the number of sensors that kept their state
+ */
+int sensor_table_adopt(sensor_table_t *table, sensor_table_t *old);
+
+/**
+ * Returns the state of sensor 'sensor_id', NULL if it isn't registered
+ */
+static inline sensor_node_t *sensor_table_lookup(sensor_table_t *table, sensor_id_t sensor_id) {
+    uint16_t position = table->index[sensor_id];
+    return position == SENSOR_TABLE_NONE ? NULL : &table->nodes[position - 1];
+}
+
+/**
+ * Returns the statistics of room 'room_id', NULL if none of the sensors of the table is in it
+ */
+static inline room_stats_t *sensor_table_room(sensor_table_t *table, uint16_t room_id) {
+    uint16_t position = table->room_index[room_id];
+    return position == SENSOR_TABLE_NONE ? NULL : table->rooms[position - 1];
+}
+
+/**
+ * Frees '*table' and sets it to NULL, nothing is done if it is NULL already
+ */
+void sensor_table_free(sensor_table_t **table);
+
+#endif // SENSORTABLE_H
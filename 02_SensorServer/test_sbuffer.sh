@@ -0,0 +1,29 @@
+producers=32
+readings=20000
+limit=120
+echo -e "building the shared buffer stress test"
+gcc sbuffer_stress.c sbuffer.c -Wall -std=c11 -Werror -pthread -o sbuffer_stress
+
+# shards, Data Manager threads, capacity and policy of every run, a small capacity keeps the producers blocking, the smallest
+# shards leave only two slots for the ingest queue
+failed=0
+for run in "2 2 8 block" "1 1 64 block" "4 2 64 block" "8 8 1024 block" "4 2 64 spill"; do
+    set -- $run
+    echo -e "$producers producers, $readings readings each, $1 shards, $2 Data Manager threads, capacity $3, policy $4"
+    # Lost or duplicated slots can leave a stage waiting forever, a run that hangs fails as well
+    timeout $limit ./sbuffer_stress $producers $readings $1 $2 $3 $4
+    result=$?
+    if [ $result -eq 124 ]; then
+        echo -e "no result after $limit seconds"
+    fi
+    if [ $result -ne 0 ]; then
+        failed=1
+    fi
+done
+rm -f sbuffer_stress
+
+if [ $failed -ne 0 ]; then
+    echo -e "shared buffer stress test failed"
+    exit 1
+fi
+echo -e "shared buffer stress test passed"
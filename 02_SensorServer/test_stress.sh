@@ -0,0 +1,41 @@
+make all
+port=5679
+clients=20
+loops=500
+batch=32
+echo -e "building a sensor node that sends $loops measurements"
+gcc sensor_node.c -Wall -std=c11 -Werror -DLOOPS=$loops -ltcpsock -ludpsock -o sensor_node_stress -L./lib -Wl,-rpath,./lib
+echo -e "starting gateway "
+./sensor_gateway -s 4 "$@" $port $clients &
+gateway=$!
+sleep 3
+echo -e "starting $clients sensor nodes without any sleep, every second one sends frames of $batch readings"
+nodes=""
+for i in $(seq 1 $clients); do
+    if [ $((i % 2)) -eq 0 ]; then
+        ./sensor_node_stress $((100 + i)) 0 127.0.0.1 $port $batch > /dev/null &
+    else
+        ./sensor_node_stress $((100 + i)) 0 127.0.0.1 $port > /dev/null &
+    fi
+    nodes="$nodes $!"
+done
+wait $nodes
+wait $gateway
+rm -f sensor_node_stress
+
+# Every sensor must have exactly all of its measurements stored, nothing lost and nothing stored twice
+echo -e "checking data.csv"
+failed=0
+for i in $(seq 1 $clients); do
+    count=$(grep -c "^$((100 + i))," data.csv)
+    if [ "$count" -ne "$loops" ]; then
+        echo -e "sensor $((100 + i)): $count measurements stored, expected $loops"
+        failed=1
+    fi
+done
+echo -e "$(($(wc -l < data.csv) - 1)) measurements stored"
+if [ $failed -ne 0 ]; then
+    echo -e "stress test failed"
+    exit 1
+fi
+echo -e "stress test passed"
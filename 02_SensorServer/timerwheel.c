@@ -0,0 +1,119 @@
+#define _GNU_SOURCE
+
+#include "timerwheel.h"
+#include <time.h>
+
+#define LEVEL_SHIFT(level) ((level) * TIMER_WHEEL_SLOT_BITS)
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define MAX_DELAY ((1ULL << LEVEL_SHIFT(TIMER_WHEEL_LEVELS)) - 1)   // ticks the highest level reaches ahead
+
+static int slot_empty(const wheel_timer_t *slot) {
+    return slot->next == slot;
+}
+
+static void timer_unlink(timer_wheel_t *wheel, wheel_timer_t *timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = timer->prev = NULL;
+    wheel->count--;
+}
+
+// Puts 'timer' in the slot of the lowest level that reaches its expiry, seen from the current tick
+static void timer_link(timer_wheel_t *wheel, wheel_timer_t *timer) {
+    uint64_t delay = timer->expires - wheel->now;
+    if (delay > MAX_DELAY) {
+        timer->expires = wheel->now + MAX_DELAY;
+        delay = MAX_DELAY;
+    }
+
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delay >= (1ULL << LEVEL_SHIFT(level + 1))) level++;
+    wheel_timer_t *slot = &wheel->slots[level][(timer->expires >> LEVEL_SHIFT(level)) & SLOT_MASK];
+
+    timer->prev = slot->prev;
+    timer->next = slot;
+    slot->prev->next = timer;
+    slot->prev = timer;
+    wheel->count++;
+}
+
+// Moves the timers of a slot of a higher level down, now that the wheel has reached the range the slot covers
+static void slot_cascade(timer_wheel_t *wheel, wheel_timer_t *slot) {
+    while (!slot_empty(slot)) {
+        wheel_timer_t *timer = slot->next;
+        timer_unlink(wheel, timer);
+        timer_link(wheel, timer);
+    }
+}
+
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t tick_ms, uint64_t now_ms) {
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (int i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+            wheel->slots[level][i].next = wheel->slots[level][i].prev = &wheel->slots[level][i];
+        }
+    }
+    wheel->tick_ms = tick_ms > 0 ? tick_ms : 1;
+    wheel->now = now_ms / wheel->tick_ms;
+    wheel->count = 0;
+}
+
+void timer_wheel_schedule(timer_wheel_t *wheel, wheel_timer_t *timer, uint64_t delay_ms) {
+    timer_wheel_cancel(wheel, timer);
+    // The slot of the current tick has fired already, so the earliest expiry is the next tick
+    uint64_t ticks = (delay_ms + wheel->tick_ms - 1) / wheel->tick_ms;
+    timer->expires = wheel->now + (ticks > 0 ? ticks : 1);
+    timer_link(wheel, timer);
+}
+
+void timer_wheel_cancel(timer_wheel_t *wheel, wheel_timer_t *timer) {
+    if (timer->next) timer_unlink(wheel, timer);
+}
+
+void timer_wheel_advance(timer_wheel_t *wheel, uint64_t now_ms, void (*expire)(wheel_timer_t *, void *), void *arg) {
+    uint64_t target = now_ms / wheel->tick_ms;
+
+    while (wheel->now < target) {
+        if (wheel->count == 0) {
+            // Nothing can fire on the way
+            wheel->now = target;
+            break;
+        }
+        wheel->now++;
+
+        // Every 64 ticks the next slot of level 1 is due, every 64 * 64 ticks the next slot of level 2, ...
+        for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+            if (wheel->now & ((1ULL << LEVEL_SHIFT(level)) - 1)) break;
+            slot_cascade(wheel, &wheel->slots[level][(wheel->now >> LEVEL_SHIFT(level)) & SLOT_MASK]);
+        }
+
+        wheel_timer_t *slot = &wheel->slots[0][wheel->now & SLOT_MASK];
+        while (!slot_empty(slot)) {
+            wheel_timer_t *timer = slot->next;
+            timer_unlink(wheel, timer);
+            expire(timer, arg);
+        }
+    }
+}
+
+int timer_wheel_timeout(timer_wheel_t *wheel, uint64_t now_ms) {
+    if (wheel->count == 0) return -1;
+
+    // The first tick that fires a timer of level 0, or else the next cascade, which may move timers to level 0
+    uint64_t next = (wheel->now | SLOT_MASK) + 1;
+    for (uint64_t tick = wheel->now + 1; tick < next; tick++) {
+        if (!slot_empty(&wheel->slots[0][tick & SLOT_MASK])) {
+            next = tick;
+            break;
+        }
+    }
+
+    uint64_t due_ms = next * wheel->tick_ms;
+    if (due_ms <= now_ms) return 0;
+    return due_ms - now_ms > INT32_MAX ? INT32_MAX : (int) (due_ms - now_ms);
+}
+
+uint64_t timer_wheel_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
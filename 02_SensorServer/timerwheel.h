@@ -0,0 +1,89 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stdint.h>
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)     // slots per level, a level spans 64 times the previous one
+
+/**
+ * Timer that can be scheduled on a timer wheel, embedded in the structure it belongs to
+ *
+ * @param next Next timer in the same slot, NULL while the timer isn't scheduled
+ * @param prev Previous timer in the same slot
+ * @param expires Tick the timer expires at
+ * @param data Pointer handed back to the owner when the timer expires
+ */
+typedef struct wheel_timer {
+    struct wheel_timer *next;
+    struct wheel_timer *prev;
+    uint64_t expires;
+    void *data;
+} wheel_timer_t;
+
+/**
+ * Hierarchical timer wheel, not thread-safe: every thread keeps its own
+ *
+ * Level 0 has a slot per tick, every next level a slot per 64 ticks of the level below. A timer is put in the level
+ * that covers its expiry, and moves down a level whenever the wheel reaches its slot ("cascading"), so scheduling,
+ * cancelling and expiring a timer are O(1) no matter how many timers are scheduled.
+ *
+ * @param slots Circular lists of timers, the sentinels of every level
+ * @param tick_ms Length of a tick in milliseconds
+ * @param now Current tick, every timer that expires at or before it has fired
+ * @param count Number of scheduled timers
+ */
+typedef struct {
+    wheel_timer_t slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint64_t tick_ms;
+    uint64_t now;
+    int count;
+} timer_wheel_t;
+
+/**
+ * Sets up an empty 'wheel' with ticks of 'tick_ms' milliseconds, starting at time 'now_ms'
+ * \param wheel the wheel
+ * \param tick_ms the length of a tick in milliseconds, the timers fire at most this much late
+ * \param now_ms the current time in milliseconds of a monotonic clock
+ */
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t tick_ms, uint64_t now_ms);
+
+/**
+ * Schedules 'timer' to expire 'delay_ms' milliseconds after the current tick of 'wheel', rounded up to a whole tick
+ * A timer that is scheduled already is moved
+ * \param wheel the wheel
+ * \param timer the timer, its data pointer is left untouched
+ * \param delay_ms the delay in milliseconds
+ */
+void timer_wheel_schedule(timer_wheel_t *wheel, wheel_timer_t *timer, uint64_t delay_ms);
+
+/**
+ * Removes 'timer' from 'wheel', nothing is done if it isn't scheduled
+ */
+void timer_wheel_cancel(timer_wheel_t *wheel, wheel_timer_t *timer);
+
+/**
+ * Advances 'wheel' to time 'now_ms' and calls 'expire' for every timer that expires on the way, in order of expiry
+ * The timer is removed from the wheel before 'expire' is called, so it may schedule it again
+ * \param wheel the wheel
+ * \param now_ms the current time in milliseconds of the same clock as timer_wheel_init
+ * \param expire the function to call with each expired timer and 'arg'
+ * \param arg passed on to 'expire'
+ */
+void timer_wheel_advance(timer_wheel_t *wheel, uint64_t now_ms, void (*expire)(wheel_timer_t *, void *), void *arg);
+
+/**
+ * Returns how long a caller may wait before it has to advance 'wheel' again, to be used as a poll timeout
+ * \param wheel the wheel
+ * \param now_ms the current time in milliseconds
+ * \return the time in milliseconds, -1 if no timer is scheduled
+ */
+int timer_wheel_timeout(timer_wheel_t *wheel, uint64_t now_ms);
+
+/**
+ * Returns the current time in milliseconds of the monotonic clock
+ */
+uint64_t timer_wheel_clock(void);
+
+#endif // TIMERWHEEL_H
@@ -0,0 +1,148 @@
+#define _GNU_SOURCE
+
+#include "udpmgr.h"
+#include "protocol.h"
+#include "lib/udpsock.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+
+#define BUFFER_SIZE 1024
+#define DATAGRAM_SIZE (UDPMGR_MAX_RECORDS * PROTOCOL_RECORD_SIZE)
+#define UDPMGR_BATCH 32             // datagrams received per recvmmsg
+
+/**
+ * Counters of the UDP Manager
+ *
+ * @param datagrams Datagrams received
+ * @param measurements Measurements inserted into the buffer
+ * @param malformed Datagrams that don't hold whole measurements, or use the reserved sensor ID
+ * @param rejected Datagrams the buffer didn't accept
+ */
+typedef struct {
+    unsigned long datagrams;
+    unsigned long measurements;
+    unsigned long malformed;
+    unsigned long rejected;
+} udpmgr_stats_t;
+
+// Decodes a measurement in the order a Sensor Node sends it: <sensor_id><temperature><timestamp>
+static void record_decode(const unsigned char *record, sensor_data_t *data) {
+    memcpy(&data->id, record, sizeof(data->id));
+    memcpy(&data->value, record + sizeof(data->id), sizeof(data->value));
+    memcpy(&data->ts, record + sizeof(data->id) + sizeof(data->value), sizeof(data->ts));
+}
+
+/**
+ * Validates the datagram 'datagram' of 'size' bytes and decodes its measurements to 'batch'
+ * \return the number of measurements, -1 if the datagram is malformed
+ */
+static int datagram_decode(const unsigned char *datagram, int size, sensor_data_t *batch) {
+    if (size <= 0 || size % PROTOCOL_RECORD_SIZE != 0) return -1;
+
+    int count = size / PROTOCOL_RECORD_SIZE;
+    for (int i = 0; i < count; i++) {
+        record_decode(datagram + i * PROTOCOL_RECORD_SIZE, &batch[i]);
+        if (batch[i].id == PROTOCOL_HELLO_ID) return -1;
+    }
+    return count;
+}
+
+/**
+ * Receives everything that is queued on 'socket', one recvmmsg per batch of datagrams
+ * The measurements of the valid datagrams of a batch are inserted into 'buffer' together
+ */
+static void udpmgr_receive(udpsock_t *socket, sbuffer_t *buffer, unsigned char *datagrams, sensor_data_t *batch,
+                           udpmgr_stats_t *stats) {
+    char message[BUFFER_SIZE];
+    int sizes[UDPMGR_BATCH];
+    int count = UDPMGR_BATCH;
+
+    while (udp_receive_batch(socket, datagrams, DATAGRAM_SIZE, sizes, &count) == UDP_NO_ERROR) {
+        int measurements = 0;
+        int valid = 0;
+        for (int i = 0; i < count; i++) {
+            int decoded = datagram_decode(datagrams + i * DATAGRAM_SIZE, sizes[i], batch + measurements);
+            if (decoded < 0) {
+                stats->malformed++;
+                continue;
+            }
+            for (int j = measurements; j < measurements + decoded; j++) {
+                // LOG
+                snprintf(message, BUFFER_SIZE, "Received new data over UDP {id: %d, value: %.2f, ts: %ld}",
+                         batch[j].id, batch[j].value, batch[j].ts);
+                write_to_pipe(message);
+            }
+            measurements += decoded;
+            valid++;
+        }
+
+        stats->datagrams += count;
+        if (measurements > 0 && sbuffer_insert_batch(buffer, batch, measurements) != SBUFFER_SUCCESS) {
+            stats->rejected += valid;
+        } else {
+            stats->measurements += measurements;
+        }
+        count = UDPMGR_BATCH;
+    }
+}
+
+void *udpmgr_logic(void *arg) {
+    udpmgr_args_t *args = (udpmgr_args_t *)arg;
+    char message[BUFFER_SIZE];
+    udpsock_t *socket;
+
+    if (udp_passive_open(&socket, args->port) != UDP_NO_ERROR) {
+        // LOG
+        snprintf(message, BUFFER_SIZE, "Failed to open UDP socket on port %5d. Errno: %d (%s)",
+                 args->port, errno, strerror(errno));
+        write_to_pipe(message);
+        return NULL;
+    }
+
+    unsigned char *datagrams = malloc(UDPMGR_BATCH * DATAGRAM_SIZE);
+    sensor_data_t *batch = malloc(UDPMGR_BATCH * UDPMGR_MAX_RECORDS * sizeof(sensor_data_t));
+    if (!datagrams || !batch) {
+        write_to_pipe("Memory allocation for the UDP Manager failed.");
+        free(datagrams);
+        free(batch);
+        udp_close(&socket);
+        return NULL;
+    }
+
+    // LOG
+    snprintf(message, BUFFER_SIZE, "UDP Manager is receiving datagrams on port %5d", args->port);
+    write_to_pipe(message);
+
+    udpmgr_stats_t stats = { 0 };
+    struct pollfd fds[2] = {
+        { .events = POLLIN },
+        { .fd = args->stop_fd, .events = POLLIN }
+    };
+    udp_get_sd(socket, &fds[0].fd);
+    while (1) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("[ERROR] Poll of the UDP socket failed");
+            break;
+        }
+        // Whatever is still queued when the stop arrives is received first
+        if (fds[0].revents & POLLIN) udpmgr_receive(socket, args->buffer, datagrams, batch, &stats);
+        if (fds[1].revents & POLLIN) break;
+    }
+
+    unsigned long dropped = 0;
+    udp_get_dropped(socket, &dropped);
+    // LOG
+    snprintf(message, BUFFER_SIZE,
+             "UDP Manager: datagrams %lu, measurements %lu, malformed %lu, dropped by the kernel %lu, rejected by the buffer %lu",
+             stats.datagrams, stats.measurements, stats.malformed, dropped, stats.rejected);
+    write_to_pipe(message);
+
+    free(datagrams);
+    free(batch);
+    udp_close(&socket);
+    return NULL;
+}
@@ -0,0 +1,34 @@
+#ifndef UDPMGR_H
+#define UDPMGR_H
+
+#include "sbuffer.h"
+
+#define UDPMGR_MAX_RECORDS 32       // measurements a single datagram may carry
+
+/**
+ * UDP Manager Arguments
+ *
+ * Every datagram holds one or more measurements in the legacy format of protocol.h, <sensor_id><temperature><timestamp>,
+ * and nothing else. Datagrams that don't match are counted as malformed and ignored.
+ *
+ * @param buffer A pointer to the shared buffer
+ * @param port Port the datagrams are received on
+ * @param stop_fd Eventfd created by the caller, the UDP Manager exits once it becomes readable
+ */
+typedef struct {
+    sbuffer_t *buffer;
+    int port;
+    int stop_fd;
+} udpmgr_args_t;
+
+/**
+ * UDP Manager Thread Logic
+ * Receives the datagrams in batches with recvmmsg and inserts the measurements of each batch into the buffer at once.
+ * The counters of received, malformed and dropped datagrams are logged on exit.
+ *
+ * @param arg a pointer to the arguments (udpmgr_args_t)
+ * @return void
+ */
+void *udpmgr_logic(void *arg);
+
+#endif // UDPMGR_H
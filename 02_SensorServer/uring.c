@@ -0,0 +1,278 @@
+#define _GNU_SOURCE
+
+#include "uring.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+// The kernel reads and writes the ring indices concurrently, so they are accessed with acquire/release semantics
+#define URING_LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define URING_STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/**
+ * Structure of an io_uring and the mappings it shares with the kernel
+ *
+ * sq_ring and cq_ring are the same mapping when the kernel supports IORING_FEAT_SINGLE_MMAP
+ * sqe_tail counts the entries handed out by uring_get_sqe, the kernel only sees them once *sq_tail is advanced
+ */
+struct uring {
+    int fd;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int sq_mask;
+    unsigned int sq_entries;
+    unsigned int sqe_tail;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe *cqes;
+    struct io_uring_buf_ring *buf_ring;     // provided buffer ring, NULL until uring_provide_buffers
+    size_t buf_ring_size;
+    char *buffers;
+    unsigned int buffer_count;
+    unsigned int buffer_size;
+    unsigned short buf_tail;
+};
+
+static int uring_setup(unsigned int entries, struct io_uring_params *params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned int submit, unsigned int wait, unsigned int flags, void *arg, size_t size) {
+    return (int) syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, size);
+}
+
+static int uring_register(int fd, unsigned int opcode, void *arg, unsigned int count) {
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+// Checks that the kernel knows every operation the Connection Manager needs
+static int uring_supported(int fd) {
+    size_t size = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    if (!probe) return 0;
+
+    int supported = 0;
+    if (uring_register(fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0) {
+        // Multishot recv has no probe of its own, it came with the same release (6.0) as IORING_OP_SEND_ZC
+        int ops[] = { IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL, IORING_OP_SEND_ZC };
+        supported = 1;
+        for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+            if (ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) supported = 0;
+        }
+    }
+    free(probe);
+    return supported;
+}
+
+int uring_init(uring_t **ring, unsigned int entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = uring_setup(entries, &params);
+    if (fd < 0) return (errno == ENOSYS || errno == EPERM) ? URING_UNSUPPORTED : URING_ERROR;
+    if (!(params.features & IORING_FEAT_NODROP) || !(params.features & IORING_FEAT_EXT_ARG) || !uring_supported(fd)) {
+        close(fd);
+        return URING_UNSUPPORTED;
+    }
+
+    uring_t *r = calloc(1, sizeof(uring_t));
+    if (!r) {
+        close(fd);
+        return URING_ERROR;
+    }
+    r->fd = fd;
+    r->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    r->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_ring_size > r->sq_ring_size) r->sq_ring_size = r->cq_ring_size;
+        r->cq_ring_size = r->sq_ring_size;
+    }
+    r->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED) r->sq_ring = NULL;
+    if (r->sq_ring && (params.features & IORING_FEAT_SINGLE_MMAP)) {
+        r->cq_ring = r->sq_ring;
+    } else if (r->sq_ring) {
+        r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED) r->cq_ring = NULL;
+    }
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) r->sqes = NULL;
+    if (!r->sq_ring || !r->cq_ring || !r->sqes) {
+        uring_free(&r);
+        return URING_ERROR;
+    }
+
+    char *sq = r->sq_ring;
+    r->sq_head = (unsigned int *) (sq + params.sq_off.head);
+    r->sq_tail = (unsigned int *) (sq + params.sq_off.tail);
+    r->sq_mask = *(unsigned int *) (sq + params.sq_off.ring_mask);
+    r->sq_entries = params.sq_entries;
+    r->sqe_tail = *r->sq_tail;
+    // Entries are always handed out in ring order, so the indirection array maps every slot to itself
+    unsigned int *array = (unsigned int *) (sq + params.sq_off.array);
+    for (unsigned int i = 0; i < params.sq_entries; i++) array[i] = i;
+
+    char *cq = r->cq_ring;
+    r->cq_head = (unsigned int *) (cq + params.cq_off.head);
+    r->cq_tail = (unsigned int *) (cq + params.cq_off.tail);
+    r->cq_mask = *(unsigned int *) (cq + params.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    *ring = r;
+    return URING_NO_ERROR;
+}
+
+void uring_free(uring_t **ring) {
+    if (!ring || !*ring) return;
+    uring_t *r = *ring;
+
+    // Closing the ring ends all requests, only then the kernel lets go of the buffers
+    if (r->fd >= 0) close(r->fd);
+    if (r->sqes) munmap(r->sqes, r->sqes_size);
+    if (r->cq_ring && r->cq_ring != r->sq_ring) munmap(r->cq_ring, r->cq_ring_size);
+    if (r->sq_ring) munmap(r->sq_ring, r->sq_ring_size);
+    if (r->buf_ring) munmap(r->buf_ring, r->buf_ring_size);
+    free(r->buffers);
+    free(r);
+    *ring = NULL;
+}
+
+int uring_provide_buffers(uring_t *ring, unsigned short group, unsigned int count, unsigned int size) {
+    if (ring->buf_ring || count == 0 || count > 32768 || (count & (count - 1)) != 0) return URING_ERROR;
+
+    // The kernel needs the buffer ring page aligned
+    ring->buf_ring_size = count * sizeof(struct io_uring_buf);
+    void *buf_ring = mmap(NULL, ring->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf_ring == MAP_FAILED) return URING_ERROR;
+    ring->buffers = malloc((size_t) count * size);
+    if (!ring->buffers) {
+        munmap(buf_ring, ring->buf_ring_size);
+        return URING_ERROR;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long) buf_ring;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        int unsupported = errno == EINVAL;
+        munmap(buf_ring, ring->buf_ring_size);
+        free(ring->buffers);
+        ring->buffers = NULL;
+        return unsupported ? URING_UNSUPPORTED : URING_ERROR;
+    }
+
+    ring->buf_ring = buf_ring;
+    ring->buffer_count = count;
+    ring->buffer_size = size;
+    ring->buf_tail = 0;
+    for (unsigned int id = 0; id < count; id++) uring_buffer_recycle(ring, (unsigned short) id);
+    return URING_NO_ERROR;
+}
+
+void *uring_buffer(uring_t *ring, unsigned short id) {
+    return ring->buffers + (size_t) id * ring->buffer_size;
+}
+
+void uring_buffer_recycle(uring_t *ring, unsigned short id) {
+    struct io_uring_buf *buf = &ring->buf_ring->bufs[ring->buf_tail & (ring->buffer_count - 1)];
+    buf->addr = (unsigned long) uring_buffer(ring, id);
+    buf->len = ring->buffer_size;
+    buf->bid = id;
+    ring->buf_tail++;
+    URING_STORE_RELEASE(&ring->buf_ring->tail, ring->buf_tail);
+}
+
+struct io_uring_sqe *uring_get_sqe(uring_t *ring) {
+    if (ring->sqe_tail - URING_LOAD_ACQUIRE(ring->sq_head) >= ring->sq_entries) {
+        uring_submit_and_wait(ring, 0, -1);
+        if (ring->sqe_tail - URING_LOAD_ACQUIRE(ring->sq_head) >= ring->sq_entries) return NULL;
+    }
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+    ring->sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+void uring_prep_accept_multishot(struct io_uring_sqe *sqe, int sd, unsigned long long user_data) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = sd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = user_data;
+}
+
+void uring_prep_accept(struct io_uring_sqe *sqe, int sd, unsigned long long user_data) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = sd;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = user_data;
+}
+
+void uring_prep_recv_multishot(struct io_uring_sqe *sqe, int sd, unsigned short group, unsigned long long user_data) {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = group;
+    sqe->user_data = user_data;
+}
+
+void uring_prep_poll(struct io_uring_sqe *sqe, int fd, unsigned int events, unsigned long long user_data) {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->user_data = user_data;
+}
+
+void uring_prep_cancel(struct io_uring_sqe *sqe, unsigned long long target, unsigned long long user_data) {
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = user_data;
+}
+
+int uring_submit_and_wait(uring_t *ring, unsigned int wait, int timeout_ms) {
+    // Entries the kernel didn't consume on an earlier call are submitted again
+    unsigned int submit = ring->sqe_tail - URING_LOAD_ACQUIRE(ring->sq_head);
+    URING_STORE_RELEASE(ring->sq_tail, ring->sqe_tail);
+
+    int result;
+    if (wait > 0 && timeout_ms >= 0) {
+        // The timeout is passed as an extended argument, so no timeout request has to be queued on the ring
+        struct __kernel_timespec ts = { .tv_sec = timeout_ms / 1000, .tv_nsec = (timeout_ms % 1000) * 1000000LL };
+        struct io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (unsigned long long) (uintptr_t) &ts;
+        result = uring_enter(ring->fd, submit, wait, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    } else {
+        result = uring_enter(ring->fd, submit, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    }
+    if (result < 0) return (errno == EINTR || errno == ETIME) ? 0 : -errno;
+    return result;
+}
+
+struct io_uring_cqe *uring_peek_cqe(uring_t *ring) {
+    unsigned int head = *ring->cq_head;
+    if (head == URING_LOAD_ACQUIRE(ring->cq_tail)) return NULL;
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(uring_t *ring) {
+    URING_STORE_RELEASE(ring->cq_head, *ring->cq_head + 1);
+}
@@ -0,0 +1,113 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+
+#define URING_NO_ERROR 0
+#define URING_UNSUPPORTED 1     // the kernel has no io_uring, or lacks multishot accept/recv, provided buffer rings or wait timeouts
+#define URING_ERROR 2           // setting up the ring failed for another reason (memory, limits, ...)
+
+typedef struct uring uring_t;
+
+/**
+ * Creates a new io_uring with room for 'entries' submissions, using the raw system calls
+ * The kernel must support multishot accept, multishot recv and provided buffer rings (Linux 6.0 and newer)
+ * \param ring a double pointer, that will be filled out with the new ring
+ * \param entries the number of submission queue entries, rounded up by the kernel to a power of two
+ * \return URING_NO_ERROR on success, URING_UNSUPPORTED if the kernel can't run the ring, URING_ERROR otherwise
+ */
+int uring_init(uring_t **ring, unsigned int entries);
+
+/**
+ * Frees the ring '*ring', its provided buffers and sets '*ring' to NULL
+ * Requests that are still in flight are cancelled by the kernel
+ * \param ring a double pointer to the ring
+ */
+void uring_free(uring_t **ring);
+
+/**
+ * Registers 'count' provided receive buffers of 'size' bytes each as buffer group 'group'
+ * Multishot receives of that group pick a free buffer themselves, the id of the buffer is in the flags of the completion
+ * Only a single buffer group per ring is supported
+ * \param ring the ring
+ * \param group the id of the buffer group
+ * \param count the number of buffers, a power of two no larger than 32768
+ * \param size the size of every buffer in bytes
+ * \return URING_NO_ERROR on success, URING_UNSUPPORTED if the kernel has no provided buffer rings, URING_ERROR otherwise
+ */
+int uring_provide_buffers(uring_t *ring, unsigned short group, unsigned int count, unsigned int size);
+
+/**
+ * Returns the provided buffer with id 'id'
+ * \param ring the ring
+ * \param id the id of the buffer, taken from a completion with IORING_CQE_F_BUFFER set
+ * \return a pointer to the buffer
+ */
+void *uring_buffer(uring_t *ring, unsigned short id);
+
+/**
+ * Hands the provided buffer with id 'id' back to the kernel, once its data is no longer needed
+ * \param ring the ring
+ * \param id the id of the buffer
+ */
+void uring_buffer_recycle(uring_t *ring, unsigned short id);
+
+/**
+ * Returns the next free submission queue entry, cleared
+ * If the submission queue is full, the queued entries are submitted first
+ * \param ring the ring
+ * \return a pointer to the entry, NULL if no entry is free
+ */
+struct io_uring_sqe *uring_get_sqe(uring_t *ring);
+
+/**
+ * Prepares 'sqe' to accept connections on the listening socket 'sd' until it is cancelled
+ * Every accepted connection gives a completion with the new socket descriptor as result
+ */
+void uring_prep_accept_multishot(struct io_uring_sqe *sqe, int sd, unsigned long long user_data);
+
+/**
+ * Prepares 'sqe' to accept a single connection on the listening socket 'sd', the completion ends the accept
+ */
+void uring_prep_accept(struct io_uring_sqe *sqe, int sd, unsigned long long user_data);
+
+/**
+ * Prepares 'sqe' to receive from socket 'sd' into buffers of group 'group' until the connection is closed
+ * Every chunk of data gives a completion, a completion without IORING_CQE_F_MORE ends the receive
+ */
+void uring_prep_recv_multishot(struct io_uring_sqe *sqe, int sd, unsigned short group, unsigned long long user_data);
+
+/**
+ * Prepares 'sqe' to wait once until file descriptor 'fd' has one of the poll 'events' (POLLIN, ...)
+ * The completion has the events that occurred as result
+ */
+void uring_prep_poll(struct io_uring_sqe *sqe, int fd, unsigned int events, unsigned long long user_data);
+
+/**
+ * Prepares 'sqe' to cancel the request that was submitted with user data 'target'
+ */
+void uring_prep_cancel(struct io_uring_sqe *sqe, unsigned long long target, unsigned long long user_data);
+
+/**
+ * Submits the queued entries and waits until at least 'wait' completions are available, or 'timeout_ms' has passed
+ * \param ring the ring
+ * \param wait the number of completions to wait for, 0 to only submit
+ * \param timeout_ms the longest time to wait in milliseconds, -1 to wait without a timeout
+ * \return the number of submitted entries, -errno if an error occurred. A signal or the timeout ending the wait is not an error.
+ */
+int uring_submit_and_wait(uring_t *ring, unsigned int wait, int timeout_ms);
+
+/**
+ * Returns the oldest completion without waiting, it stays valid until uring_cqe_seen
+ * \param ring the ring
+ * \return a pointer to the completion, NULL if there is none
+ */
+struct io_uring_cqe *uring_peek_cqe(uring_t *ring);
+
+/**
+ * Marks the completion returned by uring_peek_cqe as consumed
+ * \param ring the ring
+ */
+void uring_cqe_seen(uring_t *ring);
+
+#endif // URING_H
@@ -0,0 +1,161 @@
+#define _GNU_SOURCE
+
+#include "window.h"
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_CAPACITY 16     // of a window in time, it doubles whenever it is full
+
+#define VALUE(window, seq) ((window)->values[(seq) % (window)->capacity])
+#define TIME(window, seq) ((window)->times[(seq) % (window)->capacity])
+#define QUEUE(window, queue, position) ((window)->queue[(position) % (window)->capacity])
+
+int window_parse(const char *text, window_spec_t *spec) {
+    char *end;
+    errno = 0;
+    long length = strtol(text, &end, 10);
+    if (errno || end == text || length <= 0) return -1;
+
+    if (*end == '\0') {
+        if (length > WINDOW_MAX_SAMPLES) return -1;
+        spec->samples = (int) length;
+        spec->seconds = 0;
+        return 0;
+    }
+    if (strcmp(end, "s") == 0) {
+        if (length > WINDOW_MAX_SECONDS) return -1;
+        spec->samples = 0;
+        spec->seconds = (int) length;
+        return 0;
+    }
+    return -1;
+}
+
+// Allocates the rings with room for 'capacity' samples and moves the samples and the deques over
+static int window_resize(window_t *window, int capacity) {
+    double *values = malloc(capacity * sizeof(double));
+    time_t *times = malloc(capacity * sizeof(time_t));
+    uint64_t *min_queue = malloc(capacity * sizeof(uint64_t));
+    uint64_t *max_queue = malloc(capacity * sizeof(uint64_t));
+    if (!values || !times || !min_queue || !max_queue) {
+        free(values);
+        free(times);
+        free(min_queue);
+        free(max_queue);
+        return -1;
+    }
+
+    // Nothing collides, as the window never holds more samples than the old capacity
+    for (uint64_t seq = window->first; seq < window->next; seq++) {
+        values[seq % capacity] = VALUE(window, seq);
+        times[seq % capacity] = TIME(window, seq);
+    }
+    for (uint64_t position = window->min_head; position < window->min_tail; position++) {
+        min_queue[position % capacity] = QUEUE(window, min_queue, position);
+    }
+    for (uint64_t position = window->max_head; position < window->max_tail; position++) {
+        max_queue[position % capacity] = QUEUE(window, max_queue, position);
+    }
+
+    window_free(window);
+    window->values = values;
+    window->times = times;
+    window->min_queue = min_queue;
+    window->max_queue = max_queue;
+    window->capacity = capacity;
+    return 0;
+}
+
+int window_init(window_t *window, window_spec_t spec) {
+    memset(window, 0, sizeof(window_t));
+    window->spec = spec;
+    return window_resize(window, spec.samples > 0 ? spec.samples : INITIAL_CAPACITY);
+}
+
+// Recomputes the sums from the samples, so the rounding errors of the subtractions don't pile up
+static void window_resum(window_t *window) {
+    window->sum = window->sum_squares = 0.0;
+    for (uint64_t seq = window->first; seq < window->next; seq++) {
+        double value = VALUE(window, seq);
+        window->sum += value;
+        window->sum_squares += value * value;
+    }
+    window->evicted = 0;
+}
+
+// Drops the oldest sample from the window
+static void window_evict(window_t *window) {
+    double value = VALUE(window, window->first);
+    window->sum -= value;
+    window->sum_squares -= value * value;
+    if (QUEUE(window, min_queue, window->min_head) == window->first) window->min_head++;
+    if (QUEUE(window, max_queue, window->max_head) == window->first) window->max_head++;
+    window->first++;
+
+    // A full pass every 'capacity' evictions keeps the cost per sample constant
+    if (++window->evicted >= window->capacity) window_resum(window);
+}
+
+void window_add(window_t *window, double value, time_t ts) {
+    if (window->spec.samples > 0) {
+        if (window_count(window) == window->spec.samples) window_evict(window);
+    } else {
+        while (window_count(window) > 0 && TIME(window, window->first) <= ts - window->spec.seconds) {
+            window_evict(window);
+        }
+        if (window_count(window) == window->capacity) {
+            // A window that can't grow any further keeps the newest samples, it just covers less time
+            int capacity = window->capacity * 2 > WINDOW_MAX_SAMPLES ? WINDOW_MAX_SAMPLES : window->capacity * 2;
+            if (capacity == window->capacity || window_resize(window, capacity) != 0) window_evict(window);
+        }
+    }
+
+    uint64_t seq = window->next++;
+    VALUE(window, seq) = value;
+    TIME(window, seq) = ts;
+    window->sum += value;
+    window->sum_squares += value * value;
+
+    // The samples this one outlives and beats can never become the minimum or maximum anymore
+    while (window->min_tail > window->min_head && VALUE(window, QUEUE(window, min_queue, window->min_tail - 1)) >= value) {
+        window->min_tail--;
+    }
+    QUEUE(window, min_queue, window->min_tail++) = seq;
+    while (window->max_tail > window->max_head && VALUE(window, QUEUE(window, max_queue, window->max_tail - 1)) <= value) {
+        window->max_tail--;
+    }
+    QUEUE(window, max_queue, window->max_tail++) = seq;
+}
+
+double window_mean(const window_t *window) {
+    int count = window_count(window);
+    return count > 0 ? window->sum / count : 0.0;
+}
+
+double window_stddev(const window_t *window) {
+    int count = window_count(window);
+    if (count == 0) return 0.0;
+    double mean = window->sum / count;
+    double variance = window->sum_squares / count - mean * mean;
+    return variance > 0.0 ? sqrt(variance) : 0.0;
+}
+
+double window_min(const window_t *window) {
+    return window_count(window) > 0 ? VALUE(window, QUEUE(window, min_queue, window->min_head)) : 0.0;
+}
+
+double window_max(const window_t *window) {
+    return window_count(window) > 0 ? VALUE(window, QUEUE(window, max_queue, window->max_head)) : 0.0;
+}
+
+void window_free(window_t *window) {
+    free(window->values);
+    free(window->times);
+    free(window->min_queue);
+    free(window->max_queue);
+    window->values = NULL;
+    window->times = NULL;
+    window->min_queue = window->max_queue = NULL;
+}
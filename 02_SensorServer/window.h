@@ -0,0 +1,120 @@
+#ifndef WINDOW_H
+#define WINDOW_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define WINDOW_MAX_SAMPLES 65536        // longest window in samples, a window in time grows to at most this many
+#define WINDOW_MAX_SECONDS 86400        // longest window in time
+
+/**
+ * Length of a sliding window, either in samples or in time
+ *
+ * @param samples Number of most recent samples the window holds, 0 for a window in time
+ * @param seconds Age in seconds of the oldest sample the window holds, 0 for a window in samples
+ */
+typedef struct {
+    int samples;
+    int seconds;
+} window_spec_t;
+
+/**
+ * Sliding window over the values of a sensor, with incrementally maintained aggregates, not thread-safe
+ *
+ * The samples are kept in a ring indexed by their sequence number. The sum and the sum of squares are updated with
+ * every sample that enters or leaves the window, and the minimum and maximum are at the front of two monotonic deques
+ * (rings of sequence numbers, with increasing and decreasing values respectively), so adding a sample is amortized
+ * O(1) no matter how long the window is.
+ *
+ * @param spec Length of the window
+ * @param values Values of the samples, by sequence number modulo 'capacity'
+ * @param times Timestamps of the samples, by sequence number modulo 'capacity'
+ * @param min_queue Sequence numbers of the samples that can still become the minimum, by position modulo 'capacity'
+ * @param max_queue Sequence numbers of the samples that can still become the maximum, by position modulo 'capacity'
+ * @param capacity Number of samples the rings have room for
+ * @param first Sequence number of the oldest sample in the window
+ * @param next Sequence number of the next sample
+ * @param min_head Position of the front of min_queue
+ * @param min_tail Position after the back of min_queue
+ * @param max_head Position of the front of max_queue
+ * @param max_tail Position after the back of max_queue
+ * @param sum Sum of the values in the window
+ * @param sum_squares Sum of the squares of the values in the window
+ * @param evicted Samples that left the window since the sums were last recomputed from scratch
+ */
+typedef struct {
+    window_spec_t spec;
+    double *values;
+    time_t *times;
+    uint64_t *min_queue;
+    uint64_t *max_queue;
+    int capacity;
+    uint64_t first;
+    uint64_t next;
+    uint64_t min_head;
+    uint64_t min_tail;
+    uint64_t max_head;
+    uint64_t max_tail;
+    double sum;
+    double sum_squares;
+    int evicted;
+} window_t;
+
+/**
+ * Parses a window length: "<n>" for a window of n samples, "<n>s" for a window of n seconds
+ * \param text the text to parse
+ * \param spec the parsed length
+ * \return 0 on success, -1 if the text isn't a valid window length
+ */
+int window_parse(const char *text, window_spec_t *spec);
+
+/**
+ * Sets up an empty 'window' of length 'spec'
+ * \param window the window
+ * \param spec the length, as returned by window_parse
+ * \return 0 on success, -1 if memory allocation failed
+ */
+int window_init(window_t *window, window_spec_t spec);
+
+/**
+ * Adds a sample to 'window', dropping the samples that fall out of it
+ * \param window the window
+ * \param value the value of the sample
+ * \param ts the timestamp of the sample, a window in time ends at the newest timestamp. A window in time that holds
+ * WINDOW_MAX_SAMPLES samples, or can't get the memory to grow, drops its oldest sample to make room.
+ */
+void window_add(window_t *window, double value, time_t ts);
+
+/**
+ * Returns the number of samples in 'window'
+ */
+static inline int window_count(const window_t *window) {
+    return (int) (window->next - window->first);
+}
+
+/**
+ * Returns the average of the samples in 'window', 0 if it is empty
+ */
+double window_mean(const window_t *window);
+
+/**
+ * Returns the standard deviation of the samples in 'window', 0 if it is empty
+ */
+double window_stddev(const window_t *window);
+
+/**
+ * Returns the smallest sample in 'window', 0 if it is empty
+ */
+double window_min(const window_t *window);
+
+/**
+ * Returns the largest sample in 'window', 0 if it is empty
+ */
+double window_max(const window_t *window);
+
+/**
+ * Releases the memory of 'window', which has to be set up again before it is used
+ */
+void window_free(window_t *window);
+
+#endif // WINDOW_H